@@ -0,0 +1,129 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Log-linear latency histogram, for the round trip measurements of the
+ * applications. Each power of two range of values is split into
+ * LATENCY_HIST_SUB_COUNT linear buckets, which bounds the relative error of
+ * a reported value to 1 / LATENCY_HIST_SUB_COUNT over the whole 64-bit
+ * range. The memory is fixed, recording a sample costs a bit scan and an
+ * increment, without any allocation.
+ */
+
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define LATENCY_HIST_SUB_BITS	5
+#define LATENCY_HIST_SUB_COUNT	(1U << LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_BUCKETS	\
+	((64 - LATENCY_HIST_SUB_BITS + 1) << LATENCY_HIST_SUB_BITS)
+/* Percentiles are given in parts per million, as 999000 for p99.9 */
+#define LATENCY_HIST_PPM	1000000ULL
+
+struct latency_hist {
+	uint64_t counts[LATENCY_HIST_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+static inline void latency_hist_reset(struct latency_hist *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+	hist->min = UINT64_MAX;
+}
+
+static inline unsigned int latency_hist_index(uint64_t value)
+{
+	unsigned int msb, shift;
+
+	if (value < 2 * LATENCY_HIST_SUB_COUNT)
+		return value;
+	msb = 63 - __builtin_clzll(value);
+	shift = msb - LATENCY_HIST_SUB_BITS;
+	return (shift << LATENCY_HIST_SUB_BITS) + (value >> shift);
+}
+
+/* Highest value counted in the bucket */
+static inline uint64_t latency_hist_bucket_value(unsigned int index)
+{
+	unsigned int shift = index >> LATENCY_HIST_SUB_BITS;
+
+	if (shift <= 1)
+		return index;
+	shift--;
+	return ((uint64_t)(index - (shift << LATENCY_HIST_SUB_BITS) + 1) <<
+		shift) - 1;
+}
+
+/**
+ * latency_hist_record - record a sample
+ *
+ * @hist: histogram
+ * @value: sample value, as a latency in ns
+ */
+static inline void latency_hist_record(struct latency_hist *hist,
+				       uint64_t value)
+{
+	hist->counts[latency_hist_index(value)]++;
+	hist->total++;
+	hist->sum += value;
+	if (value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+}
+
+/**
+ * latency_hist_value_at - get the value at a percentile
+ *
+ * @hist: histogram
+ * @ppm: percentile in parts per million, from 0 for the minimum to
+ *	 LATENCY_HIST_PPM for the maximum
+ *
+ * return the highest value of the bucket holding the percentile, within
+ * the recorded minimum and maximum, or 0 if no sample is recorded
+ */
+static inline uint64_t latency_hist_value_at(const struct latency_hist *hist,
+					     uint64_t ppm)
+{
+	uint64_t rank, count = 0, value;
+	unsigned int i;
+
+	if (!hist->total)
+		return 0;
+	rank = (hist->total * ppm + LATENCY_HIST_PPM - 1) / LATENCY_HIST_PPM;
+	if (!rank)
+		return hist->min;
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		count += hist->counts[i];
+		if (count >= rank)
+			break;
+	}
+	value = latency_hist_bucket_value(i);
+	if (value < hist->min)
+		return hist->min;
+	if (value > hist->max)
+		return hist->max;
+	return value;
+}
+
+static inline uint64_t latency_hist_mean(const struct latency_hist *hist)
+{
+	return hist->total ? hist->sum / hist->total : 0;
+}
+
+#if defined __cplusplus
+}
+#endif
+
+#endif /* LATENCY_HIST_H */
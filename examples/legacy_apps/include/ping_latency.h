@@ -0,0 +1,211 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Round trip latency mode of the ping applications: options, open loop
+ * schedule and report of the round trips, recorded in latency histograms.
+ * The application provides the round trip of one message.
+ *
+ * The latencies are in ns of metal_get_timestamp(), which is only the case
+ * on Linux: elsewhere the timestamp counts machine specific ticks, or is not
+ * implemented, so the mode is refused. The histograms are only allocated
+ * for the run, so that the images which do not use the mode do not hold
+ * them.
+ */
+
+#ifndef PING_LATENCY_H
+#define PING_LATENCY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <metal/alloc.h>
+#include <metal/time.h>
+#include "latency_hist.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define PING_LATENCY_OPTS	"ln:s:w:r:"
+#define PING_LATENCY_NUMS_DEF	10000
+#define PING_LATENCY_SIZE_DEF	16
+#define PING_LATENCY_NS_PER_S	(1000ULL * 1000 * 1000)
+/* Reads of the timestamp for it to advance before it is deemed broken */
+#define PING_LATENCY_TS_PROBES	1000000
+
+struct ping_latency {
+	int enabled;
+	int size;
+	unsigned long nums;
+	unsigned long warmup;
+	unsigned long rate;
+	/* Actual send time of the message in flight */
+	unsigned long long tsend;
+	/*
+	 * From the intended send time, and from the actual send time,
+	 * allocated by ping_latency_run()
+	 */
+	struct latency_hist *response;
+	struct latency_hist *service;
+};
+
+/*
+ * Round trip of message num stamped with ts: send it, then poll until its
+ * echo is received. Return 0 on success, a negative value on failure.
+ */
+typedef int (*ping_latency_round_trip)(void *arg, unsigned long num,
+				       unsigned long long ts);
+
+static inline void ping_latency_init(struct ping_latency *pl)
+{
+	memset(pl, 0, sizeof(*pl));
+	pl->size = PING_LATENCY_SIZE_DEF;
+	pl->nums = PING_LATENCY_NUMS_DEF;
+}
+
+/* Parse an option of PING_LATENCY_OPTS, return 0 if opt is not one of them */
+static inline int ping_latency_option(struct ping_latency *pl, int opt,
+				      const char *arg)
+{
+	switch (opt) {
+	case 'l':
+		pl->enabled = 1;
+		break;
+	case 'n':
+		pl->nums = strtoul(arg, NULL, 0);
+		break;
+	case 's':
+		pl->size = strtol(arg, NULL, 0);
+		break;
+	case 'w':
+		pl->warmup = strtoul(arg, NULL, 0);
+		break;
+	case 'r':
+		pl->rate = strtoul(arg, NULL, 0);
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+static inline void ping_latency_help(const char *prog)
+{
+	printf("usage: %s [-l [-n msgs] [-s size] [-w warmup] [-r rate]] [platform args]\r\n",
+	       prog);
+	printf("  -l  measure the round trip latency instead of the payload sizes sweep\r\n");
+	printf("  -n  number of measured messages, default %d\r\n",
+	       PING_LATENCY_NUMS_DEF);
+	printf("  -s  payload size, default %d\r\n", PING_LATENCY_SIZE_DEF);
+	printf("  -w  number of warm-up messages excluded from the results\r\n");
+	printf("  -r  open loop send rate in msgs/s, default closed loop\r\n");
+}
+
+/* Record the echo of message num stamped with ts, received at now */
+static inline void ping_latency_record(struct ping_latency *pl,
+				       unsigned long num, unsigned long long ts,
+				       unsigned long long now)
+{
+	if (num < pl->warmup)
+		return;
+	latency_hist_record(pl->response, now - ts);
+	latency_hist_record(pl->service, now - pl->tsend);
+}
+
+/* Whether metal_get_timestamp() is a running ns clock */
+static inline int ping_latency_clock_ok(void)
+{
+#ifdef __linux__
+	unsigned long long t0 = metal_get_timestamp();
+	unsigned long i;
+
+	for (i = 0; i < PING_LATENCY_TS_PROBES; i++) {
+		if (metal_get_timestamp() != t0)
+			return 1;
+	}
+	printf("ERROR: timestamp does not advance, no latency mode.\r\n");
+#else
+	printf("ERROR: latency mode needs the ns timestamp of Linux.\r\n");
+#endif
+	return 0;
+}
+
+static inline void ping_latency_print(const char *name,
+				      const struct latency_hist *hist)
+{
+	printf("%-8s min %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu mean %llu\r\n",
+	       name,
+	       (unsigned long long)hist->min,
+	       (unsigned long long)latency_hist_value_at(hist, 500000),
+	       (unsigned long long)latency_hist_value_at(hist, 900000),
+	       (unsigned long long)latency_hist_value_at(hist, 990000),
+	       (unsigned long long)latency_hist_value_at(hist, 999000),
+	       (unsigned long long)hist->max,
+	       (unsigned long long)latency_hist_mean(hist));
+}
+
+/*
+ * Round trips of one message at a time, recorded in the histograms. With a
+ * rate, the messages are sent on an open loop schedule and the response
+ * latency is measured from the intended send time, so that a slow round
+ * trip delaying the next sends is accounted for in the tail, instead of
+ * being omitted.
+ */
+static inline int ping_latency_run(struct ping_latency *pl,
+				   ping_latency_round_trip round_trip,
+				   void *arg)
+{
+	unsigned long long interval = pl->rate ?
+				      PING_LATENCY_NS_PER_S / pl->rate : 0;
+	unsigned long long next, tstart, tdiff;
+	unsigned long i;
+	int ret = 0;
+
+	if (!ping_latency_clock_ok())
+		return -1;
+	pl->response = metal_allocate_memory(2 * sizeof(*pl->response));
+	if (!pl->response) {
+		printf("ERROR: latency histograms allocation failed.\r\n");
+		return -1;
+	}
+	pl->service = pl->response + 1;
+	latency_hist_reset(pl->response);
+	latency_hist_reset(pl->service);
+
+	tstart = metal_get_timestamp();
+	next = tstart;
+	for (i = 0; i < pl->warmup + pl->nums; i++) {
+		/* Wait for the intended send time of the open loop */
+		while (interval && metal_get_timestamp() < next)
+			;
+		pl->tsend = metal_get_timestamp();
+		ret = round_trip(arg, i, interval ? next : pl->tsend);
+		if (ret < 0)
+			break;
+		next += interval;
+	}
+	tdiff = metal_get_timestamp() - tstart;
+
+	printf("round trip latency in ns, %llu samples of %d bytes, %lu warm-up\r\n",
+	       (unsigned long long)pl->service->total, pl->size, pl->warmup);
+	if (interval) {
+		printf("open loop at %lu msgs/s, achieved %llu msgs/s\r\n",
+		       pl->rate, tdiff ?
+		       (unsigned long long)i * PING_LATENCY_NS_PER_S / tdiff :
+		       0ULL);
+		ping_latency_print("response", pl->response);
+	}
+	ping_latency_print("service", pl->service);
+	metal_free_memory(pl->response);
+	pl->response = NULL;
+	pl->service = NULL;
+	return ret < 0 ? ret : 0;
+}
+
+#if defined __cplusplus
+}
+#endif
+
+#endif /* PING_LATENCY_H */
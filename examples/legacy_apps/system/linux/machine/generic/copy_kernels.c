@@ -0,0 +1,174 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Copy kernels for the shared memory I/O region of the Linux generic
+ * machine. Small payloads are copied with overlapping fixed-size moves,
+ * larger ones with AVX2 or NEON vectors when available, and with
+ * non-temporal stores from a threshold for the buffers handed to the peer.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include "copy_kernels.h"
+
+#define COPY_SMALL_MAX	64
+
+typedef void (*copy_fn)(unsigned char *d, const unsigned char *s, size_t len);
+
+static size_t copy_nt_threshold = COPY_NT_DEF_THRESHOLD;
+
+/*
+ * Up to COPY_SMALL_MAX bytes, with two overlapping copies of a fixed size
+ * which the compiler turns into plain loads and stores.
+ */
+static inline void copy_small(unsigned char *d, const unsigned char *s,
+			      size_t len)
+{
+	if (len >= 32) {
+		memcpy(d, s, 32);
+		memcpy(d + len - 32, s + len - 32, 32);
+	} else if (len >= 16) {
+		memcpy(d, s, 16);
+		memcpy(d + len - 16, s + len - 16, 16);
+	} else if (len >= 8) {
+		memcpy(d, s, 8);
+		memcpy(d + len - 8, s + len - 8, 8);
+	} else if (len >= 4) {
+		memcpy(d, s, 4);
+		memcpy(d + len - 4, s + len - 4, 4);
+	} else if (len) {
+		d[0] = s[0];
+		d[len / 2] = s[len / 2];
+		d[len - 1] = s[len - 1];
+	}
+}
+
+static void copy_memcpy(unsigned char *d, const unsigned char *s, size_t len)
+{
+	memcpy(d, s, len);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static void copy_avx2(unsigned char *d, const unsigned char *s, size_t len)
+{
+	__m256i a, b, c, e;
+
+	for (; len >= 128; len -= 128, d += 128, s += 128) {
+		a = _mm256_loadu_si256((const __m256i *)s);
+		b = _mm256_loadu_si256((const __m256i *)(s + 32));
+		c = _mm256_loadu_si256((const __m256i *)(s + 64));
+		e = _mm256_loadu_si256((const __m256i *)(s + 96));
+		_mm256_storeu_si256((__m256i *)d, a);
+		_mm256_storeu_si256((__m256i *)(d + 32), b);
+		_mm256_storeu_si256((__m256i *)(d + 64), c);
+		_mm256_storeu_si256((__m256i *)(d + 96), e);
+	}
+	for (; len > COPY_SMALL_MAX; len -= 32, d += 32, s += 32)
+		_mm256_storeu_si256((__m256i *)d,
+				    _mm256_loadu_si256((const __m256i *)s));
+	copy_small(d, s, len);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2_nt(unsigned char *d, const unsigned char *s, size_t len)
+{
+	size_t head = -(uintptr_t)d & 31;
+
+	/* Streaming stores need an aligned destination */
+	copy_small(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		_mm256_stream_si256((__m256i *)d,
+				    _mm256_loadu_si256((const __m256i *)s));
+		_mm256_stream_si256((__m256i *)(d + 32),
+				    _mm256_loadu_si256((const __m256i *)(s + 32)));
+	}
+	/* Order the streaming stores before the buffer is handed over */
+	_mm_sfence();
+	copy_small(d, s, len);
+}
+#elif defined(__aarch64__)
+static void copy_neon(unsigned char *d, const unsigned char *s, size_t len)
+{
+	uint8x16_t a, b, c, e;
+
+	for (; len >= 64; len -= 64, d += 64, s += 64) {
+		a = vld1q_u8(s);
+		b = vld1q_u8(s + 16);
+		c = vld1q_u8(s + 32);
+		e = vld1q_u8(s + 48);
+		vst1q_u8(d, a);
+		vst1q_u8(d + 16, b);
+		vst1q_u8(d + 32, c);
+		vst1q_u8(d + 48, e);
+	}
+	copy_small(d, s, len);
+}
+
+static void copy_neon_nt(unsigned char *d, const unsigned char *s, size_t len)
+{
+	uint8x16_t a, b;
+
+	for (; len >= 32; len -= 32, d += 32, s += 32) {
+		a = vld1q_u8(s);
+		b = vld1q_u8(s + 16);
+		__asm__ volatile("stnp %q0, %q1, [%2]"
+				 : : "w"(a), "w"(b), "r"(d) : "memory");
+	}
+	copy_small(d, s, len);
+}
+#endif
+
+static copy_fn copy_bulk = copy_memcpy;
+static copy_fn copy_bulk_nt = copy_memcpy;
+static const char *copy_bulk_name = "memcpy";
+
+void copy_kernels_init(size_t nt_threshold)
+{
+	copy_nt_threshold = nt_threshold;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		copy_bulk = copy_avx2;
+		copy_bulk_nt = copy_avx2_nt;
+		copy_bulk_name = "avx2";
+	}
+#elif defined(__aarch64__)
+	copy_bulk = copy_neon;
+	copy_bulk_nt = copy_neon_nt;
+	copy_bulk_name = "neon";
+#endif
+}
+
+const char *copy_kernels_name(void)
+{
+	return copy_bulk_name;
+}
+
+void copy_kernel(void *dst, const void *src, size_t len)
+{
+	if (len <= COPY_SMALL_MAX)
+		copy_small(dst, src, len);
+	else
+		copy_bulk(dst, src, len);
+}
+
+void copy_kernel_stream(void *dst, const void *src, size_t len)
+{
+	if (len <= COPY_SMALL_MAX)
+		copy_small(dst, src, len);
+	else if (copy_nt_threshold && len >= copy_nt_threshold)
+		copy_bulk_nt(dst, src, len);
+	else
+		copy_bulk(dst, src, len);
+}
@@ -0,0 +1,64 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Copy kernels for the shared memory I/O region of the Linux generic
+ * machine, selected by payload size and CPU features.
+ */
+
+#ifndef COPY_KERNELS_H_
+#define COPY_KERNELS_H_
+
+#include <stddef.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Default size from which copy_kernel_stream() bypasses the cache */
+#define COPY_NT_DEF_THRESHOLD	(32 * 1024)
+
+/**
+ * copy_kernels_init - select the copy kernels for the CPU
+ *
+ * @nt_threshold: size from which copy_kernel_stream() uses non-temporal
+ *		  stores, 0 to never use them
+ */
+void copy_kernels_init(size_t nt_threshold);
+
+/**
+ * copy_kernels_name - name of the selected bulk copy kernel
+ *
+ * return "avx2", "neon" or "memcpy"
+ */
+const char *copy_kernels_name(void);
+
+/**
+ * copy_kernel - copy a buffer the local CPU is going to read
+ *
+ * Fixed-size copies up to 64 bytes, vector copies above.
+ *
+ * @dst: destination buffer
+ * @src: source buffer, not overlapping dst
+ * @len: size to copy
+ */
+void copy_kernel(void *dst, const void *src, size_t len);
+
+/**
+ * copy_kernel_stream - copy a buffer the local CPU is not going to read
+ *
+ * As copy_kernel(), but with non-temporal stores from the threshold given
+ * to copy_kernels_init(), so that the copy does not evict the local cache.
+ *
+ * @dst: destination buffer
+ * @src: source buffer, not overlapping dst
+ * @len: size to copy
+ */
+void copy_kernel_stream(void *dst, const void *src, size_t len);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif /* COPY_KERNELS_H_ */
@@ -18,21 +18,42 @@
  *
  **************************************************************************/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memfd_create() */
+#endif
+
 #include <metal/alloc.h>
 #include <metal/atomic.h>
+#include <metal/cpu.h>
 #include <metal/io.h>
 #include <metal/irq.h>
+#include <metal/mutex.h>
 #include <metal/shmem.h>
 #include <metal/utilities.h>
 #include <openamp/remoteproc.h>
+#include <openamp/remoteproc_virtio.h>
 #include <openamp/rpmsg_virtio.h>
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include "copy_kernels.h"
+#include "platform_info.h"
 #include "rsc_table.h"
 #include "suspend.h"
 
@@ -41,45 +62,236 @@
 #define IPI_CHAN_RECV 1
 #define UNIX_PREFIX "unix:"
 #define UNIXS_PREFIX "unixs:"
+#define FUTEX_PREFIX "futex:"
+#define FUTEXS_PREFIX "futexs:"
 
 #define RSC_MEM_PA  0x0UL
-#define SHARED_BUF_PA   0x10000UL
+#define RSC_MEM_SIZE    0x4000UL
 #define SHARED_BUF_SIZE 0x40000UL
+#define SHARED_BUF_ALIGN 0x10000UL
+#define DOORBELL_SIZE   0x1000UL
+/* vrings are placed on SHM_ALIGN, or their own alignment if larger */
+#define SHM_ALIGN       0x4000UL
+#define VRING_MAX_NUM   32768
+
+#define DOORBELL_READY  0x4F414D50UL
+#define CACHE_LINE_SIZE 64
+
+#define SHM_DEF_SIZE    0x80000
+#define SHM_HUGETLBFS_DEF_DIR "/dev/hugepages"
+/* UNIX socket the memfd and hugetlbfs memories are handed over */
+#define SHM_FD_SOCK_FMT "/tmp/%s.fd"
+#define MAX_INSTANCES   1024
+#define EPOLL_MAX_EVENTS 64
+/* futex_waitv(), Linux 5.16, for uapi headers which predate it */
+#ifndef FUTEX_WAITV_MAX
+#define FUTEX_32        2
+#define FUTEX_WAITV_MAX 128
+struct futex_waitv {
+	uint64_t val;
+	uint64_t uaddr;
+	uint32_t flags;
+	uint32_t __reserved;
+};
+#endif
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+/* Room for a UNIX socket path, its prefix and an instance suffix */
+#define NAME_MAX_LEN    128
+/* UNIX socket of the vdevs other than vdev 0, suffixed to the IPI path */
+#define VDEV_IPI_SUFFIX_FMT ".vdev%u"
+
+/*
+ * Futex doorbell, one per direction. The word is bumped by the kicking side
+ * and waited on by the other side, the waiter count lets the kicking side
+ * skip the FUTEX_WAKE syscall when nobody is sleeping. The kick timestamp
+ * is written for every IPI transport, when the kick latency is measured.
+ */
+struct futex_doorbell {
+	atomic_uint seq;
+	atomic_uint waiters;
+	atomic_ullong kick_ns;
+	unsigned char pad[CACHE_LINE_SIZE - 2 * sizeof(atomic_uint) -
+			  sizeof(atomic_ullong)];
+};
+
+/* Doorbell page layout, last page of the shared memory file */
+struct futex_doorbell_page {
+	/* Set by the futexs: side once the shared memory is initialized */
+	atomic_uint ready;
+	unsigned char pad[CACHE_LINE_SIZE - sizeof(atomic_uint)];
+	/*
+	 * Doorbells of vdev n, [2n]: kicks to the futexs: side,
+	 * [2n + 1]: kicks to the futex: side
+	 */
+	struct futex_doorbell db[2 * RPMSG_VDEV_MAX];
+};
 
 struct vring_ipi_info {
-	/* Socket file path */
+	/* Socket file path, or futex doorbell label */
 	const char *path;
 	int fd;
 	atomic_flag sync;
+	/* Futex doorbell transport */
+	struct futex_doorbell_page *db_page;
+	struct futex_doorbell *rx_db;
+	struct futex_doorbell *tx_db;
+	unsigned int rx_seq;
+	/* Timestamp of the last kick accounted in the latency */
+	unsigned long long rx_kick_ns;
+	/* Number of kicks received from the remote */
+	atomic_ulong kicks;
+};
+
+enum io_mode {
+	IO_MODE_OPS,
+	IO_MODE_DIRECT,
+	IO_MODE_SIMD,
+};
+
+enum shm_backend {
+	SHM_BACKEND_SHM,
+	SHM_BACKEND_MEMFD,
+	SHM_BACKEND_HUGETLBFS,
+};
+
+/*
+ * Shared memory layout, computed at init from the geometry parameters:
+ * resource table, TX and RX vrings and buffer pool of each vdev and, in the
+ * last page of the shared memory, the futex doorbells. The vrings and pool
+ * of vdev n are n * vdev_stride after those of vdev 0.
+ */
+struct shm_layout {
+	unsigned int vdev_num;
+	size_t vdev_stride;
+	unsigned int vring_num;
+	unsigned int vring_align;
+	metal_phys_addr_t vring_pa[2];
+	metal_phys_addr_t pool_pa;
+	size_t pool_size;
+	/* Default and minimum shared memory sizes */
+	size_t shm_size;
+	size_t shm_min_size;
+};
+
+/* rpmsg vdev of an instance, with its own vrings, buffer pool and IPI */
+struct platform_vdev {
+	struct vring_ipi_info ipi;
+	struct rpmsg_virtio_device *rpvdev;
+	struct rpmsg_virtio_shm_pool shpool;
+	/*
+	 * Kicks merged since the last one delivered, and since when. With the
+	 * kick counters and the buffer stats, they are updated under the lock
+	 * of the rpmsg device, which rpmsg holds around its notifies.
+	 */
+	unsigned int kick_pending;
+	unsigned long long kick_pending_ns;
+	/* Remote TX vring index when the hybrid poll of all vdevs started */
+	uint16_t spin_svq_idx;
+	struct platform_poll_stats poll_stats;
+	struct platform_buf_stats buf_stats;
 };
 
 struct remoteproc_priv {
 	const char *shm_file;
 	int shm_size;
+	/* IPI path, shared by the vdevs */
+	const char *ipi_path;
+	/* Futex doorbell page */
+	metal_phys_addr_t db_pa;
+	/* Resource table, copied to the shared memory by the server side */
+	void *rsc_table;
+	int rsc_size;
+	/* Shared memory mapping, shm_fd is -1 for the shm backend */
+	void *shm_va;
+	size_t shm_map_size;
+	int shm_fd;
 	struct metal_io_region *shm_old_io;
 	struct metal_io_region shm_new_io;
 	struct remoteproc_mem shm;
-	struct vring_ipi_info ipi;
+	struct platform_vdev vdevs[RPMSG_VDEV_MAX];
 };
 
 static struct remoteproc_priv rproc_priv_table [] = {
 	{
 		.shm_file = "openamp.shm",
-		.shm_size = 0x80000,
-		.ipi = {
-			.path = "unixs:/tmp/openamp.event.0",
-		},
+		.ipi_path = "unixs:/tmp/openamp.event.0",
+	},
+	{
+		.shm_file = "openamp.shm",
+		.ipi_path = "unix:/tmp/openamp.event.0",
+	},
+	{
+		.shm_file = "openamp.shm",
+		.ipi_path = "futexs:openamp.shm",
 	},
 	{
 		.shm_file = "openamp.shm",
-		.shm_size = 0x80000,
-		.ipi = {
-			.path = "unix:/tmp/openamp.event.0",
-		},
+		.ipi_path = "futex:openamp.shm",
 	},
 };
 
-static struct remoteproc rproc_inst;
+/*
+ * Waiter of futex doorbells on behalf of the platform_poll() thread, for
+ * the doorbells past the ones it waits on itself. Entry 0 is poll_stop_db.
+ */
+struct poll_waiter {
+	pthread_t thread;
+	unsigned int num;
+	struct futex_doorbell *dbs[FUTEX_WAITV_MAX];
+	struct futex_waitv waitv[FUTEX_WAITV_MAX];
+};
+
+/* Remoteproc instance driven by this process */
+struct platform_instance {
+	struct remoteproc rproc;
+	struct remoteproc_priv priv;
+	char shm_file[NAME_MAX_LEN];
+	char ipi_path[NAME_MAX_LEN];
+};
+
+static struct platform_instance *rproc_insts;
+static unsigned int rproc_num;
+
+/*
+ * Blocking wait of platform_poll() on all the instances: the process
+ * doorbell, rung by the IPI handler of the UNIX socket instances, and the
+ * futex doorbells of the futex instances, at once with futex_waitv(). The
+ * futex doorbells which do not fit in its wait vector are waited on by
+ * poll_waiters threads, which ring the process doorbell.
+ */
+static struct futex_doorbell poll_db;
+static struct vring_ipi_info *poll_futex_ipis[FUTEX_WAITV_MAX - 1];
+static unsigned int poll_futex_num;
+static struct futex_doorbell *poll_dbs[FUTEX_WAITV_MAX] = { &poll_db };
+static struct futex_waitv poll_waitv[FUTEX_WAITV_MAX];
+static struct poll_waiter *poll_waiters;
+static unsigned int poll_waiter_num;
+static struct futex_doorbell poll_stop_db;
+
+/* Hybrid poll spin budget in ns, 0 to always block in platform_poll() */
+static unsigned long poll_spin_ns;
+
+static struct shm_layout shm_layout;
+
+/* epoll event loop, in place of the libmetal IRQ thread when >= 0 */
+static int epoll_fd = -1;
+static int epoll_timeout_ms = -1;
+static int kick_latency;
+static int buf_stats_print;
+
+/* Kick coalescing, at most kick_batch kicks merged within kick_window_ns */
+static unsigned int kick_batch;
+static unsigned long long kick_window_ns;
+
+static enum io_mode io_mode = IO_MODE_OPS;
+/* Physical base of the shared memory io region in direct mode */
+static const metal_phys_addr_t shm_physmap = 0;
+
+static enum shm_backend shm_backend = SHM_BACKEND_SHM;
+static const char *shm_hugetlbfs_dir = SHM_HUGETLBFS_DEF_DIR;
+static int shm_prefault;
 
 /* External functions */
 extern int init_system(void);
@@ -149,6 +361,90 @@ static struct metal_io_ops linux_proc_io_ops = {
 	.phys_to_offset = linux_proc_phys_to_offset,
 };
 
+static int linux_proc_simd_block_read(struct metal_io_region *io,
+				      unsigned long offset,
+				      void *restrict dst,
+				      memory_order order,
+				      int len)
+{
+	void *src = metal_io_virt(io, offset);
+
+	(void)order;
+	copy_kernel(dst, src, len);
+	return len;
+}
+
+static int linux_proc_simd_block_write(struct metal_io_region *io,
+				       unsigned long offset,
+				       const void *restrict src,
+				       memory_order order,
+				       int len)
+{
+	void *dst = metal_io_virt(io, offset);
+
+	(void)order;
+	/* Written for the remote, the local CPU does not read it back */
+	copy_kernel_stream(dst, src, len);
+	return len;
+}
+
+static struct metal_io_ops linux_proc_simd_io_ops = {
+	.write = NULL,
+	.read = NULL,
+	.block_read = linux_proc_simd_block_read,
+	.block_write = linux_proc_simd_block_write,
+	.block_set = linux_proc_block_set,
+	.close = NULL,
+	.offset_to_phys = linux_proc_offset_to_phys,
+	.phys_to_offset = linux_proc_phys_to_offset,
+};
+
+/* Init the shared memory io region at va in the io mode */
+static void linux_proc_shm_io_init(struct metal_io_region *io, void *va,
+				   size_t size, enum io_mode mode)
+{
+	if (mode == IO_MODE_DIRECT)
+		/* Plain process memory, let libmetal access it inline */
+		metal_io_init(io, va, &shm_physmap, size, -1, 0, NULL);
+	else
+		metal_io_init(io, va, NULL, size, -1, 0,
+			      mode == IO_MODE_SIMD ?
+			      &linux_proc_simd_io_ops : &linux_proc_io_ops);
+}
+
+/* Parse an io mode of IO_MODE_ENV, NULL for the default */
+static int linux_proc_parse_io_mode(const char *val, enum io_mode *mode)
+{
+	if (!val || !strcmp(val, "ops"))
+		*mode = IO_MODE_OPS;
+	else if (!strcmp(val, "direct"))
+		*mode = IO_MODE_DIRECT;
+	else if (!strcmp(val, "simd"))
+		*mode = IO_MODE_SIMD;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+int platform_shm_io_init(struct metal_io_region *io, void *va, size_t size,
+			 const char *mode)
+{
+	enum io_mode m;
+
+	if (!io || !va || linux_proc_parse_io_mode(mode, &m))
+		return -EINVAL;
+	linux_proc_shm_io_init(io, va, size, m);
+	return 0;
+}
+
+static unsigned long long platform_gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static int sk_unix_client(const char *descr)
 {
 	struct sockaddr_un addr;
@@ -202,6 +498,134 @@ static inline int is_sk_unix_server(const char *descr)
 		return 1;
 }
 
+static inline int is_futex(const char *descr)
+{
+	return !memcmp(FUTEX_PREFIX, descr, strlen(FUTEX_PREFIX)) ||
+	       !memcmp(FUTEXS_PREFIX, descr, strlen(FUTEXS_PREFIX));
+}
+
+static inline int is_futex_server(const char *descr)
+{
+	return !memcmp(FUTEXS_PREFIX, descr, strlen(FUTEXS_PREFIX));
+}
+
+/* Server side is the one which initializes the shared memory */
+static inline int is_ipi_server(const char *descr)
+{
+	return is_sk_unix_server(descr) || is_futex_server(descr);
+}
+
+static long sys_futex(atomic_uint *uaddr, int op, unsigned int val)
+{
+	/* Shared futex, the word lives in a MAP_SHARED file mapping */
+	return syscall(SYS_futex, (unsigned int *)uaddr, op, val, NULL, NULL, 0);
+}
+
+static void doorbell_attach(struct vring_ipi_info *ipi,
+			    struct futex_doorbell_page *page,
+			    unsigned int index)
+{
+	if (is_ipi_server(ipi->path)) {
+		ipi->rx_db = &page->db[2 * index];
+		ipi->tx_db = &page->db[2 * index + 1];
+	} else {
+		ipi->rx_db = &page->db[2 * index + 1];
+		ipi->tx_db = &page->db[2 * index];
+	}
+}
+
+static int futex_doorbell_open(struct vring_ipi_info *ipi,
+			       struct futex_doorbell_page *page)
+{
+	int i;
+
+	ipi->db_page = page;
+	if (is_futex_server(ipi->path)) {
+		/* Doorbells were cleared with the resource table setup */
+		atomic_store(&page->ready, DOORBELL_READY);
+	} else {
+		/* Give the peer a chance to setup, as for the UNIX client */
+		for (i = 0; i < 100; i++) {
+			if (atomic_load(&page->ready) == DOORBELL_READY)
+				break;
+			usleep(i * 10 * 1000);
+		}
+		if (atomic_load(&page->ready) != DOORBELL_READY)
+			return -1;
+	}
+	ipi->rx_seq = atomic_load(&ipi->rx_db->seq);
+	printf("Open IPI: %s\r\n", ipi->path);
+	return 0;
+}
+
+static void futex_doorbell_kick(struct vring_ipi_info *ipi)
+{
+	struct futex_doorbell *db = ipi->tx_db;
+
+	/*
+	 * seq_cst ordering of the seq increment and the waiters load pairs
+	 * with the waiters increment and seq reload in futex_doorbell_wait(),
+	 * so either the peer sees the new seq or we see it waiting.
+	 */
+	atomic_fetch_add(&db->seq, 1);
+	/*
+	 * Wake all the waiters: a platform_poll_vdev() thread may wait on the
+	 * doorbell along with the platform_poll() one.
+	 */
+	if (atomic_load(&db->waiters))
+		sys_futex(&db->seq, FUTEX_WAKE, INT_MAX);
+}
+
+/* Ring a doorbell of this process, as the remote rings a futex doorbell */
+static void process_doorbell_ring(struct futex_doorbell *db)
+{
+	atomic_fetch_add(&db->seq, 1);
+	if (atomic_load(&db->waiters))
+		sys_futex(&db->seq, FUTEX_WAKE, INT_MAX);
+}
+
+/*
+ * Wait for any of the n doorbells dbs to move from the seq in the val of
+ * its waitv entry. The waiters are accounted before the kernel checks the
+ * seqs, so that the kicking side issues the FUTEX_WAKE.
+ */
+static void futex_doorbells_wait(struct futex_doorbell **dbs,
+				 struct futex_waitv *waitv, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		waitv[i].uaddr = (uintptr_t)&dbs[i]->seq;
+		waitv[i].flags = FUTEX_32;
+		waitv[i].__reserved = 0;
+		atomic_fetch_add(&dbs[i]->waiters, 1);
+	}
+	if (n == 1)
+		sys_futex(&dbs[0]->seq, FUTEX_WAIT, waitv[0].val);
+	else
+		syscall(SYS_futex_waitv, waitv, n, 0, NULL, CLOCK_MONOTONIC);
+	for (i = 0; i < n; i++)
+		atomic_fetch_sub(&dbs[i]->waiters, 1);
+}
+
+static void futex_doorbell_wait(struct vring_ipi_info *ipi)
+{
+	struct futex_doorbell *db = ipi->rx_db;
+	unsigned int seq;
+
+	while (1) {
+		seq = atomic_load(&db->seq);
+		if (seq != ipi->rx_seq)
+			break;
+		atomic_fetch_add(&db->waiters, 1);
+		if (atomic_load(&db->seq) == seq)
+			sys_futex(&db->seq, FUTEX_WAIT, seq);
+		atomic_fetch_sub(&db->waiters, 1);
+	}
+	atomic_fetch_add(&ipi->kicks, seq - ipi->rx_seq);
+	ipi->rx_seq = seq;
+}
+
 static int event_open(const char *descr)
 {
 	int fd = -1;
@@ -230,19 +654,291 @@ static int linux_proc_irq_handler(int vect_id, void *data)
 {
 	char dummy_buf[32];
 	struct vring_ipi_info *ipi = data;
+	ssize_t len;
 
-	read(vect_id, dummy_buf, sizeof(dummy_buf));
+	len = read(vect_id, dummy_buf, sizeof(dummy_buf));
+	if (len > 0)
+		atomic_fetch_add(&ipi->kicks, len);
 	atomic_flag_clear(&ipi->sync);
+	/* platform_poll() of several instances waits on the process doorbell */
+	process_doorbell_ring(&poll_db);
+	return 0;
+}
+
+static int shm_fd_send(int sock, int fd)
+{
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char dummy = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(buf, 0, sizeof(buf));
+	iov.iov_base = &dummy;
+	iov.iov_len = sizeof(dummy);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(dummy) ? 0 : -1;
+}
+
+static int shm_fd_recv(int sock)
+{
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char dummy;
+	int fd;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &dummy;
+	iov.iov_len = sizeof(dummy);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = buf;
+	msg.msg_controllen = sizeof(buf);
+	if (recvmsg(sock, &msg, 0) != sizeof(dummy))
+		return -1;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
+/* Hand the shared memory fd over to the peer, waits for it to connect */
+static int shm_fd_publish(struct remoteproc_priv *prproc)
+{
+	char descr[NAME_MAX_LEN + sizeof(UNIXS_PREFIX)];
+	int sock, ret;
+
+	snprintf(descr, sizeof(descr), UNIXS_PREFIX SHM_FD_SOCK_FMT,
+		 prproc->shm_file);
+	sock = sk_unix_server(descr);
+	unlink(descr + strlen(UNIXS_PREFIX));
+	if (sock < 0)
+		return -1;
+	ret = shm_fd_send(sock, prproc->shm_fd);
+	close(sock);
+	return ret;
+}
+
+static int shm_fd_lookup(struct remoteproc_priv *prproc)
+{
+	char descr[NAME_MAX_LEN + sizeof(UNIX_PREFIX)];
+	int sock = -1;
+	int fd, i;
+
+	snprintf(descr, sizeof(descr), UNIX_PREFIX SHM_FD_SOCK_FMT,
+		 prproc->shm_file);
+	/* Retry to connect a few times to give the peer a chance to setup. */
+	for (i = 0; i < 100 && sock == -1; i++) {
+		sock = sk_unix_client(descr);
+		if (sock == -1)
+			usleep(i * 10 * 1000);
+	}
+	if (sock < 0)
+		return -1;
+	fd = shm_fd_recv(sock);
+	close(sock);
+	return fd;
+}
+
+static int shm_fd_create(struct remoteproc_priv *prproc, size_t *size)
+{
+	char path[2 * NAME_MAX_LEN];
+	struct statfs sfs;
+	int fd;
+
+	if (shm_backend == SHM_BACKEND_MEMFD) {
+		fd = memfd_create(prproc->shm_file, MFD_CLOEXEC);
+	} else {
+		snprintf(path, sizeof(path), "%s/%s", shm_hugetlbfs_dir,
+			 prproc->shm_file);
+		fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		/* The peer gets the fd, no need to keep the file around */
+		if (fd >= 0)
+			unlink(path);
+	}
+	if (fd < 0)
+		return -1;
+	/* hugetlbfs sizes are multiples of the huge page size */
+	*size = prproc->shm_size;
+	if (shm_backend == SHM_BACKEND_HUGETLBFS && !fstatfs(fd, &sfs))
+		*size = (*size + sfs.f_bsize - 1) / sfs.f_bsize * sfs.f_bsize;
+	if (ftruncate(fd, *size)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void shm_do_prefault(void *va, size_t size)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	volatile char *p = va;
+	size_t i;
+
+	/* mlock() faults the pages in, touch them if it is not allowed */
+	if (!mlock(va, size))
+		return;
+	fprintf(stderr, "WARNING: failed to mlock shm, %s.\r\n",
+		strerror(errno));
+	for (i = 0; i < size; i += page_size)
+		(void)p[i];
+}
+
+/*
+ * Map the shared memory of the instance. The server side creates it and
+ * sets up the resource table, before handing it to the peer when the
+ * backend is a memfd or hugetlbfs.
+ */
+static int linux_proc_shm_open(struct remoteproc_priv *prproc)
+{
+	int server = is_ipi_server(prproc->ipi_path);
+	int flags = MAP_SHARED;
+	struct metal_io_region *io;
+	struct stat st;
+	char *va;
+	int ret;
+
+	prproc->shm_fd = -1;
+	if (shm_backend == SHM_BACKEND_SHM) {
+		ret = metal_shmem_open(prproc->shm_file, prproc->shm_size, &io);
+		if (ret)
+			return ret;
+		prproc->shm_old_io = io;
+		prproc->shm_va = io->virt;
+		prproc->shm_map_size = prproc->shm_size;
+		if (shm_prefault)
+			shm_do_prefault(prproc->shm_va, prproc->shm_map_size);
+	} else {
+		if (server) {
+			prproc->shm_fd = shm_fd_create(prproc,
+						       &prproc->shm_map_size);
+		} else {
+			prproc->shm_fd = shm_fd_lookup(prproc);
+			if (prproc->shm_fd >= 0 && !fstat(prproc->shm_fd, &st))
+				prproc->shm_map_size = st.st_size;
+		}
+		if (prproc->shm_fd < 0 ||
+		    prproc->shm_map_size < (size_t)prproc->shm_size)
+			return -1;
+		if (shm_prefault)
+			flags |= MAP_POPULATE;
+		va = mmap(NULL, prproc->shm_map_size, PROT_READ | PROT_WRITE,
+			  flags, prproc->shm_fd, 0);
+		if (va == MAP_FAILED)
+			return -1;
+		prproc->shm_va = va;
+		if (shm_prefault)
+			shm_do_prefault(va, prproc->shm_map_size);
+	}
+
+	if (!server)
+		return 0;
+	/* Clear the doorbells before the peer can see the resource table */
+	va = prproc->shm_va;
+	memset(va + prproc->db_pa, 0, DOORBELL_SIZE);
+	memcpy(va + RSC_MEM_PA, prproc->rsc_table, prproc->rsc_size);
+	if (shm_backend != SHM_BACKEND_SHM)
+		return shm_fd_publish(prproc);
+	return 0;
+}
+
+static void linux_proc_shm_close(struct remoteproc_priv *prproc)
+{
+	if (prproc->shm_old_io) {
+		metal_io_finish(prproc->shm_old_io);
+		prproc->shm_old_io = NULL;
+	} else if (prproc->shm_va) {
+		munmap(prproc->shm_va, prproc->shm_map_size);
+	}
+	prproc->shm_va = NULL;
+	if (prproc->shm_fd >= 0) {
+		close(prproc->shm_fd);
+		prproc->shm_fd = -1;
+	}
+}
+
+/* Open the IPI channel of vdev index */
+static int linux_proc_ipi_open(struct vring_ipi_info *ipi, unsigned int index,
+			       struct futex_doorbell_page *page)
+{
+	char descr[NAME_MAX_LEN + 16];
+	struct epoll_event ev;
+
+	doorbell_attach(ipi, page, index);
+	if (is_futex(ipi->path)) {
+		ipi->fd = -1;
+		if (futex_doorbell_open(ipi, page)) {
+			fprintf(stderr,
+				"ERROR: Failed to open doorbell %s for IPI.\r\n",
+				ipi->path);
+			return -1;
+		}
+		return 0;
+	}
+	/* vdev 0 keeps the plain path, as with a single vdev */
+	if (index)
+		snprintf(descr, sizeof(descr), "%s" VDEV_IPI_SUFFIX_FMT,
+			 ipi->path, index);
+	else
+		snprintf(descr, sizeof(descr), "%s", ipi->path);
+	ipi->fd = event_open(descr);
+	if (ipi->fd < 0) {
+		fprintf(stderr,
+			"ERROR: Failed to open sock %s for IPI.\r\n",
+			descr);
+		return -1;
+	}
+	if (epoll_fd >= 0) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = ipi;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ipi->fd, &ev)) {
+			fprintf(stderr, "ERROR: Failed to add %s to epoll.\r\n",
+				descr);
+			return -1;
+		}
+		return 0;
+	}
+	metal_irq_register(ipi->fd, linux_proc_irq_handler, ipi);
+	metal_irq_enable(ipi->fd);
 	return 0;
 }
 
+static void linux_proc_ipi_close(struct vring_ipi_info *ipi)
+{
+	if (ipi->fd >= 0 && epoll_fd >= 0) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ipi->fd, NULL);
+		close(ipi->fd);
+	} else if (ipi->fd >= 0) {
+		metal_irq_disable(ipi->fd);
+		metal_irq_unregister(ipi->fd);
+		close(ipi->fd);
+	}
+	ipi->fd = -1;
+	if (ipi->db_page && is_futex_server(ipi->path))
+		atomic_store(&ipi->db_page->ready, 0);
+	ipi->db_page = NULL;
+}
+
 static struct remoteproc *
 linux_proc_init(struct remoteproc *rproc,
 		const struct remoteproc_ops *ops, void *arg)
 {
 	struct remoteproc_priv *prproc = arg;
-	struct metal_io_region *io;
-	struct vring_ipi_info *ipi;
+	struct futex_doorbell_page *page;
+	unsigned int i;
 	int ret;
 
 	(void)ops;
@@ -250,36 +946,31 @@ linux_proc_init(struct remoteproc *rproc,
 		return NULL;
 
 	/* Create shared memory io */
-	ret = metal_shmem_open(prproc->shm_file, prproc->shm_size, &io);
+	ret = linux_proc_shm_open(prproc);
 	if (ret) {
 		printf("Failed to init rproc, failed to open shm %s.\r\n",
 		       prproc->shm_file);
+		linux_proc_shm_close(prproc);
 		return NULL;
 	}
-	prproc->shm_old_io = io;
 
-	metal_io_init(&prproc->shm_new_io, io->virt, NULL,
-		      prproc->shm_size, -1, 0, &linux_proc_io_ops);
+	linux_proc_shm_io_init(&prproc->shm_new_io, prproc->shm_va,
+			       prproc->shm_size, io_mode);
 
 	remoteproc_init_mem(&prproc->shm, NULL, 0, 0,
 			    prproc->shm_size, &prproc->shm_new_io);
 
-	/* Open IPI */
-	ipi = &prproc->ipi;
-	if (!ipi->path) {
+	/* Open IPI, one channel per vdev */
+	if (!prproc->ipi_path) {
 		fprintf(stderr,
 			"ERROR: No IPI sock path specified.\r\n");
 		goto err;
 	}
-	ipi->fd = event_open(ipi->path);
-	if (ipi->fd < 0) {
-		fprintf(stderr,
-			"ERROR: Failed to open sock %s for IPI.\r\n",
-			ipi->path);
-		goto err;
+	page = (void *)((char *)prproc->shm_va + prproc->db_pa);
+	for (i = 0; i < shm_layout.vdev_num; i++) {
+		if (linux_proc_ipi_open(&prproc->vdevs[i].ipi, i, page))
+			goto err;
 	}
-	metal_irq_register(ipi->fd, linux_proc_irq_handler, ipi);
-	metal_irq_enable(ipi->fd);
 	return rproc;
 
 err:
@@ -290,25 +981,18 @@ err:
 static void linux_proc_remove(struct remoteproc *rproc)
 {
 	struct remoteproc_priv *prproc;
-	struct vring_ipi_info *ipi;
+	unsigned int i;
 
 	if (!rproc)
 		return;
 	prproc = rproc->priv;
 
 	/* Close IPI */
-	ipi = &prproc->ipi;
-	if (ipi->fd >= 0) {
-		metal_irq_disable(ipi->fd);
-		metal_irq_unregister(ipi->fd);
-		close(ipi->fd);
-	}
+	for (i = 0; i < shm_layout.vdev_num; i++)
+		linux_proc_ipi_close(&prproc->vdevs[i].ipi);
 
 	/* Close shared memory */
-	if (prproc->shm_old_io) {
-		metal_io_finish(prproc->shm_old_io);
-		prproc->shm_old_io = NULL;
-	}
+	linux_proc_shm_close(prproc);
 }
 
 static void *
@@ -346,111 +1030,735 @@ linux_proc_mmap(struct remoteproc *rproc, metal_phys_addr_t *pa,
 	return va;
 }
 
-static int linux_proc_notify(struct remoteproc *rproc, uint32_t id)
+static void buf_occupancy_update(struct platform_buf_occupancy *occ,
+				 uint16_t cur, uint16_t num)
 {
-	struct remoteproc_priv *prproc;
-	struct vring_ipi_info *ipi;
-	char dummy = 1;
-
-	(void)id;
-	if (!rproc)
-		return -1;
-	prproc = rproc->priv;
-	ipi = &prproc->ipi;
-	send(ipi->fd, &dummy, 1, MSG_NOSIGNAL);
-	return 0;
+	occ->num = num;
+	occ->cur = cur;
+	if (cur > occ->peak)
+		occ->peak = cur;
+	occ->hist[cur >= num ? PLATFORM_BUF_HIST - 1 :
+		  cur * (PLATFORM_BUF_HIST - 1) / num]++;
 }
 
 /*
- * processor operations from r5 to a53. It defines
- * notification operation and remote processor management operations.
+ * Serialize with the notifies of the vdev, which rpmsg issues under the
+ * lock of the rpmsg device, possibly from other threads than the poll one.
  */
-static const struct remoteproc_ops linux_proc_ops = {
-	.init = linux_proc_init,
-	.remove = linux_proc_remove,
-	.mmap = linux_proc_mmap,
-	.notify = linux_proc_notify,
-	.start = NULL,
-	.stop = NULL,
-	.shutdown = NULL,
-};
+static void platform_vdev_lock(struct platform_vdev *pvdev)
+{
+	if (pvdev->rpvdev)
+		metal_mutex_acquire(&pvdev->rpvdev->rdev.lock);
+}
 
-/* RPMsg virtio shared buffer pool */
-static struct rpmsg_virtio_shm_pool shpool;
+static void platform_vdev_unlock(struct platform_vdev *pvdev)
+{
+	if (pvdev->rpvdev)
+		metal_mutex_release(&pvdev->rpvdev->rdev.lock);
+}
 
-static int platform_device_setup_resource_table(const char *shm_file,
-						int shm_size,
-						void *rsc_table, int rsc_size,
-						metal_phys_addr_t rsc_pa)
+/*
+ * Sample the buffers in use from the vring indexes. A driver offers its TX
+ * buffers in the avail ring and gets them back in the used ring, and gives
+ * its RX buffers back in the avail ring, all of them being offered at init.
+ * A device fills the RX buffers the driver offers and gives its RX buffers
+ * back in the used ring.
+ */
+static void platform_sample_bufs(struct platform_vdev *pvdev)
 {
-	struct metal_io_region *io;
-	void *rsc_shm;
-	int ret;
+	struct rpmsg_virtio_device *rpvdev = pvdev->rpvdev;
+	struct platform_buf_stats *stats = &pvdev->buf_stats;
+	struct virtqueue *svq, *rvq;
+	uint16_t tx, rx;
 
-	ret = metal_shmem_open(shm_file, shm_size, &io);
-	if (ret) {
-		printf("Failed to init rproc, failed to open shm %s.\r\n",
-		       shm_file);
+	if (!rpvdev)
+		return;
+	svq = rpvdev->svq;
+	rvq = rpvdev->rvq;
+	if (VIRTIO_ROLE_IS_DRIVER(rpvdev->vdev)) {
+		tx = svq->vq_ring.avail->idx -
+		     *(volatile uint16_t *)&svq->vq_ring.used->idx;
+		rx = rvq->vq_used_cons_idx + rvq->vq_nentries -
+		     rvq->vq_ring.avail->idx;
+	} else {
+		tx = svq->vq_ring.used->idx + svq->vq_nentries -
+		     *(volatile uint16_t *)&svq->vq_ring.avail->idx;
+		rx = rvq->vq_available_idx - rvq->vq_ring.used->idx;
+	}
+	buf_occupancy_update(&stats->tx, tx, svq->vq_nentries);
+	buf_occupancy_update(&stats->rx, rx, rvq->vq_nentries);
+	stats->samples++;
+}
+
+static void platform_kick(struct platform_vdev *pvdev)
+{
+	struct vring_ipi_info *ipi = &pvdev->ipi;
+	char dummy = 1;
+
+	if (kick_latency && ipi->tx_db)
+		atomic_store(&ipi->tx_db->kick_ns, platform_gettime_ns());
+	if (ipi->db_page)
+		futex_doorbell_kick(ipi);
+	else
+		send(ipi->fd, &dummy, 1, MSG_NOSIGNAL);
+	pvdev->kick_pending = 0;
+	pvdev->poll_stats.kick_sent++;
+}
+
+static int linux_proc_notify(struct remoteproc *rproc, uint32_t id)
+{
+	struct remoteproc_priv *prproc;
+	struct platform_vdev *pvdev;
+	unsigned long long now = 0;
+	unsigned int index;
+
+	if (!rproc)
 		return -1;
+	prproc = rproc->priv;
+	/* Kick the IPI channel of the vdev the vring belongs to */
+	index = id / RPMSG_VDEV_NOTIFY_IDS;
+	if (index >= shm_layout.vdev_num)
+		return -1;
+	pvdev = &prproc->vdevs[index];
+	pvdev->poll_stats.kick_requests++;
+	platform_sample_bufs(pvdev);
+	if (kick_batch) {
+		/* Merge the kick with the pending ones, until a limit */
+		if (kick_window_ns)
+			now = platform_gettime_ns();
+		if (!pvdev->kick_pending++)
+			pvdev->kick_pending_ns = now;
+		if (pvdev->kick_pending < kick_batch &&
+		    now - pvdev->kick_pending_ns < kick_window_ns)
+			return 0;
+	}
+	platform_kick(pvdev);
+	return 0;
+}
+
+/*
+ * processor operations from r5 to a53. It defines
+ * notification operation and remote processor management operations.
+ */
+static const struct remoteproc_ops linux_proc_ops = {
+	.init = linux_proc_init,
+	.remove = linux_proc_remove,
+	.mmap = linux_proc_mmap,
+	.notify = linux_proc_notify,
+	.start = NULL,
+	.stop = NULL,
+	.shutdown = NULL,
+};
+
+static int platform_check_vring(struct fw_rsc_vdev_vring *vring)
+{
+	if (!vring->num || vring->num > VRING_MAX_NUM ||
+	    (vring->num & (vring->num - 1)))
+		return -EINVAL;
+	if (vring->align < sizeof(uint32_t) ||
+	    (vring->align & (vring->align - 1)))
+		return -EINVAL;
+	return 0;
+}
+
+static inline metal_phys_addr_t shm_vdev_pa(metal_phys_addr_t pa,
+					    unsigned int index)
+{
+	return pa + index * shm_layout.vdev_stride;
+}
+
+/* Shared memory region, of vdev index unless it is shared by the vdevs */
+struct shm_region {
+	const char *name;
+	unsigned int index;
+	metal_phys_addr_t pa;
+	size_t size;
+};
+
+/* Check the resource table vrings against the rest of the shm layout */
+static int platform_check_rsc_table(struct remoteproc_priv *prproc,
+				    struct remote_resource_table *rsc,
+				    int rsc_size)
+{
+	struct shm_layout *l = &shm_layout;
+	struct shm_region regions[2 + 3 * RPMSG_VDEV_MAX] = {
+		{ "resource table", 0, RSC_MEM_PA, RSC_MEM_SIZE },
+		{ "doorbell", 0, prproc->db_pa, DOORBELL_SIZE },
+	};
+	struct rpmsg_vdev_rsc *vrsc;
+	unsigned int i, j, n = 2;
+
+	if (!rsc || rsc_size > (int)RSC_MEM_SIZE)
+		return -EINVAL;
+	if (rsc->num != l->vdev_num) {
+		fprintf(stderr, "ERROR: %u vdevs in resource table, "
+			"expected %u.\r\n", rsc->num, l->vdev_num);
+		return -EINVAL;
+	}
+	for (i = 0; i < l->vdev_num; i++) {
+		vrsc = &rsc->rpmsg[i];
+		if (platform_check_vring(&vrsc->vring0) ||
+		    platform_check_vring(&vrsc->vring1)) {
+			fprintf(stderr,
+				"ERROR: invalid vring num or align.\r\n");
+			return -EINVAL;
+		}
+		regions[n++] = (struct shm_region){
+			"vring0", i, vrsc->vring0.da,
+			vring_size(vrsc->vring0.num, vrsc->vring0.align) };
+		regions[n++] = (struct shm_region){
+			"vring1", i, vrsc->vring1.da,
+			vring_size(vrsc->vring1.num, vrsc->vring1.align) };
+		regions[n++] = (struct shm_region){
+			"buffer pool", i, shm_vdev_pa(l->pool_pa, i),
+			l->pool_size };
+	}
+	for (i = 0; i < n; i++) {
+		if (regions[i].pa + regions[i].size >
+		    (metal_phys_addr_t)prproc->shm_size) {
+			fprintf(stderr,
+				"ERROR: %s %u exceeds shm size 0x%x.\r\n",
+				regions[i].name, regions[i].index,
+				prproc->shm_size);
+			return -EINVAL;
+		}
+		for (j = 0; j < i; j++) {
+			if (regions[i].pa < regions[j].pa + regions[j].size &&
+			    regions[j].pa < regions[i].pa + regions[i].size) {
+				fprintf(stderr,
+					"ERROR: %s %u overlaps %s %u.\r\n",
+					regions[i].name, regions[i].index,
+					regions[j].name, regions[j].index);
+				return -EINVAL;
+			}
+		}
 	}
-	rsc_shm = metal_io_virt(io, rsc_pa);
-	memcpy(rsc_shm, rsc_table, rsc_size);
-	metal_io_finish(io);
 	return 0;
 }
 
 static struct remoteproc *
-platform_create_proc(int proc_index, int rsc_index)
+platform_create_proc(struct platform_instance *inst, int rsc_index)
 {
-	struct remoteproc_priv *prproc;
+	struct remoteproc *rproc = &inst->rproc;
+	struct remoteproc_priv *prproc = &inst->priv;
 	void *rsc_table, *rsc_table_shm;
 	int rsc_size;
 	int ret;
 	metal_phys_addr_t pa;
 
-	(void)proc_index;
 	rsc_table = get_resource_table(rsc_index, &rsc_size);
 
-	prproc = &rproc_priv_table[proc_index];
 	/* Setup resource table
 	 * This step can be done out of the application.
-	 * Assumes the unix server side setup resource table. */
-	if (is_sk_unix_server(prproc->ipi.path)) {
-		ret = platform_device_setup_resource_table(prproc->shm_file,
-							   prproc->shm_size,
-							   rsc_table, rsc_size,
-							   RSC_MEM_PA);
-		if (ret) {
-			printf("Failed to initialize resource table\r\n");
-			return NULL;
-		}
-	}
+	 * Assumes the IPI server side setup resource table, once the
+	 * shared memory is mapped by the init op. */
+	prproc->rsc_table = rsc_table;
+	prproc->rsc_size = rsc_size;
 
 	/* Initialize remoteproc instance */
-	if (!remoteproc_init(&rproc_inst, &linux_proc_ops, prproc))
+	if (!remoteproc_init(rproc, &linux_proc_ops, prproc))
 		return NULL;
 
 	/* Mmap resource table */
 	pa = RSC_MEM_PA;
-	rsc_table_shm = remoteproc_mmap(&rproc_inst, &pa, NULL, rsc_size,
-					0, &rproc_inst.rsc_io);
+	rsc_table_shm = remoteproc_mmap(rproc, &pa, NULL, rsc_size,
+					0, &rproc->rsc_io);
+
+	/* The client side gets the vrings from the server resource table */
+	ret = platform_check_rsc_table(prproc, rsc_table_shm, rsc_size);
+	if (ret) {
+		printf("Resource table does not fit the shm layout\r\n");
+		remoteproc_remove(rproc);
+		return NULL;
+	}
 
 	/* parse resource table to remoteproc */
-	ret = remoteproc_set_rsc_table(&rproc_inst, rsc_table_shm, rsc_size);
+	ret = remoteproc_set_rsc_table(rproc, rsc_table_shm, rsc_size);
 	if (ret) {
 		printf("Failed to set resource table to remoteproc\r\n");
-		remoteproc_remove(&rproc_inst);
+		remoteproc_remove(rproc);
 		return NULL;
 	}
 	printf("Initialize remoteproc successfully.\r\n");
-	return &rproc_inst;
+	return rproc;
+}
+
+static int platform_setup_instance(struct platform_instance *inst,
+				   const char *ipi_path, const char *shm_file,
+				   int shm_size, const char *suffix)
+{
+	unsigned int i;
+	int ret;
+
+	ret = snprintf(inst->ipi_path, sizeof(inst->ipi_path), "%s%s",
+		       ipi_path, suffix);
+	if (ret < 0 || ret >= (int)sizeof(inst->ipi_path))
+		return -EINVAL;
+	ret = snprintf(inst->shm_file, sizeof(inst->shm_file), "%s%s",
+		       shm_file, suffix);
+	if (ret < 0 || ret >= (int)sizeof(inst->shm_file))
+		return -EINVAL;
+	if (!shm_size)
+		shm_size = shm_layout.shm_size;
+	if (shm_size < (int)shm_layout.shm_min_size) {
+		fprintf(stderr, "shm size 0x%x is below 0x%lx.\r\n",
+			shm_size, (unsigned long)shm_layout.shm_min_size);
+		return -EINVAL;
+	}
+	inst->priv.shm_file = inst->shm_file;
+	inst->priv.shm_size = shm_size;
+	inst->priv.db_pa = (shm_size & ~(DOORBELL_SIZE - 1)) - DOORBELL_SIZE;
+	inst->priv.ipi_path = inst->ipi_path;
+	for (i = 0; i < RPMSG_VDEV_MAX; i++) {
+		inst->priv.vdevs[i].ipi.path = inst->ipi_path;
+		inst->priv.vdevs[i].ipi.fd = -1;
+	}
+	inst->priv.shm_fd = -1;
+	return 0;
+}
+
+static int platform_alloc_instances(unsigned int num)
+{
+	if (!num || num > MAX_INSTANCES)
+		return -EINVAL;
+	rproc_insts = metal_allocate_memory(num * sizeof(*rproc_insts));
+	if (!rproc_insts)
+		return -ENOMEM;
+	memset(rproc_insts, 0, num * sizeof(*rproc_insts));
+	rproc_num = num;
+	return 0;
+}
+
+/*
+ * Instances from the predefined table, num copies of entry proc_id. When
+ * there are several copies, the shared memory file and IPI path of each of
+ * them are suffixed with the instance index.
+ */
+static int platform_table_instances(unsigned long proc_id, unsigned int num)
+{
+	struct remoteproc_priv *tmpl;
+	char suffix[16] = "";
+	unsigned int i;
+	int ret;
+
+	if (proc_id >= metal_dim(rproc_priv_table))
+		return -EINVAL;
+	tmpl = &rproc_priv_table[proc_id];
+	ret = platform_alloc_instances(num);
+	if (ret)
+		return ret;
+	for (i = 0; i < num; i++) {
+		if (num > 1)
+			snprintf(suffix, sizeof(suffix), ".%u", i);
+		ret = platform_setup_instance(&rproc_insts[i], tmpl->ipi_path,
+					      tmpl->shm_file, tmpl->shm_size,
+					      suffix);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Instances from a config file, one instance per line:
+ *	<ipi_path> <shm_file> [shm_size]
+ * shm_size defaults to the size of the shm layout.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+static int platform_config_instances(const char *config)
+{
+	char line[3 * NAME_MAX_LEN];
+	char ipi_path[NAME_MAX_LEN], shm_file[NAME_MAX_LEN];
+	long shm_size;
+	unsigned int num = 0;
+	FILE *f;
+	int ret;
+
+	f = fopen(config, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open config %s.\r\n", config);
+		return -errno;
+	}
+	/* First pass to count the instances */
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, " %127s", ipi_path) == 1 && ipi_path[0] != '#')
+			num++;
+	}
+	ret = platform_alloc_instances(num);
+	rewind(f);
+	num = 0;
+	while (!ret && fgets(line, sizeof(line), f)) {
+		shm_size = 0;
+		ret = sscanf(line, " %127s %127s %li", ipi_path, shm_file,
+			     &shm_size);
+		if (ret <= 0 || ipi_path[0] == '#') {
+			ret = 0;
+			continue;
+		}
+		if (ret < 2) {
+			fprintf(stderr, "Invalid config line: %s\r\n", line);
+			ret = -EINVAL;
+			break;
+		}
+		ret = platform_setup_instance(&rproc_insts[num++], ipi_path,
+					      shm_file, shm_size, "");
+	}
+	fclose(f);
+	return ret;
+}
+
+static void platform_poll_teardown(void);
+
+static void platform_free_instances(void)
+{
+	unsigned int i;
+
+	platform_poll_teardown();
+	for (i = 0; i < rproc_num; i++) {
+		if (rproc_insts[i].rproc.priv)
+			remoteproc_remove(&rproc_insts[i].rproc);
+	}
+	metal_free_memory(rproc_insts);
+	rproc_insts = NULL;
+	rproc_num = 0;
+}
+
+static unsigned long platform_getenv_ul(const char *name, unsigned long def)
+{
+	const char *val = getenv(name);
+
+	return val ? strtoul(val, NULL, 0) : def;
+}
+
+/* Compute the shared memory layout from the geometry parameters */
+static int platform_shm_layout(void)
+{
+	struct shm_layout *l = &shm_layout;
+	struct fw_rsc_vdev_vring vring;
+	size_t vring_area, align;
+	unsigned int i;
+
+	l->vdev_num = platform_getenv_ul(RPMSG_VDEVS_ENV, 1);
+	if (set_resource_table_vdevs(0, l->vdev_num)) {
+		fprintf(stderr, "Invalid number of vdevs %u, maximum %u.\r\n",
+			l->vdev_num, RPMSG_VDEV_MAX);
+		return -EINVAL;
+	}
+	l->vring_num = platform_getenv_ul(VRING_NUM_ENV, VRING_SIZE);
+	l->vring_align = platform_getenv_ul(VRING_ALIGN_ENV, VRING_ALIGN);
+	vring.num = l->vring_num;
+	vring.align = l->vring_align;
+	if (platform_check_vring(&vring)) {
+		fprintf(stderr, "Invalid vring num %u or align 0x%x.\r\n",
+			l->vring_num, l->vring_align);
+		return -EINVAL;
+	}
+
+	align = l->vring_align > SHM_ALIGN ? l->vring_align : SHM_ALIGN;
+	vring_area = metal_align_up(vring_size(l->vring_num, l->vring_align),
+				    align);
+	l->vring_pa[0] = metal_align_up(RSC_MEM_PA + RSC_MEM_SIZE, align);
+	l->vring_pa[1] = l->vring_pa[0] + vring_area;
+	l->pool_pa = metal_align_up(l->vring_pa[1] + vring_area,
+				    SHARED_BUF_ALIGN);
+
+	/* Enough buffers to fill both vrings by default */
+	l->pool_size = 2UL * l->vring_num * RPMSG_BUFFER_SIZE;
+	if (l->pool_size < SHARED_BUF_SIZE)
+		l->pool_size = SHARED_BUF_SIZE;
+	l->pool_size = platform_getenv_ul(SHM_POOL_SIZE_ENV, l->pool_size);
+
+	/* A stride aligned for both the vrings and the pool */
+	if (align < SHARED_BUF_ALIGN)
+		align = SHARED_BUF_ALIGN;
+	l->vdev_stride = metal_align_up(l->pool_pa + l->pool_size -
+					l->vring_pa[0], align);
+
+	l->shm_min_size = metal_align_up(shm_vdev_pa(l->pool_pa,
+						     l->vdev_num - 1) +
+					 l->pool_size, DOORBELL_SIZE) +
+			  DOORBELL_SIZE;
+	l->shm_size = l->shm_min_size > SHM_DEF_SIZE ?
+		      l->shm_min_size : SHM_DEF_SIZE;
+	l->shm_size = platform_getenv_ul(SHM_SIZE_ENV, l->shm_size);
+	if (l->shm_size < l->shm_min_size || l->shm_size > INT_MAX) {
+		fprintf(stderr, "Invalid shm size 0x%lx, minimum 0x%lx.\r\n",
+			(unsigned long)l->shm_size,
+			(unsigned long)l->shm_min_size);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < l->vdev_num; i++)
+		set_resource_table_vrings(0, i, shm_vdev_pa(l->vring_pa[0], i),
+					  shm_vdev_pa(l->vring_pa[1], i),
+					  l->vring_align, l->vring_num);
+	printf("shm layout: vrings 0x%lx 0x%lx num %u align 0x%x, "
+	       "pool 0x%lx size 0x%lx, shm size 0x%lx\r\n",
+	       (unsigned long)l->vring_pa[0], (unsigned long)l->vring_pa[1],
+	       l->vring_num, l->vring_align, (unsigned long)l->pool_pa,
+	       (unsigned long)l->pool_size, (unsigned long)l->shm_size);
+	if (l->vdev_num > 1)
+		printf("shm layout: %u vdevs, stride 0x%lx\r\n", l->vdev_num,
+		       (unsigned long)l->vdev_stride);
+	return 0;
+}
+
+static long platform_getenv_l(const char *name, long def)
+{
+	const char *val = getenv(name);
+
+	return val ? strtol(val, NULL, 0) : def;
+}
+
+/* Parse a CPU list, as "0-3,6" */
+static int platform_parse_cpus(const char *list, cpu_set_t *cpus)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(cpus);
+	while (*list) {
+		first = strtoul(list, &end, 0);
+		if (end == list)
+			return -EINVAL;
+		last = first;
+		if (*end == '-') {
+			list = end + 1;
+			last = strtoul(list, &end, 0);
+			if (end == list || last < first)
+				return -EINVAL;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, cpus);
+		list = end;
+		if (*list == ',')
+			list++;
+		else if (*list)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/* Event loop, CPU affinity and priority of the thread running the loop */
+static int platform_event_config(void)
+{
+	struct sched_param param;
+	const char *val;
+	cpu_set_t cpus;
+
+	kick_latency = platform_getenv_ul(KICK_LATENCY_ENV, 0);
+	buf_stats_print = platform_getenv_ul(BUF_STATS_ENV, 0);
+
+	/*
+	 * Never merge more than half a vring of kicks, so that the remote is
+	 * kicked before the vring gets full of buffers it was not told about.
+	 */
+	kick_window_ns = platform_getenv_ul(KICK_COALESCE_US_ENV, 0) * 1000ULL;
+	kick_batch = platform_getenv_ul(KICK_COALESCE_COUNT_ENV, 0);
+	if (kick_batch || kick_window_ns) {
+		if (shm_layout.vring_num < 2) {
+			fprintf(stderr,
+				"Kick coalescing needs vrings of 2 buffers or more.\r\n");
+			return -EINVAL;
+		}
+		if (!kick_batch || kick_batch > shm_layout.vring_num / 2)
+			kick_batch = shm_layout.vring_num / 2;
+		if (kick_batch && !kick_window_ns)
+			kick_window_ns = ULLONG_MAX;
+		printf("kick coalescing: %u kicks, %llu ns\r\n", kick_batch,
+		       kick_window_ns);
+	}
+
+	val = getenv(CPU_AFFINITY_ENV);
+	if (val) {
+		if (platform_parse_cpus(val, &cpus) ||
+		    sched_setaffinity(0, sizeof(cpus), &cpus)) {
+			fprintf(stderr, "Failed to set CPU affinity %s.\r\n",
+				val);
+			return -EINVAL;
+		}
+	}
+
+	param.sched_priority = platform_getenv_ul(SCHED_FIFO_ENV, 0);
+	if (param.sched_priority &&
+	    sched_setscheduler(0, SCHED_FIFO, &param)) {
+		fprintf(stderr, "Failed to set SCHED_FIFO priority %d, %s.\r\n",
+			param.sched_priority, strerror(errno));
+		return -EPERM;
+	}
+
+	val = getenv(EVENT_LOOP_ENV);
+	if (!val || !strcmp(val, "metal"))
+		return 0;
+	if (strcmp(val, "epoll")) {
+		fprintf(stderr, "Unknown event loop %s.\r\n", val);
+		return -EINVAL;
+	}
+	epoll_timeout_ms = platform_getenv_l(EPOLL_TIMEOUT_ENV, -1);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		return -errno;
+	return 0;
+}
+
+static int platform_shm_config(void)
+{
+	const char *val = getenv(SHM_BACKEND_ENV);
+
+	if (!val || !strcmp(val, "shm")) {
+		shm_backend = SHM_BACKEND_SHM;
+	} else if (!strcmp(val, "memfd")) {
+		shm_backend = SHM_BACKEND_MEMFD;
+	} else if (!strcmp(val, "hugetlbfs")) {
+		shm_backend = SHM_BACKEND_HUGETLBFS;
+	} else {
+		fprintf(stderr, "Unknown shm backend %s.\r\n", val);
+		return -EINVAL;
+	}
+	val = getenv(IO_MODE_ENV);
+	if (linux_proc_parse_io_mode(val, &io_mode)) {
+		fprintf(stderr, "Unknown io mode %s.\r\n", val);
+		return -EINVAL;
+	}
+	if (io_mode == IO_MODE_SIMD) {
+		copy_kernels_init(platform_getenv_ul(COPY_NT_THRESHOLD_ENV,
+						     COPY_NT_DEF_THRESHOLD));
+		printf("io: %s copy kernels\r\n", copy_kernels_name());
+	}
+	val = getenv(SHM_HUGETLBFS_ENV);
+	if (val)
+		shm_hugetlbfs_dir = val;
+	shm_prefault = platform_getenv_ul(SHM_PREFAULT_ENV,
+					  shm_backend != SHM_BACKEND_SHM);
+	return 0;
+}
+
+/* Wait on the doorbells of the waiter, ring the process doorbell on kicks */
+static void *poll_waiter_thread(void *arg)
+{
+	struct poll_waiter *w = arg;
+	unsigned int i, seq;
+	int kicked;
+
+	while (atomic_load(&poll_stop_db.seq) == w->waitv[0].val) {
+		futex_doorbells_wait(w->dbs, w->waitv, w->num);
+		kicked = 0;
+		for (i = 1; i < w->num; i++) {
+			seq = atomic_load(&w->dbs[i]->seq);
+			if (seq != w->waitv[i].val) {
+				w->waitv[i].val = seq;
+				kicked = 1;
+			}
+		}
+		if (kicked)
+			process_doorbell_ring(&poll_db);
+	}
+	return NULL;
+}
+
+/*
+ * Wait vectors of platform_poll() with several instances: the process
+ * doorbell and the futex doorbells, the ones past FUTEX_WAITV_MAX - 1
+ * waited on by poll_waiters threads. The epoll set only holds the UNIX
+ * sockets, so it cannot serve futex instances along with them.
+ */
+static int platform_poll_setup(void)
+{
+	const unsigned int per_wait = FUTEX_WAITV_MAX - 1;
+	unsigned int i, j, unix_num = 0, futex_num = 0;
+	struct vring_ipi_info *ipi;
+	struct poll_waiter *w;
+	int ret;
+
+	if (rproc_num <= 1 && shm_layout.vdev_num <= 1)
+		return 0;
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++) {
+			if (rproc_insts[i].priv.vdevs[j].ipi.db_page)
+				futex_num++;
+			else
+				unix_num++;
+		}
+	}
+	if (!futex_num)
+		return 0;
+	if (epoll_fd >= 0 && unix_num) {
+		fprintf(stderr, "The epoll event loop cannot wait on both "
+			"UNIX socket and futex IPI instances.\r\n");
+		return -EINVAL;
+	}
+	/* Fails with EINVAL on the empty vector if implemented */
+	if (syscall(SYS_futex_waitv, NULL, 0, 0, NULL, CLOCK_MONOTONIC) &&
+	    errno == ENOSYS) {
+		fprintf(stderr, "futex_waitv() is not available to wait on "
+			"several futex IPI instances.\r\n");
+		return -ENOSYS;
+	}
+	if (futex_num > per_wait) {
+		poll_waiter_num = (futex_num - 1) / per_wait;
+		poll_waiters = metal_allocate_memory(poll_waiter_num *
+						     sizeof(*poll_waiters));
+		if (!poll_waiters) {
+			poll_waiter_num = 0;
+			return -ENOMEM;
+		}
+		memset(poll_waiters, 0, poll_waiter_num * sizeof(*poll_waiters));
+	}
+	futex_num = 0;
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++) {
+			ipi = &rproc_insts[i].priv.vdevs[j].ipi;
+			if (!ipi->db_page)
+				continue;
+			if (poll_futex_num < per_wait) {
+				poll_futex_ipis[poll_futex_num++] = ipi;
+				poll_dbs[poll_futex_num] = ipi->rx_db;
+				continue;
+			}
+			w = &poll_waiters[futex_num++ / per_wait];
+			if (!w->num) {
+				w->dbs[0] = &poll_stop_db;
+				w->waitv[0].val = atomic_load(&poll_stop_db.seq);
+				w->num = 1;
+			}
+			w->waitv[w->num].val = ipi->rx_seq;
+			w->dbs[w->num++] = ipi->rx_db;
+		}
+	}
+	for (i = 0; i < poll_waiter_num; i++) {
+		ret = pthread_create(&poll_waiters[i].thread, NULL,
+				     poll_waiter_thread, &poll_waiters[i]);
+		if (ret) {
+			fprintf(stderr, "Failed to start doorbell waiter.\r\n");
+			poll_waiter_num = i;
+			return -ret;
+		}
+	}
+	return 0;
+}
+
+static void platform_poll_teardown(void)
+{
+	unsigned int i;
+
+	if (poll_waiters) {
+		process_doorbell_ring(&poll_stop_db);
+		for (i = 0; i < poll_waiter_num; i++)
+			pthread_join(poll_waiters[i].thread, NULL);
+		metal_free_memory(poll_waiters);
+	}
+	poll_waiters = NULL;
+	poll_waiter_num = 0;
+	poll_futex_num = 0;
 }
 
 int platform_init(int argc, char *argv[], void **platform)
 {
 	unsigned long proc_id = 0;
 	unsigned long rsc_id = 0;
-	struct remoteproc *rproc;
+	unsigned long num = 1;
+	unsigned int i;
+	int ret;
 
 	if (!platform) {
 		fprintf(stderr, "Failed to initialize platform, NULL pointer"
@@ -460,21 +1768,102 @@ int platform_init(int argc, char *argv[], void **platform)
 	/* Initialize HW system components */
 	init_system();
 
-	if (argc >= 2) {
-		proc_id = strtoul(argv[1], NULL, 0);
-	}
+	poll_spin_ns = platform_getenv_ul(POLL_SPIN_NS_ENV, 0);
+	ret = platform_shm_config();
+	if (!ret)
+		ret = platform_shm_layout();
+	if (!ret)
+		ret = platform_event_config();
+	if (ret)
+		return ret;
+
+	if (argc >= 2 && !isdigit((unsigned char)argv[1][0])) {
+		/* Instances described by a config file */
+		ret = platform_config_instances(argv[1]);
+	} else {
+		if (argc >= 2) {
+			proc_id = strtoul(argv[1], NULL, 0);
+		}
+
+		if (argc >= 3) {
+			rsc_id = strtoul(argv[2], NULL, 0);
+		}
 
-	if (argc >= 3) {
-		rsc_id = strtoul(argv[2], NULL, 0);
+		if (argc >= 4) {
+			num = strtoul(argv[3], NULL, 0);
+		}
+		ret = platform_table_instances(proc_id, num);
+	}
+	if (ret) {
+		fprintf(stderr, "Failed to setup remoteproc instances.\r\n");
+		goto err;
 	}
 
-	rproc = platform_create_proc(proc_id, rsc_id);
-	if (!rproc) {
-		fprintf(stderr, "Failed to create remoteproc device.\r\n");
-		return -EINVAL;
+	for (i = 0; i < rproc_num; i++) {
+		if (!platform_create_proc(&rproc_insts[i], rsc_id)) {
+			fprintf(stderr,
+				"Failed to create remoteproc device %u.\r\n",
+				i);
+			ret = -EINVAL;
+			goto err;
+		}
 	}
-	*platform = rproc;
+	ret = platform_poll_setup();
+	if (ret)
+		goto err;
+	*platform = &rproc_insts[0].rproc;
 	return 0;
+
+err:
+	platform_free_instances();
+	return ret;
+}
+
+unsigned int platform_get_num_instances(void *platform)
+{
+	(void)platform;
+	return rproc_num;
+}
+
+void *platform_get_instance(void *platform, unsigned int index)
+{
+	(void)platform;
+	if (index >= rproc_num)
+		return NULL;
+	return &rproc_insts[index].rproc;
+}
+
+unsigned int platform_get_num_vdevs(void *platform)
+{
+	(void)platform;
+	return shm_layout.vdev_num;
+}
+
+unsigned int platform_get_vdev_index(void *platform, const char *name)
+{
+	uint32_t hash = 2166136261U;
+
+	(void)platform;
+	/* FNV-1a, both sides place the service on the same vdev */
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash % shm_layout.vdev_num;
+}
+
+struct rpmsg_device *platform_get_rpmsg_vdev(void *platform,
+					     unsigned int vdev_index)
+{
+	struct remoteproc *rproc = platform;
+	struct remoteproc_priv *prproc;
+
+	if (!rproc || vdev_index >= shm_layout.vdev_num)
+		return NULL;
+	prproc = rproc->priv;
+	if (!prproc->vdevs[vdev_index].rpvdev)
+		return NULL;
+	return rpmsg_virtio_get_rpmsg_device(prproc->vdevs[vdev_index].rpvdev);
 }
 
 struct  rpmsg_device *
@@ -484,20 +1873,30 @@ platform_create_rpmsg_vdev(void *platform, unsigned int vdev_index,
 			   rpmsg_ns_bind_cb ns_bind_cb)
 {
 	struct remoteproc *rproc = platform;
+	struct remoteproc_priv *prproc = rproc->priv;
 	struct rpmsg_virtio_device *rpmsg_vdev;
+	struct platform_vdev *pvdev;
 	struct virtio_device *vdev;
 	void *shbuf;
 	struct metal_io_region *shbuf_io;
+	metal_phys_addr_t pool_pa;
 	int ret;
 
+	if (vdev_index >= shm_layout.vdev_num)
+		return NULL;
+	pvdev = &prproc->vdevs[vdev_index];
+	if (pvdev->rpvdev)
+		return NULL;
+
 	/* Setup resource table */
 	rpmsg_vdev = metal_allocate_memory(sizeof(*rpmsg_vdev));
 	if (!rpmsg_vdev)
 		return NULL;
-	shbuf_io = remoteproc_get_io_with_pa(rproc, SHARED_BUF_PA);
+	pool_pa = shm_vdev_pa(shm_layout.pool_pa, vdev_index);
+	shbuf_io = remoteproc_get_io_with_pa(rproc, pool_pa);
 	if (!shbuf_io)
 		goto err1;
-	shbuf = metal_io_phys_to_virt(shbuf_io, SHARED_BUF_PA);
+	shbuf = metal_io_phys_to_virt(shbuf_io, pool_pa);
 
 	printf("creating remoteproc virtio\r\n");
 	/* TODO: can we have a wrapper for the following two functions? */
@@ -509,17 +1908,19 @@ platform_create_rpmsg_vdev(void *platform, unsigned int vdev_index,
 
 	printf("initializing rpmsg shared buffer pool\r\n");
 	/* Only RPMsg virtio driver needs to initialize the shared buffers pool */
-	rpmsg_virtio_init_shm_pool(&shpool, shbuf, SHARED_BUF_SIZE);
+	rpmsg_virtio_init_shm_pool(&pvdev->shpool, shbuf,
+				   shm_layout.pool_size);
 
 	printf("initializing rpmsg vdev\r\n");
 	/* RPMsg virtio device can set shared buffers pool argument to NULL */
 	ret =  rpmsg_init_vdev(rpmsg_vdev, vdev, ns_bind_cb,
 			       shbuf_io,
-			       &shpool);
+			       &pvdev->shpool);
 	if (ret) {
 		printf("failed rpmsg_init_vdev\r\n");
 		goto err2;
 	}
+	pvdev->rpvdev = rpmsg_vdev;
 	return rpmsg_virtio_get_rpmsg_device(rpmsg_vdev);
 err2:
 	remoteproc_remove_virtio(rproc, vdev);
@@ -528,38 +1929,542 @@ err1:
 	return NULL;
 }
 
-int platform_poll(void *priv)
+/* Index the remote produces to: used ring for a driver, avail for a device */
+static inline uint16_t vq_peer_idx(struct virtqueue *vq)
 {
-	struct remoteproc *rproc = priv;
-	struct remoteproc_priv *prproc;
+	if (VIRTIO_ROLE_IS_DRIVER(vq->vq_dev))
+		return *(volatile uint16_t *)&vq->vq_ring.used->idx;
+	return *(volatile uint16_t *)&vq->vq_ring.avail->idx;
+}
+
+/* Notifications disabled by the remote, as when it polls the vring */
+static inline int vq_peer_no_notify(struct virtqueue *vq)
+{
+	if (VIRTIO_ROLE_IS_DRIVER(vq->vq_dev))
+		return *(volatile uint16_t *)&vq->vq_ring.used->flags &
+		       VRING_USED_F_NO_NOTIFY;
+	return *(volatile uint16_t *)&vq->vq_ring.avail->flags &
+	       VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+static inline uint16_t vq_local_idx(struct virtqueue *vq)
+{
+	if (VIRTIO_ROLE_IS_DRIVER(vq->vq_dev))
+		return vq->vq_used_cons_idx;
+	return vq->vq_available_idx;
+}
+
+/* Pending RX messages, or TX buffers given back since the svq_idx snapshot */
+static inline int rpvdev_has_work(struct rpmsg_virtio_device *rpvdev,
+				  uint16_t svq_idx)
+{
+	return vq_peer_idx(rpvdev->rvq) != vq_local_idx(rpvdev->rvq) ||
+	       vq_peer_idx(rpvdev->svq) != svq_idx;
+}
+
+static void rpvdev_enable_notification(struct rpmsg_virtio_device *rpvdev,
+				       int enable)
+{
+	if (enable) {
+		virtqueue_enable_cb(rpvdev->rvq);
+		virtqueue_enable_cb(rpvdev->svq);
+	} else {
+		virtqueue_disable_cb(rpvdev->rvq);
+		virtqueue_disable_cb(rpvdev->svq);
+	}
+}
+
+/* Deliver the merged kicks, before the vdev goes idle */
+static void platform_flush_kicks(struct platform_vdev *pvdev)
+{
+	struct rpmsg_virtio_device *rpvdev = pvdev->rpvdev;
+
+	platform_vdev_lock(pvdev);
+	if (!pvdev->kick_pending)
+		goto out;
+	/*
+	 * Pairs with the remote enabling its notifications then checking the
+	 * vrings again, when it stops polling them.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (rpvdev && vq_peer_no_notify(rpvdev->svq) &&
+	    vq_peer_no_notify(rpvdev->rvq)) {
+		pvdev->kick_pending = 0;
+		goto out;
+	}
+	platform_kick(pvdev);
+out:
+	platform_vdev_unlock(pvdev);
+}
+
+/*
+ * Wait for kicks on the IPI sockets of the epoll event loop, the kicked
+ * instances are marked pending as by the libmetal IRQ thread.
+ */
+static int platform_epoll_wait(int timeout)
+{
+	struct epoll_event events[EPOLL_MAX_EVENTS];
 	struct vring_ipi_info *ipi;
+	int i, n;
+
+	n = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, timeout);
+	for (i = 0; i < n; i++) {
+		ipi = events[i].data.ptr;
+		linux_proc_irq_handler(ipi->fd, ipi);
+	}
+	return n;
+}
+
+/*
+ * Wait for a kick from the remote on the IPI channel. Without the libmetal
+ * IRQ thread, only the socket of the channel is waited on: the other
+ * channels may be polled by other threads.
+ */
+static void platform_wait_notification(struct vring_ipi_info *ipi)
+{
+	struct pollfd pfd;
 	unsigned int flags;
 
-	prproc = rproc->priv;
-	ipi = &prproc->ipi;
+	if (ipi->db_page) {
+		futex_doorbell_wait(ipi);
+		return;
+	}
+	if (epoll_fd >= 0) {
+		pfd.fd = ipi->fd;
+		pfd.events = POLLIN;
+		while (atomic_flag_test_and_set(&ipi->sync)) {
+			if (poll(&pfd, 1, epoll_timeout_ms) > 0)
+				linux_proc_irq_handler(ipi->fd, ipi);
+		}
+		return;
+	}
 	while(1) {
 		flags = metal_irq_save_disable();
 		if (!(atomic_flag_test_and_set(&ipi->sync))) {
 			metal_irq_restore_enable(flags);
-			remoteproc_get_notification(rproc, RSC_NOTIFY_ID_ANY);
 			break;
 		}
 		system_suspend();
 		metal_irq_restore_enable(flags);
 	}
+}
+
+/* Consume a pending kick from the remote, without blocking */
+static int platform_ipi_pending(struct vring_ipi_info *ipi)
+{
+	unsigned int flags, seq;
+	int pending;
+
+	if (!ipi->db_page) {
+		flags = metal_irq_save_disable();
+		pending = !atomic_flag_test_and_set(&ipi->sync);
+		metal_irq_restore_enable(flags);
+		return pending;
+	}
+	seq = atomic_load(&ipi->rx_db->seq);
+	if (seq == ipi->rx_seq)
+		return 0;
+	atomic_fetch_add(&ipi->kicks, seq - ipi->rx_seq);
+	ipi->rx_seq = seq;
+	return 1;
+}
+
+/* Account the kick latency, then run the vring callbacks of the vdev */
+static void platform_dispatch(struct platform_vdev *pvdev)
+{
+	struct platform_poll_stats *stats = &pvdev->poll_stats;
+	struct vring_ipi_info *ipi = &pvdev->ipi;
+	unsigned long long ts, lat;
+
+	if (kick_latency && ipi->rx_db) {
+		ts = atomic_load(&ipi->rx_db->kick_ns);
+		/* Only once per kick, the hybrid poll runs without kicks */
+		if (ts && ts != ipi->rx_kick_ns) {
+			ipi->rx_kick_ns = ts;
+			lat = platform_gettime_ns() - ts;
+			if (!stats->kick_lat_count || lat < stats->kick_lat_min_ns)
+				stats->kick_lat_min_ns = lat;
+			if (lat > stats->kick_lat_max_ns)
+				stats->kick_lat_max_ns = lat;
+			stats->kick_lat_sum_ns += lat;
+			stats->kick_lat_count++;
+		}
+	}
+	if (pvdev->rpvdev) {
+		rproc_virtio_notified(pvdev->rpvdev->vdev, RSC_NOTIFY_ID_ANY);
+		platform_vdev_lock(pvdev);
+		platform_sample_bufs(pvdev);
+		platform_vdev_unlock(pvdev);
+	}
+}
+
+/* Enable or disable the kicks of all the vdevs, snapshot them when disabled */
+static void platform_notify_instances(int enable)
+{
+	struct platform_vdev *pvdev;
+	unsigned int i, j;
+
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++) {
+			pvdev = &rproc_insts[i].priv.vdevs[j];
+			if (!pvdev->rpvdev)
+				continue;
+			if (!enable)
+				pvdev->spin_svq_idx =
+					vq_peer_idx(pvdev->rpvdev->svq);
+			rpvdev_enable_notification(pvdev->rpvdev, enable);
+		}
+	}
+}
+
+/* Whether a vdev got work since platform_notify_instances() disabled kicks */
+static int platform_instances_have_work(void)
+{
+	struct platform_vdev *pvdev;
+	unsigned int i, j;
+
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++) {
+			pvdev = &rproc_insts[i].priv.vdevs[j];
+			if (pvdev->rpvdev &&
+			    rpvdev_has_work(pvdev->rpvdev, pvdev->spin_svq_idx))
+				return 1;
+		}
+	}
 	return 0;
 }
 
+/*
+ * Spin on the vrings of all the vdevs for poll_spin_ns with the remote kicks
+ * suppressed, then re-enable the kicks and serve the vdevs which got work.
+ * Return the number of vdevs served, 0 if the caller is to block.
+ */
+static unsigned int platform_spin_instances(void)
+{
+	struct platform_vdev *pvdev;
+	unsigned long long deadline;
+	unsigned int i, j, served = 0;
+
+	platform_notify_instances(0);
+	deadline = platform_gettime_ns() + poll_spin_ns;
+	while (!platform_instances_have_work() &&
+	       platform_gettime_ns() < deadline)
+		metal_cpu_yield();
+	/*
+	 * Kicks on again before serving, so that none stays suppressed when
+	 * the application does not poll again. The remote may have produced
+	 * before it could see them enabled, order the flags update against
+	 * the re-check.
+	 */
+	platform_notify_instances(1);
+	atomic_thread_fence(memory_order_seq_cst);
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++) {
+			pvdev = &rproc_insts[i].priv.vdevs[j];
+			if (!pvdev->rpvdev ||
+			    !rpvdev_has_work(pvdev->rpvdev,
+					     pvdev->spin_svq_idx))
+				continue;
+			atomic_thread_fence(memory_order_acquire);
+			pvdev->poll_stats.spins++;
+			platform_dispatch(pvdev);
+			served++;
+		}
+	}
+	if (served)
+		return served;
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++)
+			rproc_insts[i].priv.vdevs[j].poll_stats.blocks++;
+	}
+	return 0;
+}
+
+/*
+ * Block until a kick for any of the instances: on the epoll set when it
+ * holds all the IPIs, or else on the process doorbell, from wake_seq, and
+ * the futex doorbells.
+ */
+static void platform_wait_instances(unsigned int wake_seq)
+{
+	unsigned int i;
+
+	if (epoll_fd >= 0 && !poll_futex_num) {
+		platform_epoll_wait(epoll_timeout_ms);
+		return;
+	}
+	poll_waitv[0].val = wake_seq;
+	for (i = 0; i < poll_futex_num; i++)
+		poll_waitv[i + 1].val = poll_futex_ipis[i]->rx_seq;
+	futex_doorbells_wait(poll_dbs, poll_waitv, poll_futex_num + 1);
+}
+
+/* Serve the vdevs of all the instances, until one of them got a kick */
+static void platform_poll_instances(void)
+{
+	struct platform_vdev *pvdev;
+	unsigned int i, j, served, wake_seq;
+
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++)
+			platform_flush_kicks(&rproc_insts[i].priv.vdevs[j]);
+	}
+	while (1) {
+		/* Before the IPIs are checked, a kick since then moves it */
+		wake_seq = atomic_load(&poll_db.seq);
+		served = 0;
+		for (i = 0; i < rproc_num; i++) {
+			for (j = 0; j < shm_layout.vdev_num; j++) {
+				pvdev = &rproc_insts[i].priv.vdevs[j];
+				if (!platform_ipi_pending(&pvdev->ipi))
+					continue;
+				platform_dispatch(pvdev);
+				served++;
+			}
+		}
+		if (served)
+			break;
+		if (poll_spin_ns && platform_spin_instances())
+			break;
+		platform_wait_instances(wake_seq);
+	}
+}
+
+/*
+ * Spin on the vrings for poll_spin_ns with the remote kicks suppressed,
+ * then re-enable the kicks and block on the IPI. The kicks are enabled
+ * again before returning in any case: the application may block elsewhere,
+ * as in rpmsg_send(), before it polls again.
+ */
+static void platform_poll_hybrid(struct platform_vdev *pvdev)
+{
+	struct rpmsg_virtio_device *rpvdev = pvdev->rpvdev;
+	unsigned long long deadline;
+	uint16_t svq_idx;
+
+	svq_idx = vq_peer_idx(rpvdev->svq);
+	rpvdev_enable_notification(rpvdev, 0);
+	deadline = platform_gettime_ns() + poll_spin_ns;
+	do {
+		if (rpvdev_has_work(rpvdev, svq_idx)) {
+			rpvdev_enable_notification(rpvdev, 1);
+			atomic_thread_fence(memory_order_acquire);
+			pvdev->poll_stats.spins++;
+			return;
+		}
+		metal_cpu_yield();
+	} while (platform_gettime_ns() < deadline);
+
+	rpvdev_enable_notification(rpvdev, 1);
+	/*
+	 * The remote may have produced before it could see the notifications
+	 * enabled again, order the flags update against the re-check.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (rpvdev_has_work(rpvdev, svq_idx)) {
+		atomic_thread_fence(memory_order_acquire);
+		pvdev->poll_stats.spins++;
+		return;
+	}
+	pvdev->poll_stats.blocks++;
+	platform_wait_notification(&pvdev->ipi);
+}
+
+/* Wait for a kick on the IPI channel of the vdev, then serve it */
+static void platform_poll_channel(struct platform_vdev *pvdev)
+{
+	platform_flush_kicks(pvdev);
+	if (poll_spin_ns && pvdev->rpvdev)
+		platform_poll_hybrid(pvdev);
+	else
+		platform_wait_notification(&pvdev->ipi);
+	platform_dispatch(pvdev);
+}
+
+int platform_poll(void *priv)
+{
+	struct remoteproc *rproc = priv;
+	struct remoteproc_priv *prproc;
+
+	if (rproc_num > 1 || shm_layout.vdev_num > 1) {
+		platform_poll_instances();
+		return 0;
+	}
+	prproc = rproc->priv;
+	platform_poll_channel(&prproc->vdevs[0]);
+	return 0;
+}
+
+int platform_poll_vdev(void *platform, unsigned int vdev_index)
+{
+	struct remoteproc *rproc = platform;
+	struct remoteproc_priv *prproc;
+
+	if (!rproc || vdev_index >= shm_layout.vdev_num)
+		return -EINVAL;
+	prproc = rproc->priv;
+	platform_poll_channel(&prproc->vdevs[vdev_index]);
+	return 0;
+}
+
+/* Add the counters of a vdev or instance to sum */
+static void platform_sum_poll_stats(struct platform_poll_stats *sum,
+				    const struct platform_poll_stats *stats)
+{
+	sum->spins += stats->spins;
+	sum->blocks += stats->blocks;
+	sum->wakeups += stats->wakeups;
+	if (stats->kick_lat_count &&
+	    (!sum->kick_lat_count ||
+	     stats->kick_lat_min_ns < sum->kick_lat_min_ns))
+		sum->kick_lat_min_ns = stats->kick_lat_min_ns;
+	if (stats->kick_lat_max_ns > sum->kick_lat_max_ns)
+		sum->kick_lat_max_ns = stats->kick_lat_max_ns;
+	sum->kick_lat_sum_ns += stats->kick_lat_sum_ns;
+	sum->kick_lat_count += stats->kick_lat_count;
+	sum->kick_requests += stats->kick_requests;
+	sum->kick_sent += stats->kick_sent;
+}
+
+int platform_get_poll_stats(void *platform, struct platform_poll_stats *stats)
+{
+	struct remoteproc *rproc = platform;
+	struct platform_poll_stats vdev_stats;
+	struct remoteproc_priv *prproc;
+	struct platform_vdev *pvdev;
+	unsigned int i;
+
+	if (!rproc || !stats)
+		return -EINVAL;
+	prproc = rproc->priv;
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < shm_layout.vdev_num; i++) {
+		pvdev = &prproc->vdevs[i];
+		platform_vdev_lock(pvdev);
+		vdev_stats = pvdev->poll_stats;
+		platform_vdev_unlock(pvdev);
+		vdev_stats.wakeups = atomic_load(&pvdev->ipi.kicks);
+		platform_sum_poll_stats(stats, &vdev_stats);
+	}
+	return 0;
+}
+
+int platform_reset_kick_latency(void *platform)
+{
+	struct remoteproc *rproc = platform;
+	struct platform_poll_stats *stats;
+	struct remoteproc_priv *prproc;
+	unsigned int i;
+
+	if (!rproc)
+		return -EINVAL;
+	prproc = rproc->priv;
+	for (i = 0; i < shm_layout.vdev_num; i++) {
+		stats = &prproc->vdevs[i].poll_stats;
+		stats->kick_lat_count = 0;
+		stats->kick_lat_min_ns = 0;
+		stats->kick_lat_max_ns = 0;
+		stats->kick_lat_sum_ns = 0;
+	}
+	return 0;
+}
+
+int platform_get_buf_stats(void *platform, unsigned int vdev_index,
+			   struct platform_buf_stats *stats)
+{
+	struct remoteproc *rproc = platform;
+	struct remoteproc_priv *prproc;
+	struct platform_vdev *pvdev;
+
+	if (!rproc || !stats || vdev_index >= shm_layout.vdev_num)
+		return -EINVAL;
+	prproc = rproc->priv;
+	pvdev = &prproc->vdevs[vdev_index];
+	platform_vdev_lock(pvdev);
+	*stats = pvdev->buf_stats;
+	platform_vdev_unlock(pvdev);
+	if (pvdev->shpool.size) {
+		stats->pool_size = pvdev->shpool.size;
+		stats->pool_used = pvdev->shpool.size - pvdev->shpool.avail;
+	}
+	return 0;
+}
+
+int platform_reset_buf_stats(void *platform, unsigned int vdev_index)
+{
+	struct remoteproc *rproc = platform;
+	struct remoteproc_priv *prproc;
+	struct platform_buf_stats *stats;
+	struct platform_vdev *pvdev;
+
+	if (!rproc || vdev_index >= shm_layout.vdev_num)
+		return -EINVAL;
+	prproc = rproc->priv;
+	pvdev = &prproc->vdevs[vdev_index];
+	stats = &pvdev->buf_stats;
+	platform_vdev_lock(pvdev);
+	stats->tx.peak = stats->tx.cur;
+	stats->rx.peak = stats->rx.cur;
+	memset(stats->tx.hist, 0, sizeof(stats->tx.hist));
+	memset(stats->rx.hist, 0, sizeof(stats->rx.hist));
+	stats->samples = 0;
+	platform_vdev_unlock(pvdev);
+	return 0;
+}
+
+static void platform_print_buf_occupancy(const char *name,
+					 const struct platform_buf_occupancy *occ)
+{
+	unsigned int i;
+
+	printf("  %s: %u buffers, peak %u, histogram by eighth:", name,
+	       occ->num, occ->peak);
+	for (i = 0; i < PLATFORM_BUF_HIST; i++)
+		printf(" %lu", occ->hist[i]);
+	printf("\r\n");
+}
+
+/* Print the buffer occupancy of the vdevs of an instance */
+static void platform_print_buf_stats(void *platform, unsigned int inst)
+{
+	struct platform_buf_stats stats;
+	unsigned int i;
+
+	for (i = 0; i < shm_layout.vdev_num; i++) {
+		if (platform_get_buf_stats(platform, i, &stats) ||
+		    !stats.samples)
+			continue;
+		printf("buffers of instance %u vdev %u: %lu samples",
+		       inst, i, stats.samples);
+		if (stats.pool_size)
+			printf(", pool %zu/%zu bytes used", stats.pool_used,
+			       stats.pool_size);
+		printf("\r\n");
+		platform_print_buf_occupancy("tx", &stats.tx);
+		platform_print_buf_occupancy("rx held", &stats.rx);
+	}
+}
+
 void platform_release_rpmsg_vdev(struct rpmsg_device *rpdev, void *platform)
 {
 	struct rpmsg_virtio_device *rpvdev;
+	struct remoteproc_priv *prproc;
 	struct virtio_device *vdev;
 	struct remoteproc *rproc;
+	unsigned int i;
 
 	rpvdev = metal_container_of(rpdev, struct rpmsg_virtio_device, rdev);
 	rproc = platform;
+	prproc = rproc->priv;
 	vdev = rpvdev->vdev;
 
+	for (i = 0; i < shm_layout.vdev_num; i++) {
+		if (prproc->vdevs[i].rpvdev != rpvdev)
+			continue;
+		platform_flush_kicks(&prproc->vdevs[i]);
+		prproc->vdevs[i].rpvdev = NULL;
+	}
+
 	rpmsg_deinit_vdev(rpvdev);
 	remoteproc_remove_virtio(rproc, vdev);
 	metal_free_memory(rpvdev);
@@ -567,9 +2472,33 @@ void platform_release_rpmsg_vdev(struct rpmsg_device *rpdev, void *platform)
 
 void platform_cleanup(void *platform)
 {
-	struct remoteproc *rproc = platform;
-
-	if (rproc)
-		remoteproc_remove(rproc);
+	struct platform_poll_stats stats, sum = { 0 };
+	unsigned int i, j;
+
+	(void)platform;
+	for (i = 0; i < rproc_num; i++) {
+		for (j = 0; j < shm_layout.vdev_num; j++)
+			platform_flush_kicks(&rproc_insts[i].priv.vdevs[j]);
+		platform_get_poll_stats(&rproc_insts[i].rproc, &stats);
+		platform_sum_poll_stats(&sum, &stats);
+		if (buf_stats_print)
+			platform_print_buf_stats(&rproc_insts[i].rproc, i);
+	}
+	if (kick_batch)
+		printf("kicks: delivered %lu, suppressed %lu\r\n",
+		       sum.kick_sent, sum.kick_requests - sum.kick_sent);
+	if (poll_spin_ns && rproc_num)
+		printf("poll: spin %lu, block %lu, wakeup %lu\r\n",
+		       sum.spins, sum.blocks, sum.wakeups);
+	if (sum.kick_lat_count)
+		printf("kick latency: min %llu ns, avg %llu ns, max %llu ns\r\n",
+		       sum.kick_lat_min_ns,
+		       sum.kick_lat_sum_ns / sum.kick_lat_count,
+		       sum.kick_lat_max_ns);
+	platform_free_instances();
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
 	cleanup_system();
 }
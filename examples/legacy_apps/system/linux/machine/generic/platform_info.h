@@ -18,4 +18,320 @@
 
 #include "platform_info_common.h"
 
+/*
+ * Threads: platform_poll(), platform_poll_vdev(), the vdev creation and
+ * release and platform_cleanup() are to be called from a single thread,
+ * the poll thread. Other threads may send on the endpoints concurrently
+ * with it: the notifies and kick coalescing of a vdev, and its kick and
+ * buffer counters, are serialized with the poll thread by the lock of the
+ * rpmsg device. platform_get_poll_stats(), platform_get_buf_stats() and
+ * platform_reset_buf_stats() take that lock too, and may be called from any
+ * thread; platform_reset_kick_latency() only from the poll thread.
+ */
+
+/*
+ * Spin budget of platform_poll() in ns. When set, platform_poll() spins on
+ * the vrings with the remote notifications suppressed before it falls back
+ * to a blocking wait on the IPI; with several instances or vdevs, on the
+ * vrings of all of them. The notifications are enabled again before
+ * platform_poll() returns.
+ */
+#define POLL_SPIN_NS_ENV "OPENAMP_POLL_SPIN_NS"
+
+/*
+ * Shared memory backend: "shm" (default) for a file in /dev/shm, "memfd"
+ * for a memfd, "hugetlbfs" for a file in the OPENAMP_SHM_HUGETLBFS mount
+ * (/dev/hugepages by default). The memfd and hugetlbfs memories are created
+ * by the side which sets up the resource table and handed to the peer over
+ * the /tmp/<shm_file>.fd UNIX socket.
+ */
+#define SHM_BACKEND_ENV "OPENAMP_SHM_BACKEND"
+#define SHM_HUGETLBFS_ENV "OPENAMP_SHM_HUGETLBFS"
+
+/*
+ * Shared memory geometry: number of descriptors and alignment of the vrings,
+ * size of the rpmsg buffer pool and size of the shared memory. The layout is
+ * computed from them at init, the pool defaults to twice the vring size in
+ * RPMSG_BUFFER_SIZE buffers and the shm size to what the layout needs. Both
+ * sides must use the same values, the client takes the vrings from the
+ * resource table and checks them against its own layout.
+ */
+#define VRING_NUM_ENV "OPENAMP_VRING_NUM"
+#define VRING_ALIGN_ENV "OPENAMP_VRING_ALIGN"
+#define SHM_POOL_SIZE_ENV "OPENAMP_SHM_POOL_SIZE"
+#define SHM_SIZE_ENV "OPENAMP_SHM_SIZE"
+
+/*
+ * Access mode of the shared memory io region: "ops" (default) copies through
+ * memcpy() based io ops, "direct" registers the region as directly mapped
+ * memory for the libmetal inline accessors, "simd" uses the copy kernels,
+ * with non-temporal stores from OPENAMP_COPY_NT_THRESHOLD bytes (32 KB by
+ * default, 0 to disable) for the writes to the shared memory.
+ */
+#define IO_MODE_ENV "OPENAMP_IO_MODE"
+#define COPY_NT_THRESHOLD_ENV "OPENAMP_COPY_NT_THRESHOLD"
+
+/**
+ * platform_shm_io_init - init an io region as the shared memory io region
+ *
+ * The region accesses the memory at va with the io ops of the machine in
+ * the io mode, as the remoteproc instances do, for example to benchmark
+ * them on plain memory. The "simd" mode uses the copy kernels set up with
+ * copy_kernels_init().
+ *
+ * @io: pointer to the io region
+ * @va: virtual address of the memory
+ * @size: size of the memory
+ * @mode: io mode as in IO_MODE_ENV, NULL for the default
+ *
+ * return 0 for success or negative value for failure
+ */
+int platform_shm_io_init(struct metal_io_region *io, void *va, size_t size,
+			 const char *mode);
+
+/*
+ * Set to 1 to prefault and mlock the shared memory at init, rather than
+ * on the first accesses. Default to 1 for the memfd and hugetlbfs backends.
+ */
+#define SHM_PREFAULT_ENV "OPENAMP_SHM_PREFAULT"
+
+/*
+ * Event loop serving the IPI sockets: "metal" (default) for the libmetal
+ * IRQ thread, "epoll" for an epoll set waited on by platform_poll(), which
+ * then runs the endpoint callbacks on the calling thread without crossing
+ * threads. OPENAMP_EPOLL_TIMEOUT_MS is the epoll_wait() timeout, -1 (default)
+ * to block and 0 to busy poll. The futex doorbells are always waited on by
+ * platform_poll(), with futex_waitv() for several of them, so a process
+ * with several instances cannot use the epoll event loop for both UNIX
+ * socket and futex instances.
+ */
+#define EVENT_LOOP_ENV "OPENAMP_EVENT_LOOP"
+#define EPOLL_TIMEOUT_ENV "OPENAMP_EPOLL_TIMEOUT_MS"
+
+/*
+ * CPU list ("2" or "0-3,6") and SCHED_FIFO priority of the thread calling
+ * platform_init(), which is expected to run the platform_poll() loop.
+ */
+#define CPU_AFFINITY_ENV "OPENAMP_CPU_AFFINITY"
+#define SCHED_FIFO_ENV "OPENAMP_SCHED_FIFO"
+
+/*
+ * Set to 1 on both sides to timestamp the kicks in the shared memory and
+ * measure the latency from a kick to the run of its callbacks.
+ */
+#define KICK_LATENCY_ENV "OPENAMP_KICK_LATENCY"
+
+/*
+ * Kick coalescing: the kicks are merged until OPENAMP_KICK_COALESCE_COUNT of
+ * them are pending, and at most half a vring of them, which needs vrings of
+ * 2 buffers or more. OPENAMP_KICK_COALESCE_US is not a timer: it is checked
+ * on the next kick, which is delivered with the pending ones when that many
+ * microseconds elapsed since the first of them. Without a further kick, the
+ * pending kicks are merged until platform_poll() is about to wait, which
+ * delivers them unless the remote has disabled its notifications.
+ */
+#define KICK_COALESCE_US_ENV "OPENAMP_KICK_COALESCE_US"
+#define KICK_COALESCE_COUNT_ENV "OPENAMP_KICK_COALESCE_COUNT"
+
+/*
+ * Number of rpmsg vdevs of each instance, 1 by default and up to
+ * RPMSG_VDEV_MAX. Every vdev has its own vrings, buffer pool and IPI
+ * channel: its own futex doorbells, or its own UNIX socket, named after the
+ * IPI path suffixed with ".vdev<index>" for the vdevs other than vdev 0.
+ * Both sides must use the same value.
+ */
+#define RPMSG_VDEVS_ENV "OPENAMP_RPMSG_VDEVS"
+
+/*
+ * Set to 1 to print the buffer occupancy of the vdevs at cleanup. It is
+ * always tracked, see platform_get_buf_stats().
+ */
+#define BUF_STATS_ENV "OPENAMP_BUF_STATS"
+
+/**
+ * struct platform_poll_stats - platform_poll() counters
+ *
+ * @spins: polls served while spinning on the vrings
+ * @blocks: polls which fell back to a blocking wait on the IPI
+ * @wakeups: notifications received from the remote
+ * @kick_lat_count: kicks with a measured latency, see KICK_LATENCY_ENV
+ * @kick_lat_min_ns: minimum latency from the kick to its callbacks run
+ * @kick_lat_max_ns: maximum latency from the kick to its callbacks run
+ * @kick_lat_sum_ns: sum of the kick latencies, for the average
+ * @kick_requests: kicks requested by the virtqueues
+ * @kick_sent: kicks delivered to the remote, the others were merged
+ */
+struct platform_poll_stats {
+	unsigned long spins;
+	unsigned long blocks;
+	unsigned long wakeups;
+	unsigned long kick_lat_count;
+	unsigned long long kick_lat_min_ns;
+	unsigned long long kick_lat_max_ns;
+	unsigned long long kick_lat_sum_ns;
+	unsigned long kick_requests;
+	unsigned long kick_sent;
+};
+
+/**
+ * platform_get_poll_stats - get the platform_poll() counters
+ *
+ * @platform: pointer to the platform
+ * @stats: pointer to store the counters
+ *
+ * return 0 for success or negative value for failure
+ */
+int platform_get_poll_stats(void *platform, struct platform_poll_stats *stats);
+
+/**
+ * platform_reset_kick_latency - reset the kick latencies of the instance
+ *
+ * Start a new window of the kick_lat_* fields of struct platform_poll_stats,
+ * for example after a warm-up, so that their min and max cover the same
+ * kicks as their average. The other counters keep running.
+ *
+ * @platform: pointer to the platform
+ *
+ * return 0 for success or negative value for failure
+ */
+int platform_reset_kick_latency(void *platform);
+
+/* Occupancy histogram buckets: eighths of the vring, then full */
+#define PLATFORM_BUF_HIST 9
+
+/**
+ * struct platform_buf_occupancy - buffer occupancy of a vring
+ *
+ * @num: buffers of the vring
+ * @cur: buffers in use at the last sample
+ * @peak: maximum of the buffers in use
+ * @hist: samples per eighth of the vring in use, the last bucket counts the
+ *	  samples with all the buffers in use
+ */
+struct platform_buf_occupancy {
+	unsigned int num;
+	unsigned int cur;
+	unsigned int peak;
+	unsigned long hist[PLATFORM_BUF_HIST];
+};
+
+/**
+ * struct platform_buf_stats - buffer occupancy of a vdev
+ *
+ * The occupancy is sampled from the vring indexes on each kick and each
+ * dispatch of the remote notifications.
+ *
+ * @tx: TX buffers sent and not yet given back by the remote
+ * @rx: RX buffers received and not yet given back to the remote, as held
+ *	with rpmsg_hold_rx_buffer()
+ * @samples: number of samples
+ * @pool_size: size of the shared buffer pool
+ * @pool_used: size allocated from the shared buffer pool, by the driver
+ */
+struct platform_buf_stats {
+	struct platform_buf_occupancy tx;
+	struct platform_buf_occupancy rx;
+	unsigned long samples;
+	size_t pool_size;
+	size_t pool_used;
+};
+
+/**
+ * platform_get_buf_stats - get the buffer occupancy of a vdev
+ *
+ * @platform: pointer to the platform
+ * @vdev_index: index of the vdev
+ * @stats: pointer to store the occupancy
+ *
+ * return 0 for success or negative value for failure
+ */
+int platform_get_buf_stats(void *platform, unsigned int vdev_index,
+			   struct platform_buf_stats *stats);
+
+/**
+ * platform_reset_buf_stats - reset the peaks and histograms of a vdev
+ *
+ * @platform: pointer to the platform
+ * @vdev_index: index of the vdev
+ *
+ * return 0 for success or negative value for failure
+ */
+int platform_reset_buf_stats(void *platform, unsigned int vdev_index);
+
+/**
+ * platform_get_num_instances - get the number of remoteproc instances
+ *
+ * platform_init() creates one instance per config file line when its first
+ * argument is not a number, or else num_instances copies of the proc_id
+ * entry from "proc_id [rsc_id [num_instances]]". The copies use the shared
+ * memory file and IPI path of the entry suffixed with ".<index>".
+ * platform_poll() serves all the instances.
+ *
+ * @platform: pointer to the platform
+ *
+ * return the number of instances
+ */
+unsigned int platform_get_num_instances(void *platform);
+
+/**
+ * platform_get_instance - get a remoteproc instance
+ *
+ * @platform: pointer to the platform
+ * @index: instance index, 0 is the instance returned by platform_init()
+ *
+ * return the instance, to be passed as platform to the platform APIs, or
+ * NULL if out of range
+ */
+void *platform_get_instance(void *platform, unsigned int index);
+
+/**
+ * platform_get_num_vdevs - get the number of rpmsg vdevs of an instance
+ *
+ * The vdevs are created with platform_create_rpmsg_vdev(), with a
+ * vdev_index below this number.
+ *
+ * @platform: pointer to the platform
+ *
+ * return the number of vdevs, see RPMSG_VDEVS_ENV
+ */
+unsigned int platform_get_num_vdevs(void *platform);
+
+/**
+ * platform_get_vdev_index - place a service on a vdev
+ *
+ * The vdev is chosen from a hash of the service name, so that both sides
+ * place the service on the same vdev and independent services spread over
+ * the vdevs.
+ *
+ * @platform: pointer to the platform
+ * @name: service name, as passed to rpmsg_create_ept()
+ *
+ * return the index of the vdev to create the service endpoint on
+ */
+unsigned int platform_get_vdev_index(void *platform, const char *name);
+
+/**
+ * platform_get_rpmsg_vdev - get the rpmsg device of a vdev
+ *
+ * @platform: pointer to the platform
+ * @vdev_index: index of the vdev
+ *
+ * return the rpmsg device, or NULL if the vdev is not created
+ */
+struct rpmsg_device *platform_get_rpmsg_vdev(void *platform,
+					     unsigned int vdev_index);
+
+/**
+ * platform_poll_vdev - poll a single vdev
+ *
+ * As platform_poll(), but waits for and serves the IPI channel of one vdev
+ * only. Each vdev can be polled by its own thread.
+ *
+ * @platform: pointer to the platform
+ * @vdev_index: index of the vdev
+ *
+ * return 0 for success or negative value for failure
+ */
+int platform_poll_vdev(void *platform, unsigned int vdev_index);
+
 #endif /* PLATFORM_INFO_H */
@@ -20,36 +20,52 @@
 #define VIRTIO_ID_RPMSG_             7
 
 #define NUM_VRINGS                  0x02
-#define VRING_ALIGN                 0x1000
-#define RING_TX                     0x00004000
-#define RING_RX                     0x00008000
-#define VRING_SIZE                  256
 
-#define NUM_TABLE_ENTRIES           1
+#define RPMSG_VDEV_OFFSET(n) \
+	offsetof(struct remote_resource_table, rpmsg[n])
+
+/* Vring addresses are set for each vdev from the shm layout */
+#define RPMSG_VDEV_ENTRY(n) \
+	{ \
+		/* Virtio device entry */ \
+		{ \
+		 RSC_VDEV, VIRTIO_ID_RPMSG_, (n) * RPMSG_VDEV_NOTIFY_IDS, \
+		 RPMSG_VDEV_DFEATURES, 0, 0, 0, NUM_VRINGS, {0, 0}, \
+		}, \
+		/* Vring rsc entry - part of vdev rsc entry */ \
+		{RING_TX, VRING_ALIGN, VRING_SIZE, \
+		 (n) * RPMSG_VDEV_NOTIFY_IDS + 1, 0}, \
+		{RING_RX, VRING_ALIGN, VRING_SIZE, \
+		 (n) * RPMSG_VDEV_NOTIFY_IDS + 2, 0}, \
+	}
 
 struct remote_resource_table resources = {
 	/* Version */
 	1,
 
-	/* NUmber of table entries */
-	NUM_TABLE_ENTRIES,
+	/*
+	 * Number of table entries, the rpmsg vdevs in use: set at runtime by
+	 * set_resource_table_vdevs(), from one to RPMSG_VDEV_MAX
+	 */
+	1,
 	/* reserved fields */
 	{0, 0,},
 
 	/* Offsets of rsc entries */
 	{
-	 offsetof(struct remote_resource_table, rpmsg_vdev),
+	 RPMSG_VDEV_OFFSET(0), RPMSG_VDEV_OFFSET(1),
+	 RPMSG_VDEV_OFFSET(2), RPMSG_VDEV_OFFSET(3),
+	 RPMSG_VDEV_OFFSET(4), RPMSG_VDEV_OFFSET(5),
+	 RPMSG_VDEV_OFFSET(6), RPMSG_VDEV_OFFSET(7),
 	},
 
-	/* Virtio device entry */
+	/* rpmsg vdevs, only the first num of them are used */
 	{
-	 RSC_VDEV, VIRTIO_ID_RPMSG_, 0, RPMSG_VDEV_DFEATURES, 0, 0, 0,
-	 NUM_VRINGS, {0, 0},
-	 },
-
-	/* Vring rsc entry - part of vdev rsc entry */
-	{RING_TX, VRING_ALIGN, VRING_SIZE, 1, 0},
-	{RING_RX, VRING_ALIGN, VRING_SIZE, 2, 0},
+	 RPMSG_VDEV_ENTRY(0), RPMSG_VDEV_ENTRY(1),
+	 RPMSG_VDEV_ENTRY(2), RPMSG_VDEV_ENTRY(3),
+	 RPMSG_VDEV_ENTRY(4), RPMSG_VDEV_ENTRY(5),
+	 RPMSG_VDEV_ENTRY(6), RPMSG_VDEV_ENTRY(7),
+	},
 };
 
 void *get_resource_table (int rsc_id, int *len)
@@ -58,3 +74,26 @@ void *get_resource_table (int rsc_id, int *len)
 	*len = sizeof(resources);
 	return &resources;
 }
+
+void set_resource_table_vrings(int rsc_id, unsigned int index, uint32_t da_tx,
+			       uint32_t da_rx, uint32_t align, uint32_t num)
+{
+	struct rpmsg_vdev_rsc *rpmsg = &resources.rpmsg[index];
+
+	(void) rsc_id;
+	rpmsg->vring0.da = da_tx;
+	rpmsg->vring0.align = align;
+	rpmsg->vring0.num = num;
+	rpmsg->vring1.da = da_rx;
+	rpmsg->vring1.align = align;
+	rpmsg->vring1.num = num;
+}
+
+int set_resource_table_vdevs(int rsc_id, unsigned int num)
+{
+	(void) rsc_id;
+	if (!num || num > RPMSG_VDEV_MAX)
+		return -1;
+	resources.num = num;
+	return 0;
+}
@@ -21,7 +21,25 @@
 extern "C" {
 #endif
 
-#define NO_RESOURCE_ENTRIES         1
+/* Maximum number of rpmsg vdevs, one resource entry each */
+#define RPMSG_VDEV_MAX              8
+#define NO_RESOURCE_ENTRIES         RPMSG_VDEV_MAX
+
+/* Notify ids of rpmsg vdev n: n * 3 for the vdev, + 1 and + 2 its vrings */
+#define RPMSG_VDEV_NOTIFY_IDS       3
+
+/* Default vrings geometry */
+#define VRING_ALIGN                 0x1000
+#define RING_TX                     0x00004000
+#define RING_RX                     0x00008000
+#define VRING_SIZE                  256
+
+/* rpmsg vdev entry */
+struct rpmsg_vdev_rsc {
+	struct fw_rsc_vdev vdev;
+	struct fw_rsc_vdev_vring vring0;
+	struct fw_rsc_vdev_vring vring1;
+};
 
 /* Resource table for the given remote */
 struct remote_resource_table {
@@ -29,14 +47,18 @@ struct remote_resource_table {
 	unsigned int num;
 	unsigned int reserved[2];
 	unsigned int offset[NO_RESOURCE_ENTRIES];
-	/* rpmsg vdev entry */
-	struct fw_rsc_vdev rpmsg_vdev;
-	struct fw_rsc_vdev_vring rpmsg_vring0;
-	struct fw_rsc_vdev_vring rpmsg_vring1;
+	struct rpmsg_vdev_rsc rpmsg[NO_RESOURCE_ENTRIES];
 };
 
 void *get_resource_table (int rsc_id, int *len);
 
+/* Update the rpmsg vrings of the resource table, before it is used */
+void set_resource_table_vrings(int rsc_id, unsigned int index, uint32_t da_tx,
+			       uint32_t da_rx, uint32_t align, uint32_t num);
+
+/* Set the number of rpmsg vdevs of the resource table, before it is used */
+int set_resource_table_vdevs(int rsc_id, unsigned int num);
+
 #if defined __cplusplus
 }
 #endif
@@ -0,0 +1,448 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Result store of the benchmarks, as JSON lines, and comparison with a
+ * baseline. Only the files written by the benchmarks are read back: the
+ * parser relies on their layout rather than on a full JSON parser.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <metal/version.h>
+#include <openamp/version.h>
+#include "bench-result.h"
+
+#define LINE_MAX_LEN		2048
+#define FIELD_MAX_LEN		256
+/* Number of standard deviations of the runs taken as noise */
+#define NOISE_SIGMAS		3.0
+
+/* Statistics of the values of a metric */
+struct result_stat {
+	/* Benchmark, parameters and metric, as written in the file */
+	char *key;
+	char *params;
+	char *metric;
+	char *unit;
+	enum bench_better better;
+	unsigned long n;
+	double sum;
+	double sumsq;
+};
+
+struct result_set {
+	struct result_stat *stats;
+	unsigned int num;
+	unsigned int size;
+};
+
+static const char *bench_name;
+static const char *json_path;
+static const char *compare_path;
+static double threshold = BENCH_RESULT_THRESHOLD_DEF;
+static FILE *json_out;
+static char build_info[LINE_MAX_LEN / 2];
+static struct result_set baseline;
+static struct result_set current;
+
+int bench_result_option(int opt, const char *arg)
+{
+	char *end;
+
+	switch (opt) {
+	case 'j':
+		json_path = arg;
+		return 0;
+	case BENCH_RESULT_OPT_COMPARE:
+		compare_path = arg;
+		return 0;
+	case BENCH_RESULT_OPT_THRESHOLD:
+		threshold = strtod(arg, &end);
+		return (end == arg || *end || threshold < 0) ? -1 : 0;
+	default:
+		return -1;
+	}
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Statistics
+ *-----------------------------------------------------------------------------*/
+static struct result_stat *result_find(struct result_set *set,
+				       const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->num; i++)
+		if (!strcmp(set->stats[i].key, key))
+			return &set->stats[i];
+	return NULL;
+}
+
+static int result_update(struct result_set *set, const char *key,
+			 const char *params, const char *metric,
+			 const char *unit, enum bench_better better,
+			 double value)
+{
+	struct result_stat *st, *stats;
+
+	st = result_find(set, key);
+	if (!st) {
+		if (set->num == set->size) {
+			set->size = set->size ? set->size * 2 : 64;
+			stats = realloc(set->stats, set->size * sizeof(*stats));
+			if (!stats)
+				return -ENOMEM;
+			set->stats = stats;
+		}
+		st = &set->stats[set->num];
+		memset(st, 0, sizeof(*st));
+		st->key = strdup(key);
+		st->params = strdup(params);
+		st->metric = strdup(metric);
+		st->unit = strdup(unit);
+		if (!st->key || !st->params || !st->metric || !st->unit) {
+			free(st->key);
+			free(st->params);
+			free(st->metric);
+			free(st->unit);
+			return -ENOMEM;
+		}
+		st->better = better;
+		set->num++;
+	}
+	st->n++;
+	st->sum += value;
+	st->sumsq += value * value;
+	return 0;
+}
+
+static void result_free(struct result_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->num; i++) {
+		free(set->stats[i].key);
+		free(set->stats[i].params);
+		free(set->stats[i].metric);
+		free(set->stats[i].unit);
+	}
+	free(set->stats);
+	memset(set, 0, sizeof(*set));
+}
+
+static double result_mean(const struct result_stat *st)
+{
+	return st->sum / st->n;
+}
+
+/* Sample variance, 0 for a single run */
+static double result_var(const struct result_stat *st)
+{
+	double var;
+
+	if (st->n < 2)
+		return 0;
+	var = (st->sumsq - st->sum * st->sum / st->n) / (st->n - 1);
+	return var > 0 ? var : 0;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  JSON lines
+ *-----------------------------------------------------------------------------*/
+/* Copy a string to a JSON string, without the quotes */
+static void json_escape(char *buf, size_t size, const char *s)
+{
+	size_t len = 0;
+
+	for (; *s && len + 2 < size; s++) {
+		if (*s == '"' || *s == '\\')
+			buf[len++] = '\\';
+		buf[len++] = (*s >= ' ') ? *s : ' ';
+	}
+	buf[len] = '\0';
+}
+
+/* Convert "size=16,mode=copy" to {"size":16,"mode":"copy"} */
+static void json_params(char *buf, size_t size, const char *params)
+{
+	char name[FIELD_MAX_LEN], value[FIELD_MAX_LEN];
+	size_t len = 0;
+	char *end;
+	int n;
+
+	len += snprintf(buf, size, "{");
+	while (*params && len < size) {
+		n = 0;
+		sscanf(params, "%255[^=,]=%255[^,]%n", name, value, &n);
+		if (!n)
+			break;
+		params += n;
+		if (*params == ',')
+			params++;
+		strtod(value, &end);
+		if (*end || end == value)
+			len += snprintf(buf + len, size - len, "%s\"%s\":\"%s\"",
+					len > 1 ? "," : "", name, value);
+		else
+			len += snprintf(buf + len, size - len, "%s\"%s\":%s",
+					len > 1 ? "," : "", name, value);
+	}
+	if (len < size)
+		snprintf(buf + len, size - len, "}");
+}
+
+/* Convert {"size":16,"mode":"copy"} back to size=16,mode=copy */
+static void json_params_text(char *buf, size_t size, const char *json)
+{
+	size_t len = 0;
+
+	for (; *json && len + 1 < size; json++) {
+		if (*json == '{' || *json == '}' || *json == '"')
+			continue;
+		buf[len++] = *json == ':' ? '=' : *json;
+	}
+	buf[len] = '\0';
+}
+
+/*
+ * Get the value of a field of a JSON line from the start: a string without
+ * its quotes, an object or a number. Return the end of the value, NULL if
+ * the field is not found.
+ */
+static const char *json_field(const char *start, const char *name,
+			      char *buf, size_t size)
+{
+	char pattern[FIELD_MAX_LEN];
+	const char *p, *end;
+	size_t len;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\":", name);
+	p = strstr(start, pattern);
+	if (!p)
+		return NULL;
+	p += strlen(pattern);
+	if (*p == '"') {
+		for (end = ++p; *end && *end != '"'; end++)
+			if (*end == '\\' && end[1])
+				end++;
+	} else if (*p == '{') {
+		end = strchr(p, '}');
+		if (!end)
+			return NULL;
+		end++;
+	} else {
+		end = p + strcspn(p, ",}");
+	}
+	len = end - p;
+	if (len >= size)
+		len = size - 1;
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+	return end;
+}
+
+static void result_key(char *buf, size_t size, const char *bench,
+		       const char *params, const char *metric)
+{
+	snprintf(buf, size, "%s %s %s", bench, params, metric);
+}
+
+static int baseline_load(const char *path)
+{
+	char line[LINE_MAX_LEN], key[LINE_MAX_LEN];
+	char bench[FIELD_MAX_LEN], params[FIELD_MAX_LEN];
+	char metric[FIELD_MAX_LEN], unit[FIELD_MAX_LEN];
+	char better[FIELD_MAX_LEN], value[FIELD_MAX_LEN];
+	const char *p;
+	unsigned long lines = 0;
+	FILE *in;
+	int ret = 0;
+
+	in = fopen(path, "r");
+	if (!in) {
+		ret = -errno;
+		fprintf(stderr, "ERROR: Failed to open %s: %s\r\n", path,
+			strerror(errno));
+		return ret;
+	}
+	while (fgets(line, sizeof(line), in)) {
+		/* The parameters may hold any name, the fields follow them */
+		p = json_field(line, "bench", bench, sizeof(bench));
+		if (p)
+			p = json_field(p, "params", params, sizeof(params));
+		if (p)
+			p = json_field(p, "metric", metric, sizeof(metric));
+		if (p)
+			p = json_field(p, "unit", unit, sizeof(unit));
+		if (p)
+			p = json_field(p, "better", better, sizeof(better));
+		if (p)
+			p = json_field(p, "value", value, sizeof(value));
+		if (!p || strcmp(bench, bench_name))
+			continue;
+		result_key(key, sizeof(key), bench, params, metric);
+		ret = result_update(&baseline, key, params, metric, unit,
+				    strcmp(better, "lower") ?
+				    BENCH_HIGHER : BENCH_LOWER,
+				    strtod(value, NULL));
+		if (ret)
+			break;
+		lines++;
+	}
+	fclose(in);
+	if (!ret && !lines)
+		fprintf(stderr, "WARNING: No %s result in %s\r\n", bench_name,
+			path);
+	return ret;
+}
+
+static void build_info_init(void)
+{
+	char compiler[FIELD_MAX_LEN], sys[FIELD_MAX_LEN], date[32];
+	struct utsname uts;
+	time_t now = time(NULL);
+
+	json_escape(compiler, sizeof(compiler), __VERSION__);
+	if (uname(&uts))
+		snprintf(sys, sizeof(sys), "unknown");
+	else
+		snprintf(sys, sizeof(sys), "%s %s %s", uts.sysname,
+			 uts.release, uts.machine);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	snprintf(build_info, sizeof(build_info),
+		 "\"openamp\":\"%.32s\",\"libmetal\":\"%.32s\",\"compiler\":\"%s\","
+		 "\"system\":\"%s\",\"cpus\":%ld,\"time\":\"%s\"",
+		 openamp_version(), metal_ver(), compiler, sys,
+		 sysconf(_SC_NPROCESSORS_ONLN), date);
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Results
+ *-----------------------------------------------------------------------------*/
+int bench_result_start(const char *bench)
+{
+	int ret;
+
+	bench_name = bench;
+	if (compare_path) {
+		ret = baseline_load(compare_path);
+		if (ret)
+			return ret;
+	}
+	if (json_path) {
+		json_out = fopen(json_path, "a");
+		if (!json_out) {
+			ret = -errno;
+			fprintf(stderr, "ERROR: Failed to open %s: %s\r\n",
+				json_path, strerror(errno));
+			result_free(&baseline);
+			return ret;
+		}
+		build_info_init();
+	}
+	return 0;
+}
+
+void bench_result_add(const char *params, const char *metric,
+		      const char *unit, enum bench_better better,
+		      double value)
+{
+	char jparams[FIELD_MAX_LEN], key[LINE_MAX_LEN];
+
+	if ((!json_out && !compare_path) || !isfinite(value))
+		return;
+	json_params(jparams, sizeof(jparams), params);
+	if (json_out)
+		fprintf(json_out, "{\"bench\":\"%s\",\"params\":%s,"
+			"\"metric\":\"%s\",\"unit\":\"%s\",\"better\":\"%s\","
+			"\"value\":%.3f,%s}\n", bench_name, jparams, metric,
+			unit, better == BENCH_LOWER ? "lower" : "higher",
+			value, build_info);
+	if (compare_path) {
+		result_key(key, sizeof(key), bench_name, jparams, metric);
+		if (result_update(&current, key, jparams, metric, unit, better,
+				  value))
+			fprintf(stderr, "ERROR: No memory for the results\r\n");
+	}
+}
+
+static int compare_print(void)
+{
+	const struct result_stat *cur, *base;
+	char params[FIELD_MAX_LEN];
+	double mean, base_mean, change, thr;
+	int regressions = 0;
+	const char *verdict;
+	unsigned int i;
+
+	printf("\r\nComparison with %s, threshold %.1f%% or %.0f sigma\r\n",
+	       compare_path, threshold, NOISE_SIGMAS);
+	printf("%-16s %-28s %14s %14s %9s %8s %s\r\n", "metric", "params",
+	       "baseline", "current", "change", "thresh", "verdict");
+	for (i = 0; i < current.num; i++) {
+		cur = &current.stats[i];
+		base = result_find(&baseline, cur->key);
+		json_params_text(params, sizeof(params), cur->params);
+		mean = result_mean(cur);
+		if (!base) {
+			printf("%-16s %-28s %14s %14.3f %9s %8s new\r\n",
+			       cur->metric, params, "-", mean, "-", "-");
+			continue;
+		}
+		base_mean = result_mean(base);
+		if (base_mean == 0) {
+			printf("%-16s %-28s %14.3f %14.3f %9s %8s n/a\r\n",
+			       cur->metric, params, base_mean, mean, "-", "-");
+			continue;
+		}
+		change = 100.0 * (mean - base_mean) / fabs(base_mean);
+		thr = 100.0 * NOISE_SIGMAS *
+		      sqrt(result_var(base) / base->n +
+			   result_var(cur) / cur->n) / fabs(base_mean);
+		if (thr < threshold)
+			thr = threshold;
+		if (cur->better == BENCH_LOWER)
+			change = -change;
+		if (change < -thr) {
+			verdict = "REGRESSION";
+			regressions++;
+		} else if (change > thr) {
+			verdict = "improved";
+		} else {
+			verdict = "ok";
+		}
+		if (cur->better == BENCH_LOWER)
+			change = -change;
+		printf("%-16s %-28s %14.3f %14.3f %+8.1f%% %7.1f%% %s (%lu run%s)\r\n",
+		       cur->metric, params, base_mean, mean, change, thr,
+		       verdict, base->n, base->n > 1 ? "s" : "");
+	}
+	printf("%d regression%s\r\n", regressions, regressions == 1 ? "" : "s");
+	return regressions;
+}
+
+int bench_result_finish(void)
+{
+	int ret = 0;
+
+	if (json_out) {
+		if (fclose(json_out))
+			ret = -errno;
+		json_out = NULL;
+	}
+	if (compare_path) {
+		if (!ret && current.num)
+			ret = compare_print();
+		result_free(&baseline);
+		result_free(&current);
+	}
+	return ret;
+}
@@ -0,0 +1,96 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Result store of the benchmarks. Each result is a JSON line holding the
+ * benchmark name, its parameters, the metric and its value, with the
+ * OpenAMP and libmetal versions, the compiler and the machine, so that the
+ * results of several builds and machines can be kept in one file.
+ *
+ * The results of a run can also be compared with a baseline file, holding
+ * the results of one or, better, several runs of the previous build: for
+ * each metric, the relative change from the baseline mean is reported and
+ * flagged as a regression or an improvement when it exceeds the noise of
+ * the baseline runs, 3 standard deviations, or the minimum threshold.
+ */
+
+#ifndef BENCH_RESULT_H
+#define BENCH_RESULT_H
+
+#include <getopt.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* Options of the result store, for getopt_long() */
+#define BENCH_RESULT_SHORT_OPTIONS	"j:"
+#define BENCH_RESULT_OPT_COMPARE	0x100
+#define BENCH_RESULT_OPT_THRESHOLD	0x101
+#define BENCH_RESULT_LONG_OPTIONS \
+	{ "json", required_argument, NULL, 'j' }, \
+	{ "compare", required_argument, NULL, BENCH_RESULT_OPT_COMPARE }, \
+	{ "threshold", required_argument, NULL, BENCH_RESULT_OPT_THRESHOLD }
+#define BENCH_RESULT_USAGE \
+	"[-j|--json results.json] [--compare baseline.json] [--threshold pct]"
+
+/* Minimum relative change flagged, in percent */
+#define BENCH_RESULT_THRESHOLD_DEF	2.0
+
+enum bench_better {
+	BENCH_LOWER,	/* lower is better, as a latency */
+	BENCH_HIGHER,	/* higher is better, as a throughput */
+};
+
+/**
+ * bench_result_option - handle an option of the result store
+ *
+ * @opt: option returned by getopt_long()
+ * @arg: its argument
+ *
+ * return 0 if handled, -1 if not an option of the result store or invalid
+ */
+int bench_result_option(int opt, const char *arg);
+
+/**
+ * bench_result_start - start storing the results of a benchmark
+ *
+ * The results are appended to the file given with -j, and the baseline
+ * given with --compare is loaded. Without either option, the results are
+ * dropped.
+ *
+ * @bench: name of the benchmark
+ *
+ * return 0 for success, a negative errno otherwise
+ */
+int bench_result_start(const char *bench);
+
+/**
+ * bench_result_add - add a result
+ *
+ * @params: parameters of the result, as "size=16,window=8"; numeric values
+ *          are stored as numbers, others as strings
+ * @metric: name of the metric, as "rtt_avg"
+ * @unit: unit of the metric, as "ns"
+ * @better: whether lower or higher is better
+ * @value: value of the metric
+ */
+void bench_result_add(const char *params, const char *metric,
+		      const char *unit, enum bench_better better,
+		      double value);
+
+/**
+ * bench_result_finish - close the results, and compare them with the
+ * baseline if any
+ *
+ * return the number of regressions against the baseline, 0 without
+ * baseline, or a negative errno
+ */
+int bench_result_finish(void);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif /* BENCH_RESULT_H */
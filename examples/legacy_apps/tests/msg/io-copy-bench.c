@@ -0,0 +1,153 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * This is a micro-benchmark of the copies into the shared memory io region
+ * of the Linux generic machine, for payloads from 16 B to 64 KB. It compares
+ * plain memcpy(), the io region of the machine in its "ops", "direct" and
+ * "simd" io modes, see platform_shm_io_init(), and the copy kernels.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <metal/io.h>
+#include "copy_kernels.h"
+#include "platform_info.h"
+
+#define LPRINTF(format, ...) printf(format, ##__VA_ARGS__)
+#define LPERROR(format, ...) LPRINTF("ERROR: " format, ##__VA_ARGS__)
+
+#define SIZE_MIN	16
+#define SIZE_MAX_	(64 * 1024)
+#define BYTES_PER_SIZE	(256UL * 1024 * 1024)
+#define ITER_MIN	1000
+#define NS_PER_S	(1000 * 1000 * 1000)
+
+/* Globals */
+static unsigned char *src_buf;
+static unsigned char *shm_buf;
+static struct metal_io_region io_ops;
+static struct metal_io_region io_simd;
+static struct metal_io_region io_direct;
+
+static unsigned long long bench_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static void copy_memcpy(size_t len)
+{
+	memcpy(shm_buf, src_buf, len);
+}
+
+static void copy_io_ops(size_t len)
+{
+	metal_io_block_write(&io_ops, 0, src_buf, len);
+}
+
+static void copy_io_direct(size_t len)
+{
+	metal_io_block_write(&io_direct, 0, src_buf, len);
+}
+
+static void copy_io_simd(size_t len)
+{
+	metal_io_block_write(&io_simd, 0, src_buf, len);
+}
+
+static void copy_kernel_write(size_t len)
+{
+	copy_kernel(shm_buf, src_buf, len);
+}
+
+static const struct {
+	const char *name;
+	void (*copy)(size_t len);
+} modes[] = {
+	{ "memcpy", copy_memcpy },
+	{ "io-ops", copy_io_ops },
+	{ "io-direct", copy_io_direct },
+	{ "io-simd", copy_io_simd },
+	{ "kernel", copy_kernel_write },
+};
+
+static void print_help(const char *prog)
+{
+	LPRINTF("usage: %s [-t nt_threshold]\r\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long tstart, tdiff;
+	size_t nt_threshold = COPY_NT_DEF_THRESHOLD;
+	unsigned long iter, i;
+	unsigned int m;
+	size_t len;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't':
+			nt_threshold = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+
+	src_buf = aligned_alloc(4096, SIZE_MAX_);
+	shm_buf = aligned_alloc(4096, SIZE_MAX_);
+	if (!src_buf || !shm_buf) {
+		LPERROR("memory allocation failed.\r\n");
+		return -1;
+	}
+	memset(src_buf, 0xA5, SIZE_MAX_);
+	memset(shm_buf, 0, SIZE_MAX_);
+
+	copy_kernels_init(nt_threshold);
+	/* The shared memory io region of the machine, in each io mode */
+	platform_shm_io_init(&io_ops, shm_buf, SIZE_MAX_, "ops");
+	platform_shm_io_init(&io_simd, shm_buf, SIZE_MAX_, "simd");
+	platform_shm_io_init(&io_direct, shm_buf, SIZE_MAX_, "direct");
+
+	LPRINTF("copy kernels: %s, non-temporal from %lu bytes\r\n",
+		copy_kernels_name(), (unsigned long)nt_threshold);
+	LPRINTF("%8s", "size");
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+		LPRINTF(" %18s", modes[m].name);
+	LPRINTF("\r\n%8s", "");
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+		LPRINTF(" %18s", "ns/copy    MB/s");
+	LPRINTF("\r\n");
+
+	for (len = SIZE_MIN; len <= SIZE_MAX_; len *= 2) {
+		iter = BYTES_PER_SIZE / len;
+		if (iter < ITER_MIN)
+			iter = ITER_MIN;
+		LPRINTF("%8lu", (unsigned long)len);
+		for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			/* Warm up the caches and the branch predictors */
+			for (i = 0; i < ITER_MIN; i++)
+				modes[m].copy(len);
+			tstart = bench_gettime();
+			for (i = 0; i < iter; i++)
+				modes[m].copy(len);
+			tdiff = bench_gettime() - tstart;
+			LPRINTF(" %9.1f %8.0f", (double)tdiff / iter,
+				(double)len * iter * 1000 / tdiff);
+		}
+		LPRINTF("\r\n");
+	}
+
+	free(src_buf);
+	free(shm_buf);
+	return 0;
+}
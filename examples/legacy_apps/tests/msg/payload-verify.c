@@ -0,0 +1,195 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Payload generator and verifier for the message tests. The CRC32C is
+ * computed with the SSE4.2 crc32 instruction on x86_64 CPUs supporting it,
+ * with the ARMv8 CRC instructions when the build targets them, and with a
+ * slicing-by-8 table otherwise.
+ */
+
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#include "payload-verify.h"
+
+#define CRC32C_POLY	0x82f63b78U
+
+typedef uint32_t (*crc_fn)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t crc_table[8][256];
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t v;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, sizeof(v));
+		v ^= crc;
+		crc = crc_table[7][v & 0xff] ^
+		      crc_table[6][(v >> 8) & 0xff] ^
+		      crc_table[5][(v >> 16) & 0xff] ^
+		      crc_table[4][(v >> 24) & 0xff] ^
+		      crc_table[3][(v >> 32) & 0xff] ^
+		      crc_table[2][(v >> 40) & 0xff] ^
+		      crc_table[1][(v >> 48) & 0xff] ^
+		      crc_table[0][v >> 56];
+	}
+	for (; len; len--, p++)
+		crc = crc_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t c = crc, v;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, sizeof(v));
+		c = _mm_crc32_u64(c, v);
+	}
+	crc = c;
+	for (; len; len--, p++)
+		crc = _mm_crc32_u8(crc, *p);
+	return crc;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_armv8(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t v;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32cd(crc, v);
+	}
+	for (; len; len--, p++)
+		crc = __crc32cb(crc, *p);
+	return crc;
+}
+#endif
+
+static crc_fn crc_kernel = crc32c_table;
+static const char *crc_kernel_name = "table";
+
+void payload_verify_init(void)
+{
+	uint32_t crc;
+	unsigned int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		crc_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++)
+			crc_table[j][i] = crc_table[0][crc_table[j - 1][i] & 0xff] ^
+					  (crc_table[j - 1][i] >> 8);
+	}
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		crc_kernel = crc32c_sse42;
+		crc_kernel_name = "sse4.2";
+	}
+#elif defined(__ARM_FEATURE_CRC32)
+	crc_kernel = crc32c_armv8;
+	crc_kernel_name = "armv8-crc";
+#endif
+}
+
+const char *payload_verify_name(void)
+{
+	return crc_kernel_name;
+}
+
+uint32_t payload_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	return ~crc_kernel(~crc, buf, len);
+}
+
+/* xorshift64* pattern, seeded by the seed and the sequence number */
+static void payload_pattern(unsigned char *p, size_t len, uint32_t seq,
+			    uint32_t seed)
+{
+	uint64_t x = ((uint64_t)seed << 32 | seq) ^ 0x9e3779b97f4a7c15ULL;
+	uint64_t v;
+
+	for (;;) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		v = x * 0x2545f4914f6cdd1dULL;
+		if (len < sizeof(v))
+			break;
+		memcpy(p, &v, sizeof(v));
+		p += sizeof(v);
+		len -= sizeof(v);
+	}
+	memcpy(p, &v, len);
+}
+
+void payload_fill(void *buf, size_t len, uint32_t seq, uint32_t seed)
+{
+	struct payload_hdr hdr;
+	unsigned char *p = buf;
+
+	if (len < sizeof(hdr)) {
+		payload_pattern(p, len, seq, seed);
+		return;
+	}
+	hdr.seq = seq;
+	hdr.len = len;
+	hdr.seed = seed;
+	payload_pattern(p + sizeof(hdr), len - sizeof(hdr), seq, seed);
+	hdr.crc = payload_crc32c(0, &hdr, offsetof(struct payload_hdr, crc));
+	hdr.crc = payload_crc32c(hdr.crc, p + sizeof(hdr), len - sizeof(hdr));
+	memcpy(p, &hdr, sizeof(hdr));
+}
+
+int payload_verify(const void *buf, size_t len, uint32_t seed, uint32_t *seq)
+{
+	unsigned char pattern[sizeof(struct payload_hdr)];
+	const unsigned char *p = buf;
+	struct payload_hdr hdr;
+	uint32_t crc;
+
+	if (len < sizeof(hdr)) {
+		payload_pattern(pattern, len, *seq, seed);
+		return memcmp(p, pattern, len) ? PAYLOAD_ERR_DATA : 0;
+	}
+	memcpy(&hdr, p, sizeof(hdr));
+	if (hdr.len != len)
+		return PAYLOAD_ERR_LEN;
+	crc = payload_crc32c(0, &hdr, offsetof(struct payload_hdr, crc));
+	crc = payload_crc32c(crc, p + sizeof(hdr), len - sizeof(hdr));
+	if (crc != hdr.crc)
+		return PAYLOAD_ERR_CRC;
+	if (hdr.seed != seed)
+		return PAYLOAD_ERR_DATA;
+	*seq = hdr.seq;
+	return 0;
+}
+
+int payload_seq_check(struct payload_seq *s, uint32_t seq)
+{
+	if (seq == s->next) {
+		s->next++;
+		return 0;
+	}
+	if ((int32_t)(seq - s->next) > 0) {
+		s->gaps++;
+		s->lost += seq - s->next;
+		s->next = seq + 1;
+		return PAYLOAD_ERR_GAP;
+	}
+	s->reordered++;
+	return PAYLOAD_ERR_ORDER;
+}
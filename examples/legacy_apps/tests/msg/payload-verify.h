@@ -0,0 +1,117 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Payload generator and verifier for the message tests. A payload is
+ * filled with a pseudo-random pattern derived from a seed and its sequence
+ * number, after a header embedding the sequence number and the CRC32C of
+ * the payload. The verification only computes the CRC32C, with the CRC
+ * instructions of the CPU when available, so that it costs a fraction of a
+ * cycle per byte while still catching the corruptions a constant pattern
+ * misses, as stale or misplaced data. The sequence numbers reveal the lost
+ * and reordered payloads.
+ */
+
+#ifndef PAYLOAD_VERIFY_H
+#define PAYLOAD_VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define PAYLOAD_SEED_DEF	0x5eed0a5aU
+
+/* Errors returned by payload_verify() and payload_seq_check() */
+#define PAYLOAD_ERR_LEN		-1
+#define PAYLOAD_ERR_CRC		-2
+#define PAYLOAD_ERR_DATA	-3
+#define PAYLOAD_ERR_GAP		-4
+#define PAYLOAD_ERR_ORDER	-5
+
+/* Header at the start of the payloads large enough to hold it */
+struct payload_hdr {
+	uint32_t seq;
+	uint32_t len;
+	uint32_t seed;
+	/* CRC32C of the header up to here, then of the pattern */
+	uint32_t crc;
+};
+
+/* Sequence tracking of the received payloads */
+struct payload_seq {
+	uint32_t next;
+	unsigned long gaps;
+	unsigned long lost;
+	unsigned long reordered;
+};
+
+/**
+ * payload_verify_init - select the CRC32C kernel for the CPU
+ */
+void payload_verify_init(void);
+
+/**
+ * payload_verify_name - name of the selected CRC32C kernel
+ *
+ * return "sse4.2", "armv8-crc" or "table"
+ */
+const char *payload_verify_name(void);
+
+/**
+ * payload_crc32c - update a CRC32C
+ *
+ * @crc: CRC32C of the previous data, 0 to start
+ * @buf: data
+ * @len: size of the data
+ *
+ * return the CRC32C of the previous data followed by buf
+ */
+uint32_t payload_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * payload_fill - generate a payload
+ *
+ * Payloads smaller than the header only hold the pattern.
+ *
+ * @buf: payload buffer
+ * @len: size of the payload
+ * @seq: sequence number of the payload
+ * @seed: seed of the pattern
+ */
+void payload_fill(void *buf, size_t len, uint32_t seq, uint32_t seed);
+
+/**
+ * payload_verify - verify a payload
+ *
+ * Payloads holding the header are verified on their CRC32C, the smaller
+ * ones against the pattern of the expected sequence number.
+ *
+ * @buf: payload buffer
+ * @len: size of the payload
+ * @seed: seed of the pattern
+ * @seq: expected sequence number, updated with the one of the payload
+ *
+ * return 0 for success or a negative PAYLOAD_ERR_* value
+ */
+int payload_verify(const void *buf, size_t len, uint32_t seed, uint32_t *seq);
+
+/**
+ * payload_seq_check - track the sequence number of a received payload
+ *
+ * @s: sequence tracking, zeroed to expect 0 first
+ * @seq: sequence number of the received payload
+ *
+ * return 0 if the payload is the expected one, PAYLOAD_ERR_GAP if payloads
+ * were skipped, PAYLOAD_ERR_ORDER if it is late or duplicated
+ */
+int payload_seq_check(struct payload_seq *s, uint32_t seq);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif /* PAYLOAD_VERIFY_H */
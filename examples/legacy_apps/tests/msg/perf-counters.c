@@ -0,0 +1,210 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Hardware performance counters of the benchmarks. The counters are opened
+ * in one group, read with a single read(), falling back to counters read
+ * on their own for the ones the group cannot schedule together.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include "perf-counters.h"
+
+#define CALIBRATION_RUNS	64
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} counters[PERF_CNT_NUM] = {
+	[PERF_CNT_CYCLES] = {
+		"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_CNT_INSTRUCTIONS] = {
+		"instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CNT_CACHE_MISSES] = {
+		"cache-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_CNT_BRANCH_MISSES] = {
+		"br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[PERF_CNT_CTX_SWITCHES] = {
+		"ctx-sw", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd)
+{
+	/* Calling thread, any CPU */
+	return syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static int open_counter(struct perf_counters *pc, unsigned int i,
+			int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counters[i].type;
+	attr.config = counters[i].config;
+	attr.exclude_kernel = pc->user_only;
+	attr.exclude_hv = 1;
+	if (group_fd >= 0 || pc->group_fd < 0)
+		attr.read_format = PERF_FORMAT_GROUP;
+	return perf_event_open(&attr, group_fd);
+}
+
+static void perf_counters_read(const struct perf_counters *pc, uint64_t *v)
+{
+	uint64_t buf[1 + PERF_CNT_NUM];
+	unsigned int i;
+
+	memset(v, 0, PERF_CNT_NUM * sizeof(*v));
+	if (pc->group_fd >= 0 &&
+	    read(pc->group_fd, buf, sizeof(buf)) < (ssize_t)sizeof(buf[0]))
+		return;
+	for (i = 0; i < PERF_CNT_NUM; i++) {
+		if (pc->fd[i] < 0)
+			continue;
+		if (pc->group_idx[i] >= 0)
+			v[i] = buf[1 + pc->group_idx[i]];
+		else if (read(pc->fd[i], &v[i], sizeof(v[i])) != sizeof(v[i]))
+			v[i] = 0;
+	}
+}
+
+/* Measure the counts of an empty phase, i.e. of the reads themselves */
+static void perf_counters_calibrate(struct perf_counters *pc)
+{
+	struct perf_phase ph;
+	uint64_t prev[PERF_CNT_NUM];
+	unsigned int i, run;
+
+	memset(pc->overhead, 0, sizeof(pc->overhead));
+	perf_phase_init(&ph, NULL);
+	for (run = 0; run < CALIBRATION_RUNS; run++) {
+		memcpy(prev, ph.sum, sizeof(prev));
+		perf_phase_begin(pc, &ph);
+		perf_phase_end(pc, &ph);
+		for (i = 0; i < PERF_CNT_NUM; i++) {
+			prev[i] = ph.sum[i] - prev[i];
+			if (!run || prev[i] < pc->overhead[i])
+				pc->overhead[i] = prev[i];
+		}
+	}
+}
+
+int perf_counters_open(struct perf_counters *pc)
+{
+	int err = 0, fd;
+	unsigned int i;
+
+	memset(pc, 0, sizeof(*pc));
+	pc->group_fd = -1;
+	for (i = 0; i < PERF_CNT_NUM; i++) {
+		pc->fd[i] = -1;
+		pc->group_idx[i] = -1;
+	}
+
+	for (i = 0; i < PERF_CNT_NUM; i++) {
+		fd = open_counter(pc, i, pc->group_fd);
+		if (fd < 0 && (errno == EACCES || errno == EPERM) &&
+		    !pc->user_only && !pc->nr) {
+			/* perf_event_paranoid forbids counting the kernel */
+			pc->user_only = 1;
+			fd = open_counter(pc, i, pc->group_fd);
+		}
+		if (fd >= 0) {
+			if (pc->group_fd < 0)
+				pc->group_fd = fd;
+			pc->group_idx[i] = pc->nr_group++;
+		} else if (pc->group_fd >= 0) {
+			/* Not schedulable with the group, count on its own */
+			fd = open_counter(pc, i, -1);
+		}
+		if (fd < 0) {
+			err = -errno;
+			continue;
+		}
+		pc->fd[i] = fd;
+		pc->nr++;
+	}
+	if (!pc->nr)
+		return err;
+
+	perf_counters_calibrate(pc);
+	return 0;
+}
+
+void perf_counters_close(struct perf_counters *pc)
+{
+	unsigned int i;
+
+	for (i = 0; i < PERF_CNT_NUM; i++) {
+		if (pc->fd[i] >= 0)
+			close(pc->fd[i]);
+		pc->fd[i] = -1;
+	}
+	pc->group_fd = -1;
+	pc->nr = 0;
+}
+
+void perf_counters_describe(const struct perf_counters *pc)
+{
+	unsigned int i;
+
+	printf("perf counters%s:", pc->user_only ? " (user space only)" : "");
+	for (i = 0; i < PERF_CNT_NUM; i++)
+		if (pc->fd[i] >= 0)
+			printf(" %s", counters[i].name);
+	printf(", per message\r\n");
+}
+
+void perf_phase_init(struct perf_phase *ph, const char *name)
+{
+	memset(ph, 0, sizeof(*ph));
+	ph->name = name;
+}
+
+void perf_phase_begin(const struct perf_counters *pc, struct perf_phase *ph)
+{
+	if (pc->nr)
+		perf_counters_read(pc, ph->start);
+}
+
+void perf_phase_end(const struct perf_counters *pc, struct perf_phase *ph)
+{
+	uint64_t v[PERF_CNT_NUM], delta;
+	unsigned int i;
+
+	if (!pc->nr)
+		return;
+	perf_counters_read(pc, v);
+	for (i = 0; i < PERF_CNT_NUM; i++) {
+		delta = v[i] - ph->start[i];
+		ph->sum[i] += delta > pc->overhead[i] ? delta - pc->overhead[i] : 0;
+	}
+	ph->count++;
+}
+
+void perf_phase_print(const struct perf_counters *pc,
+		      const struct perf_phase *ph, unsigned long msgs,
+		      const char *prefix)
+{
+	unsigned int i;
+
+	if (!pc->nr || !msgs)
+		return;
+	printf("%s%-10s", prefix, ph->name);
+	for (i = 0; i < PERF_CNT_NUM; i++) {
+		if (pc->fd[i] < 0)
+			printf(" %s -", counters[i].name);
+		else
+			printf(" %s %.2f", counters[i].name,
+			       (double)ph->sum[i] / msgs);
+	}
+	printf("\r\n");
+}
@@ -0,0 +1,119 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Hardware performance counters of the benchmarks, read with
+ * perf_event_open() around the phases of their loops: the CPU cycles,
+ * instructions, cache misses, branch misses and context switches of the
+ * calling thread are accumulated per phase and reported per message. The
+ * counters the kernel or the CPU do not provide, as in most virtual
+ * machines, are left out; without any counter the phases are no-ops.
+ */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+enum perf_cnt_id {
+	PERF_CNT_CYCLES,
+	PERF_CNT_INSTRUCTIONS,
+	PERF_CNT_CACHE_MISSES,
+	PERF_CNT_BRANCH_MISSES,
+	PERF_CNT_CTX_SWITCHES,
+	PERF_CNT_NUM,
+};
+
+struct perf_counters {
+	/* Leader of the counters read together, -1 if none */
+	int group_fd;
+	/* Counter file descriptors, -1 if unavailable */
+	int fd[PERF_CNT_NUM];
+	/* Position in the group read, -1 if read on its own */
+	int group_idx[PERF_CNT_NUM];
+	unsigned int nr_group;
+	/* Number of available counters */
+	unsigned int nr;
+	/* Set if the kernel is not counted, for lack of permission */
+	int user_only;
+	/* Counts of an empty phase, subtracted from the phases */
+	uint64_t overhead[PERF_CNT_NUM];
+};
+
+struct perf_phase {
+	const char *name;
+	uint64_t start[PERF_CNT_NUM];
+	uint64_t sum[PERF_CNT_NUM];
+	unsigned long count;
+};
+
+/**
+ * perf_counters_open - open the counters of the calling thread
+ *
+ * @pc: counters
+ *
+ * return 0 if at least one counter is available, a negative errno
+ * otherwise, in which case the phases are no-ops
+ */
+int perf_counters_open(struct perf_counters *pc);
+
+/**
+ * perf_counters_close - close the counters
+ *
+ * @pc: counters
+ */
+void perf_counters_close(struct perf_counters *pc);
+
+/**
+ * perf_counters_describe - print the available counters
+ *
+ * @pc: counters
+ */
+void perf_counters_describe(const struct perf_counters *pc);
+
+/**
+ * perf_phase_init - reset a phase
+ *
+ * @ph: phase
+ * @name: name of the phase in the report
+ */
+void perf_phase_init(struct perf_phase *ph, const char *name);
+
+/**
+ * perf_phase_begin - start counting a phase
+ *
+ * @pc: counters
+ * @ph: phase
+ */
+void perf_phase_begin(const struct perf_counters *pc, struct perf_phase *ph);
+
+/**
+ * perf_phase_end - stop counting a phase, and add its counts
+ *
+ * @pc: counters
+ * @ph: phase
+ */
+void perf_phase_end(const struct perf_counters *pc, struct perf_phase *ph);
+
+/**
+ * perf_phase_print - print the counts of a phase per message
+ *
+ * @pc: counters
+ * @ph: phase
+ * @msgs: number of messages the counts are divided by
+ * @prefix: printed before the phase name
+ */
+void perf_phase_print(const struct perf_counters *pc,
+		      const struct perf_phase *ph, unsigned long msgs,
+		      const char *prefix);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,601 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * This is a benchmark application to measure how the rpmsg throughput and
+ * its fairness behave with the number of endpoints sharing one rpmsg
+ * device. The echo role echoes back the messages on every data endpoint.
+ * The ping role creates the data endpoints, drives them from one or more
+ * sender threads, each endpoint keeping a window of messages in flight,
+ * while the main thread polls the device. For each number of endpoints, it
+ * reports the aggregate rate, the per endpoint rates and their Jain
+ * fairness index.
+ *
+ * The data endpoints are created at fixed addresses on both sides, without
+ * name service, so that their number is not limited by the address bitmap
+ * of the rpmsg device. The number of endpoints is set up by the ping role
+ * through the control endpoint, which is bound with the name service as for
+ * the other tests.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openamp/open_amp.h>
+#include <metal/alloc.h>
+#include <metal/atomic.h>
+#include "bench-result.h"
+#include "platform_info.h"
+#include "rpmsg-ping.h"
+
+#define LPRINTF(format, ...) printf(format, ##__VA_ARGS__)
+#define LPERROR(format, ...) LPRINTF("ERROR: " format, ##__VA_ARGS__)
+
+#define SHUTDOWN_MSG		0xEF56A55A
+#define SETUP_MSG		0xEF56A5E0
+#define EPT_ADDR_BASE		0x10000
+#define MAX_EPTS		1000
+#define MAX_POINTS		16
+#define DEF_EPTS		"1,10,100,1000"
+#define PAYLOAD_DEF_SIZE	16
+#define DURATION_DEF_MS		1000
+#define WINDOW_DEF		1
+#define MAX_THREADS		64
+#define NS_PER_S		(1000 * 1000 * 1000)
+#define NS_PER_MS		(1000 * 1000)
+
+struct _payload {
+	unsigned long num;
+	unsigned long size;
+	unsigned char data[];
+};
+
+/* Control message, from the ping role to the echo role and back */
+struct bench_setup {
+	unsigned int msg;
+	unsigned int num_epts;
+};
+
+/*
+ * Data endpoint. The sent count is only written by the sender thread of the
+ * endpoint, the received count only by the polling thread.
+ */
+struct bench_ept {
+	struct rpmsg_endpoint ept;
+	unsigned long sent;
+	atomic_ulong rnum;
+	unsigned long no_buff;
+	int err_cnt;
+};
+
+struct bench_sender {
+	pthread_t thread;
+	unsigned int index;
+	struct _payload *payload;
+};
+
+/* Globals */
+static void *platform;
+static struct rpmsg_endpoint lept;
+static struct bench_ept *epts;
+static unsigned int num_epts;
+static unsigned int num_threads = 1;
+static unsigned int window = WINDOW_DEF;
+static struct _payload *i_payload;
+static int payload_len;
+static atomic_int stop_send;
+static int setup_req;
+static unsigned int setup_epts;
+static int shutdown_req;
+static int ept_deleted;
+static int verbose;
+
+static unsigned long long bench_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  RPMSG endpoint callbacks
+ *-----------------------------------------------------------------------------*/
+static int echo_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			    uint32_t src, void *priv)
+{
+	int ret;
+
+	(void)src;
+	(void)priv;
+
+	/* Send data back to host */
+	do {
+		ret = rpmsg_send(ept, data, len);
+	} while (ret == RPMSG_ERR_NO_BUFF);
+	if (ret < 0)
+		LPERROR("rpmsg_send, size %lu failed %d\r\n",
+			(unsigned long)len, ret);
+	return RPMSG_SUCCESS;
+}
+
+static int ping_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			    uint32_t src, void *priv)
+{
+	struct _payload *r_payload = (struct _payload *)data;
+	struct bench_ept *be = priv;
+	unsigned long rnum;
+
+	(void)src;
+
+	rnum = atomic_load_explicit(&be->rnum, memory_order_relaxed);
+	if (len < sizeof(*r_payload) || r_payload->num != rnum) {
+		LPERROR("Unexpected payload %lu on endpoint %#x, expected %lu\r\n",
+			r_payload->num, ept->addr, rnum);
+		be->err_cnt++;
+	}
+	atomic_store_explicit(&be->rnum, rnum + 1, memory_order_release);
+	return RPMSG_SUCCESS;
+}
+
+static int ctrl_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			    uint32_t src, void *priv)
+{
+	struct bench_setup *setup = data;
+
+	(void)ept;
+	(void)src;
+	(void)priv;
+
+	if (len >= sizeof(unsigned int) && setup->msg == SHUTDOWN_MSG) {
+		shutdown_req = 1;
+	} else if (len == sizeof(*setup) && setup->msg == SETUP_MSG) {
+		/* The endpoints are set up out of the callback */
+		setup_epts = setup->num_epts;
+		setup_req = 1;
+	} else {
+		LPERROR("Unexpected control message.\r\n");
+	}
+	return RPMSG_SUCCESS;
+}
+
+static void rpmsg_service_unbind(struct rpmsg_endpoint *ept)
+{
+	(void)ept;
+	rpmsg_destroy_ept(&lept);
+	LPRINTF("endpoints bench: service is destroyed\r\n");
+	ept_deleted = 1;
+	shutdown_req = 1;
+}
+
+static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
+				       const char *name, uint32_t dest)
+{
+	LPRINTF("new endpoint notification is received.\r\n");
+	if (strcmp(name, RPMSG_SERVICE_NAME))
+		LPERROR("Unexpected name service %s.\r\n", name);
+	else
+		(void)rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+				       RPMSG_ADDR_ANY, dest,
+				       ctrl_endpoint_cb,
+				       rpmsg_service_unbind);
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Data endpoints
+ *-----------------------------------------------------------------------------*/
+static void destroy_epts(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_epts; i++)
+		rpmsg_destroy_ept(&epts[i].ept);
+	num_epts = 0;
+}
+
+static int create_epts(struct rpmsg_device *rdev, unsigned int num,
+		       rpmsg_ept_cb cb)
+{
+	struct bench_ept *be;
+	unsigned int i;
+	int ret;
+
+	destroy_epts();
+	for (i = 0; i < num; i++, num_epts++) {
+		be = &epts[i];
+		memset(be, 0, sizeof(*be));
+		atomic_init(&be->rnum, 0);
+		ret = rpmsg_create_ept(&be->ept, rdev, "",
+				       EPT_ADDR_BASE + i, EPT_ADDR_BASE + i,
+				       cb, NULL);
+		if (ret) {
+			LPERROR("Failed to create endpoint %u: %d.\r\n", i,
+				ret);
+			return ret;
+		}
+		be->ept.priv = be;
+	}
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Echo role
+ *-----------------------------------------------------------------------------*/
+static int bench_echo(struct rpmsg_device *rdev)
+{
+	struct bench_setup setup = { .msg = SETUP_MSG };
+	int ret;
+
+	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+			       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
+			       ctrl_endpoint_cb, rpmsg_service_unbind);
+	if (ret) {
+		LPERROR("Failed to create endpoint.\r\n");
+		return ret;
+	}
+
+	while (!shutdown_req) {
+		platform_poll(platform);
+		if (!setup_req)
+			continue;
+		setup_req = 0;
+		if (setup_epts > MAX_EPTS)
+			setup_epts = MAX_EPTS;
+		ret = create_epts(rdev, setup_epts, echo_endpoint_cb);
+		/* Acknowledge with the number of endpoints created */
+		setup.num_epts = num_epts;
+		rpmsg_send(&lept, &setup, sizeof(setup));
+		if (!ret)
+			LPRINTF("%u endpoints are created.\r\n", num_epts);
+	}
+
+	destroy_epts();
+	if (!ept_deleted)
+		rpmsg_destroy_ept(&lept);
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Ping role
+ *-----------------------------------------------------------------------------*/
+/* Round robin over the endpoints of the thread, keeping their window full */
+static void *bench_sender_thread(void *arg)
+{
+	struct bench_sender *sender = arg;
+	struct _payload *payload = sender->payload;
+	struct bench_ept *be;
+	unsigned long rnum;
+	unsigned int i;
+	int ret;
+
+	while (!atomic_load_explicit(&stop_send, memory_order_relaxed)) {
+		for (i = sender->index; i < num_epts; i += num_threads) {
+			be = &epts[i];
+			rnum = atomic_load_explicit(&be->rnum,
+						    memory_order_acquire);
+			if (be->sent - rnum >= window)
+				continue;
+			payload->num = be->sent;
+			ret = rpmsg_trysend(&be->ept, payload, payload_len);
+			if (ret == RPMSG_ERR_NO_BUFF) {
+				be->no_buff++;
+				continue;
+			}
+			if (ret < 0) {
+				be->err_cnt++;
+				continue;
+			}
+			be->sent++;
+		}
+		sched_yield();
+	}
+	return NULL;
+}
+
+static void print_ept_stats(unsigned long long tdiff)
+{
+	unsigned long long rate, min_rate = ~0ULL, max_rate = 0;
+	unsigned long long total = 0, no_buff = 0;
+	unsigned long rnum;
+	double sum = 0, sum_sq = 0;
+	char params[64];
+	unsigned int i;
+
+	for (i = 0; i < num_epts; i++) {
+		rnum = atomic_load(&epts[i].rnum);
+		rate = (unsigned long long)rnum * 2 * NS_PER_S / tdiff;
+		if (verbose)
+			LPRINTF(" endpoint %u: %lu round trips, msgs/s: %llu, no_buff: %lu\r\n",
+				i, rnum, rate, epts[i].no_buff);
+		if (rate < min_rate)
+			min_rate = rate;
+		if (rate > max_rate)
+			max_rate = rate;
+		total += rnum;
+		no_buff += epts[i].no_buff;
+		sum += rate;
+		sum_sq += (double)rate * rate;
+	}
+	LPRINTF("%8u %12llu %10llu %10llu %10llu %8.4f %10llu\r\n",
+		num_epts, total * 2 * NS_PER_S / tdiff, min_rate,
+		(unsigned long long)(sum / num_epts), max_rate,
+		sum_sq ? sum * sum / (num_epts * sum_sq) : 0, no_buff);
+
+	snprintf(params, sizeof(params), "epts=%u,threads=%u,size=%lu,window=%u",
+		 num_epts, num_threads,
+		 (unsigned long)(payload_len - sizeof(struct _payload)), window);
+	bench_result_add(params, "msgs_s", "1/s", BENCH_HIGHER,
+			 (double)total * 2 * NS_PER_S / tdiff);
+	bench_result_add(params, "ept_min_msgs_s", "1/s", BENCH_HIGHER,
+			 min_rate);
+	if (sum_sq)
+		bench_result_add(params, "jain", "", BENCH_HIGHER,
+				 sum * sum / (num_epts * sum_sq));
+}
+
+static int bench_point(struct rpmsg_device *rdev, unsigned int num,
+		       unsigned long long duration_ns)
+{
+	struct bench_setup setup = { .msg = SETUP_MSG, .num_epts = num };
+	struct bench_sender senders[MAX_THREADS];
+	unsigned long long tstart, tdiff;
+	unsigned int i, started = 0;
+	int err_cnt = 0;
+	int ret;
+
+	/* Create the echo endpoints first, then the local ones */
+	setup_req = 0;
+	ret = rpmsg_send(&lept, &setup, sizeof(setup));
+	if (ret < 0) {
+		LPERROR("Failed to send the setup message.\r\n");
+		return ret;
+	}
+	while (!setup_req && !ept_deleted)
+		platform_poll(platform);
+	if (ept_deleted || setup_epts != num) {
+		LPERROR("The echo failed to create %u endpoints.\r\n", num);
+		return -1;
+	}
+	ret = create_epts(rdev, num, ping_endpoint_cb);
+	if (ret)
+		return ret;
+
+	atomic_store(&stop_send, 0);
+	tstart = bench_gettime();
+	for (i = 0; i < num_threads; i++, started++) {
+		/* Each thread numbers the messages in its own payload */
+		senders[i].index = i;
+		senders[i].payload = metal_allocate_memory(payload_len);
+		if (!senders[i].payload) {
+			LPERROR("memory allocation failed.\r\n");
+			ret = -1;
+			break;
+		}
+		memcpy(senders[i].payload, i_payload, payload_len);
+		if (pthread_create(&senders[i].thread, NULL,
+				   bench_sender_thread, &senders[i])) {
+			LPERROR("Failed to create thread %u.\r\n", i);
+			metal_free_memory(senders[i].payload);
+			ret = -1;
+			break;
+		}
+	}
+	while (bench_gettime() - tstart < duration_ns && !ept_deleted)
+		platform_poll(platform);
+	atomic_store(&stop_send, 1);
+	for (i = 0; i < started; i++) {
+		pthread_join(senders[i].thread, NULL);
+		metal_free_memory(senders[i].payload);
+	}
+
+	/* Drain the messages in flight */
+	for (i = 0; i < num_epts && !ept_deleted; i++) {
+		while (atomic_load(&epts[i].rnum) < epts[i].sent &&
+		       !ept_deleted)
+			platform_poll(platform);
+	}
+	tdiff = bench_gettime() - tstart;
+
+	for (i = 0; i < num_epts; i++)
+		err_cnt += epts[i].err_cnt;
+	if (err_cnt || ept_deleted) {
+		LPERROR("%u endpoints: error count = %d\r\n", num, err_cnt);
+		return -1;
+	}
+	print_ept_stats(tdiff);
+	return ret;
+}
+
+static int bench_ping(struct rpmsg_device *rdev, unsigned int *points,
+		      unsigned int num_points, int payload_size,
+		      unsigned long long duration_ns)
+{
+	unsigned int shutdown_msg = SHUTDOWN_MSG;
+	unsigned int i;
+	int ret;
+
+	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+			       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
+			       ctrl_endpoint_cb, rpmsg_service_unbind);
+	if (ret) {
+		LPERROR("Failed to create RPMsg endpoint.\r\n");
+		return ret;
+	}
+	while (!is_rpmsg_ept_ready(&lept))
+		platform_poll(platform);
+	LPRINTF("RPMSG endpoint is binded with remote.\r\n");
+
+	payload_len = sizeof(struct _payload) + payload_size;
+	if (payload_len > rpmsg_get_tx_buffer_size(&lept)) {
+		LPERROR("Payload size %d exceeds the buffer size.\r\n",
+			payload_size);
+		ret = -1;
+		goto out;
+	}
+	i_payload = metal_allocate_memory(payload_len);
+	if (!i_payload) {
+		LPERROR("memory allocation failed.\r\n");
+		ret = -1;
+		goto out;
+	}
+	i_payload->num = 0;
+	i_payload->size = payload_size;
+	memset(i_payload->data, 0xA5, payload_size);
+
+	LPRINTF("payload size: %d, window: %u, threads: %u, duration: %llu ms\r\n",
+		payload_size, window, num_threads, duration_ns / NS_PER_MS);
+	LPRINTF("%8s %12s %10s %10s %10s %8s %10s\r\n", "epts", "msgs/s",
+		"ept min", "ept mean", "ept max", "jain", "no_buff");
+	for (i = 0; i < num_points && !ret; i++)
+		ret = bench_point(rdev, points[i], duration_ns);
+
+	destroy_epts();
+	metal_free_memory(i_payload);
+out:
+	if (!ept_deleted) {
+		rpmsg_send(&lept, &shutdown_msg, sizeof(shutdown_msg));
+		rpmsg_destroy_ept(&lept);
+	}
+	return ret;
+}
+
+/* Parse a list of numbers of endpoints, as "1,10,100,1000" */
+static int parse_points(const char *list, unsigned int *points,
+			unsigned int *num)
+{
+	char *end;
+
+	*num = 0;
+	while (*list) {
+		if (*num >= MAX_POINTS)
+			return -1;
+		points[*num] = strtoul(list, &end, 0);
+		if (end == list || !points[*num] || points[*num] > MAX_EPTS)
+			return -1;
+		(*num)++;
+		list = end;
+		if (*list == ',')
+			list++;
+		else if (*list)
+			return -1;
+	}
+	return *num ? 0 : -1;
+}
+
+static const struct option long_options[] = {
+	BENCH_RESULT_LONG_OPTIONS,
+	{ NULL, 0, NULL, 0 },
+};
+
+static void print_help(const char *prog)
+{
+	LPRINTF("usage: %s [-r echo|ping] [-e epts[,epts...]] [-t threads] "
+		"[-w window] [-s payload_size] [-d duration_ms] [-v] "
+		BENCH_RESULT_USAGE " [proc_id [rsc_id]]\r\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long duration_ns = DURATION_DEF_MS * NS_PER_MS;
+	unsigned int role = VIRTIO_DEV_DEVICE;
+	int payload_size = PAYLOAD_DEF_SIZE;
+	unsigned int points[MAX_POINTS];
+	unsigned int num_points;
+	struct rpmsg_device *rpdev;
+	int opt, ret, res;
+
+	parse_points(DEF_EPTS, points, &num_points);
+	while ((opt = getopt_long(argc, argv,
+				  "r:e:t:w:s:d:vh" BENCH_RESULT_SHORT_OPTIONS,
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			if (!strcmp(optarg, "echo")) {
+				role = VIRTIO_DEV_DEVICE;
+			} else if (!strcmp(optarg, "ping")) {
+				role = VIRTIO_DEV_DRIVER;
+			} else {
+				print_help(argv[0]);
+				return -1;
+			}
+			break;
+		case 'e':
+			if (parse_points(optarg, points, &num_points)) {
+				print_help(argv[0]);
+				return -1;
+			}
+			break;
+		case 't':
+			num_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			payload_size = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration_ns = strtoull(optarg, NULL, 0) * NS_PER_MS;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			if (!bench_result_option(opt, optarg))
+				break;
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+	if (!num_threads || num_threads > MAX_THREADS || !window || !duration_ns || payload_size < 0) {
+		print_help(argv[0]);
+		return -1;
+	}
+
+	epts = metal_allocate_memory(MAX_EPTS * sizeof(*epts));
+	if (!epts) {
+		LPERROR("memory allocation failed.\r\n");
+		return -1;
+	}
+
+	ret = bench_result_start("msg-bench-endpoints");
+	if (ret)
+		return ret;
+
+	/* Initialize platform, with the remaining arguments */
+	ret = platform_init(argc - optind + 1, &argv[optind - 1], &platform);
+	if (ret) {
+		LPERROR("Failed to initialize platform.\r\n");
+		ret = -1;
+	} else {
+		rpdev = platform_create_rpmsg_vdev(platform, 0, role, NULL,
+						   role == VIRTIO_DEV_DRIVER ?
+						   rpmsg_name_service_bind_cb :
+						   NULL);
+		if (!rpdev) {
+			LPERROR("Failed to create rpmsg virtio device.\r\n");
+			ret = -1;
+		} else {
+			if (role == VIRTIO_DEV_DRIVER)
+				ret = bench_ping(rpdev, points, num_points,
+						 payload_size, duration_ns);
+			else
+				ret = bench_echo(rpdev);
+			platform_release_rpmsg_vdev(rpdev, platform);
+		}
+	}
+
+	LPRINTF("Stopping application...\r\n");
+	platform_cleanup(platform);
+	res = bench_result_finish();
+	if (!ret)
+		ret = res;
+	metal_free_memory(epts);
+
+	return ret;
+}
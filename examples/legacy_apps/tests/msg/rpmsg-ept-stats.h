@@ -0,0 +1,121 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Buffer telemetry of an endpoint: messages sent and sends which found no
+ * TX buffer, messages received, and RX buffers held with their age. The
+ * updates are a few increments, cheap enough to be left on; the time stamps
+ * of the held buffers are taken by the caller, in its own time unit, so
+ * that no clock is read when the age is not tracked.
+ */
+
+#ifndef RPMSG_EPT_STATS_H
+#define RPMSG_EPT_STATS_H
+
+#include <stdio.h>
+#include <openamp/open_amp.h>
+
+/* Held buffers histogram buckets: 1, 2-3, 4-7, ... 128 and more */
+#define RPMSG_EPT_STATS_HIST	8
+
+struct rpmsg_ept_stats {
+	unsigned long tx;
+	unsigned long tx_no_buff;
+	unsigned long rx;
+	/* RX buffers held now and at most */
+	unsigned int held;
+	unsigned int held_peak;
+	/* Held buffers on each hold, by power of two */
+	unsigned long held_hist[RPMSG_EPT_STATS_HIST];
+	/* Released buffers, with the sum and maximum of their age */
+	unsigned long released;
+	unsigned long long age_sum;
+	unsigned long long age_max;
+};
+
+/**
+ * rpmsg_ept_stats_send - account a send
+ *
+ * @st: endpoint statistics
+ * @ret: value returned by the rpmsg send function
+ *
+ * return ret
+ */
+static inline int rpmsg_ept_stats_send(struct rpmsg_ept_stats *st, int ret)
+{
+	if (ret >= 0)
+		st->tx++;
+	else if (ret == RPMSG_ERR_NO_BUFF)
+		st->tx_no_buff++;
+	return ret;
+}
+
+/**
+ * rpmsg_ept_stats_recv - account a received message
+ *
+ * @st: endpoint statistics
+ */
+static inline void rpmsg_ept_stats_recv(struct rpmsg_ept_stats *st)
+{
+	st->rx++;
+}
+
+/**
+ * rpmsg_ept_stats_hold - account an RX buffer held
+ *
+ * @st: endpoint statistics
+ */
+static inline void rpmsg_ept_stats_hold(struct rpmsg_ept_stats *st)
+{
+	unsigned int bucket = 0, held = ++st->held;
+
+	if (held > st->held_peak)
+		st->held_peak = held;
+	for (held >>= 1; held && bucket < RPMSG_EPT_STATS_HIST - 1; held >>= 1)
+		bucket++;
+	st->held_hist[bucket]++;
+}
+
+/**
+ * rpmsg_ept_stats_release - account a held RX buffer released
+ *
+ * @st: endpoint statistics
+ * @age: time the buffer was held, in the caller's unit
+ */
+static inline void rpmsg_ept_stats_release(struct rpmsg_ept_stats *st,
+					   unsigned long long age)
+{
+	st->held--;
+	st->released++;
+	st->age_sum += age;
+	if (age > st->age_max)
+		st->age_max = age;
+}
+
+/**
+ * rpmsg_ept_stats_print - print the statistics of an endpoint
+ *
+ * @name: name of the endpoint
+ * @st: endpoint statistics
+ * @unit: unit of the held buffers age
+ */
+static inline void rpmsg_ept_stats_print(const char *name,
+					 const struct rpmsg_ept_stats *st,
+					 const char *unit)
+{
+	unsigned int i;
+
+	printf("%s: tx %lu, no_buff %lu, rx %lu\r\n", name, st->tx,
+	       st->tx_no_buff, st->rx);
+	if (!st->released)
+		return;
+	printf("%s: held peak %u, age avg %llu max %llu %s, "
+	       "held on hold (1,2-3..128+):", name, st->held_peak,
+	       st->age_sum / st->released, st->age_max, unit);
+	for (i = 0; i < RPMSG_EPT_STATS_HIST; i++)
+		printf(" %lu", st->held_hist[i]);
+	printf("\r\n");
+}
+
+#endif /* RPMSG_EPT_STATS_H */
@@ -14,6 +14,8 @@
 #include <unistd.h>
 #include <openamp/open_amp.h>
 #include <metal/alloc.h>
+#include <metal/time.h>
+#include "payload-verify.h"
 #include "platform_info.h"
 #include "rpmsg-ping.h"
 
@@ -38,6 +40,7 @@ static struct _payload *i_payload;
 static int rnum = 0;
 static int err_cnt = 0;
 static int ept_deleted = 0;
+static struct payload_seq rx_seq;
 
 /* External functions */
 extern int init_system();
@@ -50,8 +53,8 @@ static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
 			     uint32_t src, void *priv)
 {
 	struct _payload *r_payload = (struct _payload *)data;
-	unsigned char *r_buf, *i_buf;
-	unsigned int i;
+	uint32_t seq;
+	int ret;
 
 	(void)ept;
 	(void)src;
@@ -64,18 +67,16 @@ static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
 		err_cnt++;
 		return RPMSG_SUCCESS;
 	}
-	/* Validate data buffer integrity. */
-	r_buf = (unsigned char*)r_payload->data;
-	i_buf = (unsigned char*)i_payload->data;
-	for (i = 0; i < (unsigned int)r_payload->size; i++) {
-		if (*r_buf != *i_buf) {
-			LPERROR("Data corruption %lu, size %lu\r\n",
-				r_payload->num, r_payload->size);
-			err_cnt++;
-			break;
-		}
-		r_buf++;
-		i_buf++;
+	/* Validate data buffer integrity and order. */
+	seq = r_payload->num;
+	ret = payload_verify(r_payload->data, r_payload->size,
+			     PAYLOAD_SEED_DEF, &seq);
+	if (!ret)
+		ret = payload_seq_check(&rx_seq, seq);
+	if (ret) {
+		LPERROR("Data corruption %lu, size %lu, error %d\r\n",
+			r_payload->num, r_payload->size, ret);
+		err_cnt++;
 	}
 	rnum = r_payload->num + 1;
 	return RPMSG_SUCCESS;
@@ -108,6 +109,7 @@ static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
  *-----------------------------------------------------------------------------*/
 int app (struct rpmsg_device *rdev, void *priv)
 {
+	unsigned long long tstart, tdiff;
 	int ret;
 	int i, s, max_size;
 	int num_pkgs;
@@ -116,6 +118,8 @@ int app (struct rpmsg_device *rdev, void *priv)
 	LPRINTF(" and validate its integrity ..\r\n");
 
 	num_pkgs = NUMS_PACKAGES;
+	payload_verify_init();
+	LPRINTF("payload CRC32C: %s\r\n", payload_verify_name());
 
 	/* Create RPMsg endpoint */
 	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME, APP_EPT_ADDR,
@@ -145,7 +149,6 @@ int app (struct rpmsg_device *rdev, void *priv)
 	}
 	max_size -= sizeof(struct _payload);
 
-	memset(&(i_payload->data[0]), 0xA5, max_size);
 	for (s = PAYLOAD_MIN_SIZE; s <= max_size; s++) {
 		int size;
 
@@ -154,8 +157,11 @@ int app (struct rpmsg_device *rdev, void *priv)
 		LPRINTF("echo test: package size %d, num of packages: %d\r\n",
 			size, num_pkgs);
 		rnum = 0;
+		memset(&rx_seq, 0, sizeof(rx_seq));
+		tstart = metal_get_timestamp();
 		for (i = 0; i < num_pkgs; i++) {
 			i_payload->num = i;
+			payload_fill(i_payload->data, s, i, PAYLOAD_SEED_DEF);
 			while (!err_cnt && !ept_deleted) {
 				ret = rpmsg_trysend(&lept, i_payload, size);
 				if (ret == RPMSG_ERR_NO_BUFF) {
@@ -177,6 +183,10 @@ int app (struct rpmsg_device *rdev, void *priv)
 
 		if (err_cnt || ept_deleted)
 			break;
+		/* Timestamps are in ns on Linux, in timer ticks elsewhere */
+		tdiff = metal_get_timestamp() - tstart;
+		LPRINTF("echo test: package size %d, elapsed %llu\r\n",
+			size, tdiff);
 	}
 
 	if (ept_deleted)
@@ -0,0 +1,181 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Ring of held RX buffers, for the zero-copy consumers. The endpoint
+ * callback holds the RX buffer and pushes it, the application sends or
+ * processes the held buffers in batches, then releases them in one go.
+ * Single producer, single consumer, no allocation per message: the ring is
+ * allocated once, with at least as many entries as the RX vring, as the
+ * remote cannot send more buffers than that before some are released.
+ */
+
+#ifndef RPMSG_HELD_RING_H
+#define RPMSG_HELD_RING_H
+
+#include <metal/alloc.h>
+#include <metal/atomic.h>
+#include <metal/utilities.h>
+#include <openamp/open_amp.h>
+
+#define HELD_RING_CACHE_LINE	64
+
+struct rpmsg_held_buf {
+	struct rpmsg_endpoint *ept;
+	void *data;
+	size_t len;
+	/* Time stamp of the hold, for the held buffers age */
+	unsigned long long ts;
+};
+
+/*
+ * The producer and consumer indexes are free running, and each of them
+ * has its own cache line so that both sides do not bounce the same line.
+ */
+struct rpmsg_held_ring {
+	struct rpmsg_held_buf *bufs;
+	unsigned int mask;
+	atomic_uint head __attribute__((aligned(HELD_RING_CACHE_LINE)));
+	atomic_uint tail __attribute__((aligned(HELD_RING_CACHE_LINE)));
+};
+
+/**
+ * rpmsg_held_ring_init - allocate the ring
+ *
+ * @ring: ring to initialize
+ * @rdev: rpmsg virtio device the buffers are received from, the ring gets
+ *	  at least as many entries as its RX vring
+ *
+ * return 0 for success or -1 if the allocation failed
+ */
+static inline int rpmsg_held_ring_init(struct rpmsg_held_ring *ring,
+				       struct rpmsg_device *rdev)
+{
+	struct rpmsg_virtio_device *rvdev;
+	unsigned int size = 1;
+
+	rvdev = metal_container_of(rdev, struct rpmsg_virtio_device, rdev);
+	while (size < rvdev->rvq->vq_nentries)
+		size <<= 1;
+	ring->bufs = metal_allocate_memory(size * sizeof(*ring->bufs));
+	if (!ring->bufs)
+		return -1;
+	ring->mask = size - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return 0;
+}
+
+static inline void rpmsg_held_ring_deinit(struct rpmsg_held_ring *ring)
+{
+	metal_free_memory(ring->bufs);
+	ring->bufs = NULL;
+}
+
+/**
+ * rpmsg_held_ring_push_ts - hold an RX buffer and queue it with a time
+ * stamp, producer side
+ *
+ * @ring: ring of held buffers
+ * @ept: endpoint the buffer was received on
+ * @data: RX buffer, as passed to the endpoint callback
+ * @len: length of the RX buffer
+ * @ts: time stamp of the hold, in the caller's unit
+ *
+ * return 0 for success or -1 if the ring is full, the buffer is not held
+ */
+static inline int rpmsg_held_ring_push_ts(struct rpmsg_held_ring *ring,
+					  struct rpmsg_endpoint *ept,
+					  void *data, size_t len,
+					  unsigned long long ts)
+{
+	unsigned int head, tail;
+	struct rpmsg_held_buf *buf;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail > ring->mask)
+		return -1;
+	rpmsg_hold_rx_buffer(ept, data);
+	buf = &ring->bufs[head & ring->mask];
+	buf->ept = ept;
+	buf->data = data;
+	buf->len = len;
+	buf->ts = ts;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return 0;
+}
+
+/**
+ * rpmsg_held_ring_push - hold an RX buffer and queue it, producer side
+ *
+ * @ring: ring of held buffers
+ * @ept: endpoint the buffer was received on
+ * @data: RX buffer, as passed to the endpoint callback
+ * @len: length of the RX buffer
+ *
+ * return 0 for success or -1 if the ring is full, the buffer is not held
+ */
+static inline int rpmsg_held_ring_push(struct rpmsg_held_ring *ring,
+				       struct rpmsg_endpoint *ept,
+				       void *data, size_t len)
+{
+	return rpmsg_held_ring_push_ts(ring, ept, data, len, 0);
+}
+
+/**
+ * rpmsg_held_ring_count - number of held buffers, consumer side
+ *
+ * The buffers are then accessed with rpmsg_held_ring_at().
+ *
+ * @ring: ring of held buffers
+ *
+ * return the number of queued buffers
+ */
+static inline unsigned int rpmsg_held_ring_count(struct rpmsg_held_ring *ring)
+{
+	return atomic_load_explicit(&ring->head, memory_order_acquire) -
+	       atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+/**
+ * rpmsg_held_ring_at - get a held buffer, consumer side
+ *
+ * @ring: ring of held buffers
+ * @index: index from the oldest held buffer, below rpmsg_held_ring_count()
+ *
+ * return the held buffer
+ */
+static inline struct rpmsg_held_buf *
+rpmsg_held_ring_at(struct rpmsg_held_ring *ring, unsigned int index)
+{
+	unsigned int tail;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	return &ring->bufs[(tail + index) & ring->mask];
+}
+
+/**
+ * rpmsg_held_ring_release - release the oldest held buffers, consumer side
+ *
+ * Gives the RX buffers back to the remote, then frees their entries.
+ *
+ * @ring: ring of held buffers
+ * @num: number of buffers to release, at most rpmsg_held_ring_count()
+ */
+static inline void rpmsg_held_ring_release(struct rpmsg_held_ring *ring,
+					   unsigned int num)
+{
+	struct rpmsg_held_buf *buf;
+	unsigned int tail, i;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	for (i = 0; i < num; i++) {
+		buf = &ring->bufs[(tail + i) & ring->mask];
+		rpmsg_release_rx_buffer(buf->ept, buf->data);
+	}
+	atomic_store_explicit(&ring->tail, tail + num, memory_order_release);
+}
+
+#endif /* RPMSG_HELD_RING_H */
@@ -0,0 +1,404 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * This is a benchmark application to measure how the Linux generic machine
+ * scales with the number of remoteproc instances driven by one process.
+ * The echo role runs the device side of every instance and echoes back the
+ * messages, the ping role runs the driver side and keeps one message in
+ * flight per instance. All the instances are served by platform_poll().
+ * The ping role reports the aggregate message rate, both roles report the
+ * memory cost per instance.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openamp/open_amp.h>
+#include <metal/alloc.h>
+#include "bench-result.h"
+#include "platform_info.h"
+#include "rpmsg-ping.h"
+
+#define LPRINTF(format, ...) printf(format, ##__VA_ARGS__)
+#define LPERROR(format, ...) LPRINTF("ERROR: " format, ##__VA_ARGS__)
+
+#define SHUTDOWN_MSG		0xEF56A55A
+#define PAYLOAD_DEF_SIZE	16
+#define NUMS_MSGS		10000
+#define NS_PER_S		(1000 * 1000 * 1000)
+
+struct _payload {
+	unsigned long num;
+	unsigned long size;
+	unsigned char data[];
+};
+
+/* Per instance state */
+struct bench_inst {
+	void *platform;
+	struct rpmsg_device *rdev;
+	struct rpmsg_endpoint ept;
+	unsigned long rnum;
+	int done;
+};
+
+/* Globals */
+static struct bench_inst *insts;
+static unsigned int num_insts;
+static struct _payload *i_payload;
+static int payload_len;
+static unsigned long nums = NUMS_MSGS;
+static unsigned int done_cnt;
+static int err_cnt;
+
+static unsigned long long bench_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/* Resident and virtual memory of the process, in bytes */
+static int bench_get_mem(unsigned long *rss, unsigned long *vsz)
+{
+	unsigned long size, resident;
+	long page_size = sysconf(_SC_PAGESIZE);
+	FILE *f;
+	int ret;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return -1;
+	ret = fscanf(f, "%lu %lu", &size, &resident);
+	fclose(f);
+	if (ret != 2)
+		return -1;
+	*vsz = size * page_size;
+	*rss = resident * page_size;
+	return 0;
+}
+
+static struct bench_inst *bench_find_inst(struct rpmsg_device *rdev)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_insts; i++) {
+		if (insts[i].rdev == rdev)
+			return &insts[i];
+	}
+	return NULL;
+}
+
+static void bench_inst_done(struct bench_inst *inst)
+{
+	if (!inst->done) {
+		inst->done = 1;
+		done_cnt++;
+	}
+}
+
+/*-----------------------------------------------------------------------------*
+ *  RPMSG endpoint callbacks
+ *-----------------------------------------------------------------------------*/
+static int echo_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			    uint32_t src, void *priv)
+{
+	struct bench_inst *inst = priv;
+	int ret;
+
+	(void)src;
+
+	/* On reception of a shutdown the instance is done */
+	if ((*(unsigned int *)data) == SHUTDOWN_MSG) {
+		bench_inst_done(inst);
+		return RPMSG_SUCCESS;
+	}
+
+	/* Send data back to host */
+	do {
+		ret = rpmsg_send(ept, data, len);
+	} while (ret == RPMSG_ERR_NO_BUFF);
+	if (ret < 0) {
+		LPERROR("rpmsg_send, size %lu failed %d\r\n",
+			(unsigned long)len, ret);
+		err_cnt++;
+	}
+	return RPMSG_SUCCESS;
+}
+
+static int ping_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			    uint32_t src, void *priv)
+{
+	struct _payload *r_payload = (struct _payload *)data;
+	struct bench_inst *inst = priv;
+
+	(void)src;
+
+	if (len < sizeof(*r_payload) || r_payload->num != inst->rnum) {
+		LPERROR("Unexpected payload %lu, expected %lu\r\n",
+			r_payload->num, inst->rnum);
+		err_cnt++;
+	}
+	inst->rnum = r_payload->num + 1;
+	if (inst->rnum >= nums) {
+		bench_inst_done(inst);
+		return RPMSG_SUCCESS;
+	}
+
+	/* Keep one message in flight on this instance */
+	i_payload->num = inst->rnum;
+	if (rpmsg_send(ept, i_payload, payload_len) < 0) {
+		LPERROR("Failed to send data...\r\n");
+		err_cnt++;
+	}
+	return RPMSG_SUCCESS;
+}
+
+static void rpmsg_service_unbind(struct rpmsg_endpoint *ept)
+{
+	struct bench_inst *inst = ept->priv;
+
+	rpmsg_destroy_ept(ept);
+	bench_inst_done(inst);
+}
+
+static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
+				       const char *name, uint32_t dest)
+{
+	struct bench_inst *inst = bench_find_inst(rdev);
+
+	if (!inst || strcmp(name, RPMSG_SERVICE_NAME)) {
+		LPERROR("Unexpected name service %s.\r\n", name);
+		return;
+	}
+	(void)rpmsg_create_ept(&inst->ept, rdev, RPMSG_SERVICE_NAME,
+			       RPMSG_ADDR_ANY, dest, ping_endpoint_cb,
+			       rpmsg_service_unbind);
+	inst->ept.priv = inst;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Application
+ *-----------------------------------------------------------------------------*/
+static int app_echo(void *platform)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num_insts; i++) {
+		ret = rpmsg_create_ept(&insts[i].ept, insts[i].rdev,
+				       RPMSG_SERVICE_NAME, RPMSG_ADDR_ANY,
+				       RPMSG_ADDR_ANY, echo_endpoint_cb,
+				       rpmsg_service_unbind);
+		if (ret) {
+			LPERROR("Failed to create endpoint %u.\r\n", i);
+			return ret;
+		}
+		insts[i].ept.priv = &insts[i];
+	}
+	LPRINTF("Echoing on %u instances.\r\n", num_insts);
+
+	while (done_cnt < num_insts)
+		platform_poll(platform);
+
+	for (i = 0; i < num_insts; i++)
+		rpmsg_destroy_ept(&insts[i].ept);
+	return err_cnt ? -1 : 0;
+}
+
+static int app_ping(void *platform, int payload_size)
+{
+	unsigned long long tstart, tend, tdiff;
+	unsigned int shutdown_msg = SHUTDOWN_MSG;
+	unsigned long total;
+	char params[32];
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num_insts; i++) {
+		ret = rpmsg_create_ept(&insts[i].ept, insts[i].rdev,
+				       RPMSG_SERVICE_NAME, RPMSG_ADDR_ANY,
+				       RPMSG_ADDR_ANY, ping_endpoint_cb,
+				       rpmsg_service_unbind);
+		if (ret) {
+			LPERROR("Failed to create endpoint %u.\r\n", i);
+			return ret;
+		}
+		insts[i].ept.priv = &insts[i];
+	}
+	for (i = 0; i < num_insts; i++) {
+		while (!is_rpmsg_ept_ready(&insts[i].ept))
+			platform_poll(platform);
+	}
+	LPRINTF("RPMSG endpoints are binded with remote.\r\n");
+
+	payload_len = sizeof(struct _payload) + payload_size;
+	if (payload_len > rpmsg_get_tx_buffer_size(&insts[0].ept)) {
+		LPERROR("Payload size %d exceeds the buffer size.\r\n",
+			payload_size);
+		return -1;
+	}
+	i_payload = (struct _payload *)metal_allocate_memory(payload_len);
+	if (!i_payload) {
+		LPERROR("memory allocation failed.\r\n");
+		return -1;
+	}
+	i_payload->size = payload_size;
+	memset(i_payload->data, 0xA5, payload_size);
+
+	tstart = bench_gettime();
+	for (i = 0; i < num_insts; i++) {
+		i_payload->num = 0;
+		if (rpmsg_send(&insts[i].ept, i_payload, payload_len) < 0) {
+			LPERROR("Failed to send data...\r\n");
+			err_cnt++;
+			break;
+		}
+	}
+	while (done_cnt < num_insts && !err_cnt)
+		platform_poll(platform);
+	tend = bench_gettime();
+
+	total = 0;
+	for (i = 0; i < num_insts; i++) {
+		total += insts[i].rnum;
+		rpmsg_send(&insts[i].ept, &shutdown_msg, sizeof(shutdown_msg));
+	}
+
+	LPRINTF("**********************************\r\n");
+	if (!err_cnt) {
+		tdiff = tend - tstart;
+		LPRINTF(" Instances: %u, payload size: %d\r\n",
+			num_insts, payload_size);
+		LPRINTF(" Round trips: %lu, total time: %llu ns\r\n",
+			total, tdiff);
+		LPRINTF(" Aggregate msgs/s: %llu\r\n",
+			(unsigned long long)total * 2 * NS_PER_S / tdiff);
+		snprintf(params, sizeof(params), "insts=%u,size=%d",
+			 num_insts, payload_size);
+		bench_result_add(params, "msgs_s", "1/s", BENCH_HIGHER,
+				 (double)total * 2 * NS_PER_S / tdiff);
+	}
+	LPRINTF(" Test Results: Error count = %d \r\n", err_cnt);
+	LPRINTF("**********************************\r\n");
+
+	for (i = 0; i < num_insts; i++)
+		rpmsg_destroy_ept(&insts[i].ept);
+	metal_free_memory(i_payload);
+	return err_cnt ? -1 : 0;
+}
+
+static const struct option long_options[] = {
+	BENCH_RESULT_LONG_OPTIONS,
+	{ NULL, 0, NULL, 0 },
+};
+
+static void print_help(const char *prog)
+{
+	LPRINTF("usage: %s [-r echo|ping] [-n msgs] [-s payload_size] "
+		BENCH_RESULT_USAGE " [proc_id [rsc_id [num_instances]] | config]\r\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long rss0 = 0, vsz0 = 0, rss1, vsz1;
+	unsigned int role = VIRTIO_DEV_DEVICE;
+	unsigned int i, created = 0;
+	int payload_size = PAYLOAD_DEF_SIZE;
+	void *platform;
+	int opt, ret, res;
+
+	while ((opt = getopt_long(argc, argv,
+				  "r:n:s:h" BENCH_RESULT_SHORT_OPTIONS,
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			if (!strcmp(optarg, "echo")) {
+				role = VIRTIO_DEV_DEVICE;
+			} else if (!strcmp(optarg, "ping")) {
+				role = VIRTIO_DEV_DRIVER;
+			} else {
+				print_help(argv[0]);
+				return -1;
+			}
+			break;
+		case 'n':
+			nums = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			payload_size = strtol(optarg, NULL, 0);
+			break;
+		default:
+			if (!bench_result_option(opt, optarg))
+				break;
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+	if (!nums || payload_size < 0) {
+		print_help(argv[0]);
+		return -1;
+	}
+
+	bench_get_mem(&rss0, &vsz0);
+
+	ret = bench_result_start("msg-bench-instances");
+	if (ret)
+		return ret;
+
+	/* Initialize platform, with the remaining arguments */
+	ret = platform_init(argc - optind + 1, &argv[optind - 1], &platform);
+	if (ret) {
+		LPERROR("Failed to initialize platform.\r\n");
+		return -1;
+	}
+
+	num_insts = platform_get_num_instances(platform);
+	insts = metal_allocate_memory(num_insts * sizeof(*insts));
+	if (!insts) {
+		LPERROR("memory allocation failed.\r\n");
+		ret = -1;
+		goto out;
+	}
+	memset(insts, 0, num_insts * sizeof(*insts));
+
+	for (i = 0; i < num_insts; i++, created++) {
+		insts[i].platform = platform_get_instance(platform, i);
+		insts[i].rdev = platform_create_rpmsg_vdev(insts[i].platform, 0,
+							   role, NULL,
+							   rpmsg_name_service_bind_cb);
+		if (!insts[i].rdev) {
+			LPERROR("Failed to create rpmsg virtio device %u.\r\n",
+				i);
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (!bench_get_mem(&rss1, &vsz1))
+		LPRINTF(" Memory per instance: rss %lu bytes, vsz %lu bytes\r\n",
+			(rss1 - rss0) / num_insts, (vsz1 - vsz0) / num_insts);
+
+	if (role == VIRTIO_DEV_DRIVER)
+		ret = app_ping(platform, payload_size);
+	else
+		ret = app_echo(platform);
+
+out:
+	for (i = 0; i < created; i++)
+		platform_release_rpmsg_vdev(insts[i].rdev, insts[i].platform);
+	metal_free_memory(insts);
+
+	LPRINTF("Stopping application...\r\n");
+	platform_cleanup(platform);
+	res = bench_result_finish();
+	if (!ret)
+		ret = res;
+
+	return ret;
+}
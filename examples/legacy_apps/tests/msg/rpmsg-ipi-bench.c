@@ -0,0 +1,300 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * This is a benchmark application to measure the cost of the notification
+ * path. It sends small messages in ping-pong mode to the echo application
+ * (msg-test-rpmsg-update) and reports the round trip rate, so that the IPI
+ * transports of the Linux generic machine can be compared against each other.
+ * The startup time, up to the endpoint binding, and the cold first round trip
+ * are reported apart from the steady state, to compare the shared memory
+ * backends and their prefaulting. With -l, the latency from the echo kicks
+ * to the run of their callbacks is reported too, the echo application must
+ * then run with OPENAMP_KICK_LATENCY=1 to timestamp its kicks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openamp/open_amp.h>
+#include <metal/alloc.h>
+#include "bench-result.h"
+#include "platform_info.h"
+#include "rpmsg-ping.h"
+
+#define LPRINTF(format, ...) printf(format, ##__VA_ARGS__)
+#define LPERROR(format, ...) LPRINTF("ERROR: " format, ##__VA_ARGS__)
+
+struct _payload {
+	unsigned long num;
+	unsigned long size;
+	unsigned char data[];
+};
+
+#define PAYLOAD_DEF_SIZE	16
+#define NUMS_ROUND_TRIPS	100000
+#define NUMS_WARMUP		1000
+#define NS_PER_S		(1000 * 1000 * 1000)
+
+/* Globals */
+static struct rpmsg_endpoint lept;
+static struct _payload *i_payload;
+static unsigned long rnum;
+static int err_cnt;
+static int ept_deleted;
+
+static unsigned long long bench_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  RPMSG endpoint callbacks
+ *-----------------------------------------------------------------------------*/
+static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			     uint32_t src, void *priv)
+{
+	struct _payload *r_payload = (struct _payload *)data;
+
+	(void)ept;
+	(void)src;
+	(void)priv;
+
+	if (len < sizeof(*r_payload) || r_payload->num != rnum) {
+		LPERROR("Unexpected payload %lu, expected %lu\r\n",
+			r_payload->num, rnum);
+		err_cnt++;
+	}
+	rnum = r_payload->num + 1;
+	return RPMSG_SUCCESS;
+}
+
+static void rpmsg_service_unbind(struct rpmsg_endpoint *ept)
+{
+	(void)ept;
+	rpmsg_destroy_ept(&lept);
+	LPRINTF("ipi bench: service is destroyed\r\n");
+	ept_deleted = 1;
+}
+
+static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
+				       const char *name, uint32_t dest)
+{
+	LPRINTF("new endpoint notification is received.\r\n");
+	if (strcmp(name, RPMSG_SERVICE_NAME))
+		LPERROR("Unexpected name service %s.\r\n", name);
+	else
+		(void)rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+				       RPMSG_ADDR_ANY, dest,
+				       rpmsg_endpoint_cb,
+				       rpmsg_service_unbind);
+}
+
+static int round_trip(void *priv, unsigned long num, int size)
+{
+	int ret;
+
+	i_payload->num = num;
+	ret = rpmsg_send(&lept, i_payload, size);
+	if (ret < 0) {
+		LPERROR("Failed to send data...\r\n");
+		return ret;
+	}
+	do {
+		platform_poll(priv);
+	} while (rnum <= num && !err_cnt && !ept_deleted);
+
+	return (err_cnt || ept_deleted) ? -1 : 0;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Application
+ *-----------------------------------------------------------------------------*/
+int app(struct rpmsg_device *rdev, void *priv, int nums, int payload_size,
+	unsigned long long tinit)
+{
+	unsigned long long tstart, tend, tdiff, tbind, tcold, trip, tmax = 0;
+	struct platform_poll_stats st0, st1;
+	unsigned long num = 0;
+	char params[32];
+	int ret, i, size;
+
+	/* Create RPMsg endpoint */
+	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+			       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
+			       rpmsg_endpoint_cb, rpmsg_service_unbind);
+	if (ret) {
+		LPERROR("Failed to create RPMsg endpoint.\r\n");
+		return ret;
+	}
+
+	while (!is_rpmsg_ept_ready(&lept))
+		platform_poll(priv);
+	tbind = bench_gettime();
+	LPRINTF("RPMSG endpoint is binded with remote.\r\n");
+
+	size = sizeof(struct _payload) + payload_size;
+	if (size > rpmsg_get_tx_buffer_size(&lept)) {
+		LPERROR("Payload size %d exceeds the buffer size.\r\n",
+			payload_size);
+		rpmsg_destroy_ept(&lept);
+		return -1;
+	}
+	i_payload = (struct _payload *)metal_allocate_memory(size);
+	if (!i_payload) {
+		LPERROR("memory allocation failed.\r\n");
+		rpmsg_destroy_ept(&lept);
+		return -1;
+	}
+	i_payload->size = payload_size;
+	memset(i_payload->data, 0xA5, payload_size);
+
+	/* First round trip, touches the buffers and vrings for the first time */
+	tstart = bench_gettime();
+	ret = round_trip(priv, num++, size);
+	tcold = bench_gettime() - tstart;
+
+	for (i = 0; i < NUMS_WARMUP && !ret; i++)
+		ret = round_trip(priv, num++, size);
+
+	/* Kick latencies of the measured round trips only */
+	platform_reset_kick_latency(priv);
+	platform_get_poll_stats(priv, &st0);
+	tstart = bench_gettime();
+	tend = tstart;
+	for (i = 0; i < nums && !ret; i++) {
+		ret = round_trip(priv, num++, size);
+		trip = bench_gettime();
+		if (trip - tend > tmax)
+			tmax = trip - tend;
+		tend = trip;
+	}
+	platform_get_poll_stats(priv, &st1);
+
+	LPRINTF("**********************************\r\n");
+	if (!ret) {
+		tdiff = tend - tstart;
+		LPRINTF(" Round trips: %d, payload size: %d\r\n",
+			nums, payload_size);
+		LPRINTF(" Total time: %llu ns\r\n", tdiff);
+		LPRINTF(" Startup: %llu ns\r\n", tbind - tinit);
+		LPRINTF(" First round trip: %llu ns\r\n", tcold);
+		LPRINTF(" Round trip avg: %llu ns\r\n", tdiff / nums);
+		LPRINTF(" Round trip max: %llu ns\r\n", tmax);
+		LPRINTF(" Round trips/s: %llu\r\n",
+			(unsigned long long)nums * NS_PER_S / tdiff);
+		if (st1.kick_lat_count > st0.kick_lat_count)
+			LPRINTF(" Kick to callback avg: %llu ns, max: %llu ns\r\n",
+				(st1.kick_lat_sum_ns - st0.kick_lat_sum_ns) /
+				(st1.kick_lat_count - st0.kick_lat_count),
+				st1.kick_lat_max_ns);
+
+		snprintf(params, sizeof(params), "size=%d", payload_size);
+		bench_result_add(params, "startup", "ns", BENCH_LOWER,
+				 tbind - tinit);
+		bench_result_add(params, "rtt_first", "ns", BENCH_LOWER, tcold);
+		bench_result_add(params, "rtt_avg", "ns", BENCH_LOWER,
+				 (double)tdiff / nums);
+		bench_result_add(params, "rtt_max", "ns", BENCH_LOWER, tmax);
+		bench_result_add(params, "round_trips_s", "1/s", BENCH_HIGHER,
+				 (double)nums * NS_PER_S / tdiff);
+		if (st1.kick_lat_count > st0.kick_lat_count)
+			bench_result_add(params, "kick_cb_avg", "ns",
+					 BENCH_LOWER,
+					 (double)(st1.kick_lat_sum_ns -
+						  st0.kick_lat_sum_ns) /
+					 (st1.kick_lat_count -
+					  st0.kick_lat_count));
+	}
+	LPRINTF(" Test Results: Error count = %d \r\n", err_cnt);
+	LPRINTF("**********************************\r\n");
+
+	rpmsg_destroy_ept(&lept);
+	metal_free_memory(i_payload);
+	return ret;
+}
+
+static const struct option long_options[] = {
+	BENCH_RESULT_LONG_OPTIONS,
+	{ NULL, 0, NULL, 0 },
+};
+
+static void print_help(const char *prog)
+{
+	LPRINTF("usage: %s [-l] [-n round_trips] [-s payload_size] "
+		BENCH_RESULT_USAGE " [proc_id [rsc_id]]\r\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	void *platform;
+	struct rpmsg_device *rpdev;
+	int nums = NUMS_ROUND_TRIPS;
+	int payload_size = PAYLOAD_DEF_SIZE;
+	unsigned long long tinit;
+	int opt, ret, res;
+
+	while ((opt = getopt_long(argc, argv,
+				  "ln:s:h" BENCH_RESULT_SHORT_OPTIONS,
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'l':
+			/* Kick latency measurement of the platform */
+			setenv(KICK_LATENCY_ENV, "1", 1);
+			break;
+		case 'n':
+			nums = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			payload_size = strtol(optarg, NULL, 0);
+			break;
+		default:
+			if (!bench_result_option(opt, optarg))
+				break;
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+	if (nums <= 0 || payload_size < 0) {
+		print_help(argv[0]);
+		return -1;
+	}
+
+	ret = bench_result_start("msg-bench-ipi");
+	if (ret)
+		return ret;
+
+	/* Initialize platform, with the remaining arguments */
+	tinit = bench_gettime();
+	ret = platform_init(argc - optind + 1, &argv[optind - 1], &platform);
+	if (ret) {
+		LPERROR("Failed to initialize platform.\r\n");
+		ret = -1;
+	} else {
+		rpdev = platform_create_rpmsg_vdev(platform, 0,
+						  VIRTIO_DEV_DRIVER,
+						  NULL,
+						  rpmsg_name_service_bind_cb);
+		if (!rpdev) {
+			LPERROR("Failed to create rpmsg virtio device.\r\n");
+			ret = -1;
+		} else {
+			ret = app(rpdev, platform, nums, payload_size, tinit);
+			platform_release_rpmsg_vdev(rpdev, platform);
+		}
+	}
+
+	LPRINTF("Stopping application...\r\n");
+	platform_cleanup(platform);
+	res = bench_result_finish();
+	if (!ret)
+		ret = res;
+
+	return ret;
+}
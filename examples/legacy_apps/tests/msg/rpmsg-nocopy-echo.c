@@ -14,6 +14,7 @@
 #include <openamp/open_amp.h>
 #include <metal/alloc.h>
 #include "platform_info.h"
+#include "rpmsg-held-ring.h"
 
 #define SHUTDOWN_MSG		0xEF56A55A
 #define RPMSG_SERVICE_NAME	"rpmsg-openamp-demo-channel"
@@ -26,14 +27,8 @@
 static struct rpmsg_endpoint lept;
 static int shutdown_req;
 
-struct rpmsg_rcv_msg {
-	void *data;
-	size_t len;
-	struct rpmsg_endpoint *ept;
-	struct rpmsg_rcv_msg *next;
-};
-
-struct rpmsg_rcv_msg *rpmsg_list;
+/* Received buffers, held until they are echoed back */
+static struct rpmsg_held_ring held_ring;
 
 /*-----------------------------------------------------------------------------
  *  RPMSG endpoint callbacks
@@ -44,7 +39,6 @@ static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
 {
 	(void)src;
 	(void)priv;
-	struct rpmsg_rcv_msg *rpmsg_node, *p_msg;
 
 	/* On reception of a shutdown we signal the application to terminate */
 	if ((*(unsigned int *)data) == SHUTDOWN_MSG) {
@@ -53,25 +47,10 @@ static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
 		return RPMSG_SUCCESS;
 	}
 
-	rpmsg_node = metal_allocate_memory(sizeof(*rpmsg_node));
-	if (!rpmsg_node) {
-		LPERROR("rpmsg_node allocation failed\r\n");
+	if (rpmsg_held_ring_push(&held_ring, ept, data, len)) {
+		LPERROR("held buffer ring is full\r\n");
 		return -1;
 	}
-	rpmsg_hold_rx_buffer(ept, data);
-	rpmsg_node->ept = ept;
-	rpmsg_node->data = data;
-	rpmsg_node->len = len;
-	rpmsg_node->next = NULL;
-
-	if (!rpmsg_list)
-		rpmsg_list = rpmsg_node;
-	else {
-		p_msg = rpmsg_list;
-		while (p_msg->next)
-			p_msg = p_msg->next;
-		p_msg->next = rpmsg_node;
-	}
 
 	return RPMSG_SUCCESS;
 }
@@ -87,24 +66,50 @@ static void rpmsg_service_unbind(struct rpmsg_endpoint *ept)
  *  Application
  *-----------------------------------------------------------------------------
  */
+/* Get and discard an unused TX buffer, it must not be the lost one */
+static int check_tx_reclaimer(struct rpmsg_endpoint *ept, void *lost_buff)
+{
+	uint32_t max_size;
+	void *tx_msg;
+
+	tx_msg = rpmsg_get_tx_payload_buffer(ept, &max_size, 1);
+	if (!tx_msg) {
+		LPERROR("Failed to get payload...\r\n");
+		return -1;
+	}
+	if (tx_msg == lost_buff) {
+		LPERROR("error: got the lost buffer\r\n");
+		return -1;
+	}
+	if (rpmsg_release_tx_buffer(ept, tx_msg) < 0) {
+		LPERROR("failed to release TX buffer...\r\n");
+		return -1;
+	}
+	return 0;
+}
+
 int app(struct rpmsg_device *rdev, void *priv)
 {
 	int ret, i;
+	unsigned int j, num;
 	uint32_t max_size;
-	struct rpmsg_rcv_msg *rpmsg_node;
+	struct rpmsg_held_buf *held;
 	void *buff_list[MAX_NB_TX_BUFF];
-	void *tx_msg;
 
 	/* Initialize RPMSG framework */
 	LPRINTF("Try to create rpmsg endpoint.\r\n");
 
-	rpmsg_list = NULL;
+	if (rpmsg_held_ring_init(&held_ring, rdev)) {
+		LPERROR("Failed to allocate the held buffer ring.\r\n");
+		return -1;
+	}
 	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
 			       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
 			       rpmsg_endpoint_cb,
 			       rpmsg_service_unbind);
 	if (ret) {
 		LPERROR("Failed to create endpoint.\r\n");
+		rpmsg_held_ring_deinit(&held_ring);
 		return -1;
 	}
 
@@ -139,43 +144,36 @@ int app(struct rpmsg_device *rdev, void *priv)
 		if (shutdown_req) {
 			break;
 		}
-		while (rpmsg_list) {
+		/* Send the whole batch back, then release its RX buffers */
+		num = rpmsg_held_ring_count(&held_ring);
+		for (j = 0; j < num; j++) {
+			held = rpmsg_held_ring_at(&held_ring, j);
 			/* Send data back to host */
-			ret = rpmsg_send(rpmsg_list->ept, rpmsg_list->data,
-					 rpmsg_list->len);
+			ret = rpmsg_send(held->ept, held->data, held->len);
 			if (ret < 0) {
 				LPERROR("rpmsg_send failed\r\n");
-				return ret;
+				break;
 			}
-			rpmsg_release_rx_buffer(rpmsg_list->ept,
-						rpmsg_list->data);
 			/* Get and discard an unused TX buffer every 13 sent */
-			if (!(i++ % 13)) {
-				tx_msg = rpmsg_get_tx_payload_buffer(rpmsg_list->ept,
-								     &max_size, 1);
-				if (!tx_msg) {
-					LPERROR("Failed to get payload...\r\n");
-					break;
-				}
-				if (tx_msg == buff_list[MAX_NB_TX_BUFF - 1]) {
-					LPERROR("error: got the lost buffer\r\n");
-					break;
-				}
-				ret = rpmsg_release_tx_buffer(rpmsg_list->ept, tx_msg);
-				if (ret < 0) {
-					LPERROR("failed to release TX buffer...\r\n");
-					break;
-				}
+			if (!(i++ % 13) &&
+			    check_tx_reclaimer(held->ept,
+					       buff_list[MAX_NB_TX_BUFF - 1])) {
+				/* Keep the rest of the batch for the next round */
+				j++;
+				break;
 			}
-			rpmsg_node = rpmsg_list;
-			rpmsg_list = rpmsg_list->next;
-			metal_free_memory(rpmsg_node);
-			/* Get and discard an unused TX buffer every 11 sent */
 		}
+		/* Only the buffers sent back, up to the failing one */
+		rpmsg_held_ring_release(&held_ring, j);
+		if (ret < 0)
+			break;
 	}
+	rpmsg_held_ring_release(&held_ring,
+				rpmsg_held_ring_count(&held_ring));
 	rpmsg_destroy_ept(&lept);
+	rpmsg_held_ring_deinit(&held_ring);
 
-	return 0;
+	return ret < 0 ? ret : 0;
 }
 
 /*-----------------------------------------------------------------------------
@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <openamp/open_amp.h>
 #include <metal/alloc.h>
+#include "payload-verify.h"
 #include "platform_info.h"
 #include "rpmsg-ping.h"
 
@@ -43,6 +44,7 @@ static struct rpmsg_rcv_msg rcv_msg;
 static int rnum;
 static int err_cnt;
 static int ept_deleted;
+static struct payload_seq rx_seq;
 
 /* External functions */
 extern int init_system(void);
@@ -50,8 +52,9 @@ extern void cleanup_system(void);
 
 static int rpmsg_check_rcv_msg(struct rpmsg_rcv_msg *msg, uint32_t exp_num)
 {
-	int i, ret = RPMSG_SUCCESS;
+	int ret = RPMSG_SUCCESS;
 	struct _payload *r_payload = msg->payload;
+	uint32_t seq;
 
 	if (r_payload->num != exp_num) {
 		LPERROR("Invalid message number received %ld, expected %d\r\n",
@@ -66,13 +69,13 @@ static int rpmsg_check_rcv_msg(struct rpmsg_rcv_msg *msg, uint32_t exp_num)
 		goto out;
 	}
 
-	/* Validate data buffer integrity. */
-	for (i = 0; i < (int)r_payload->size; i++) {
-		if (r_payload->data[i] != 0xA5) {
-			LPRINTF("Data corruption at index %d\r\n", i);
-			ret = RPMSG_ERR_PARAM;
-			goto out;
-		}
+	/* Validate data buffer integrity and order. */
+	seq = exp_num;
+	if (payload_verify(r_payload->data, r_payload->size,
+			   PAYLOAD_SEED_DEF, &seq) ||
+	    payload_seq_check(&rx_seq, seq)) {
+		LPRINTF("Data corruption in payload %u\r\n", exp_num);
+		ret = RPMSG_ERR_PARAM;
 	}
 out:
 	rpmsg_release_rx_buffer(msg->ept, r_payload);
@@ -132,6 +135,8 @@ int app(struct rpmsg_device *rdev, void *priv)
 	int expect_rnum = 0;
 	void *buff_list[MAX_NB_TX_BUFF];
 
+	payload_verify_init();
+
 	/* Create RPMsg endpoint */
 	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
 			       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
@@ -197,8 +202,8 @@ int app(struct rpmsg_device *rdev, void *priv)
 		i_payload->num = i;
 		i_payload->size = size;
 
-		/* Mark the data buffer. */
-		memset(&i_payload->data[0], 0xA5, size);
+		/* Fill the data buffer with the pattern of the payload. */
+		payload_fill(i_payload->data, size, i, PAYLOAD_SEED_DEF);
 
 		LPRINTF("sending payload number %lu of size %lu\r\n",
 			i_payload->num, sizeof(*i_payload) + size);
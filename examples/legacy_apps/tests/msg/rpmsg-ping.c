@@ -14,6 +14,9 @@
 #include <unistd.h>
 #include <openamp/open_amp.h>
 #include <metal/alloc.h>
+#include <metal/time.h>
+#include "payload-verify.h"
+#include "ping_latency.h"
 #include "platform_info.h"
 #include "rpmsg-ping.h"
 
@@ -23,6 +26,7 @@
 struct _payload {
 	unsigned long num;
 	unsigned long size;
+	unsigned long long ts;
 	unsigned char data[];
 };
 
@@ -36,6 +40,9 @@ static struct _payload *i_payload;
 static int rnum = 0;
 static int err_cnt = 0;
 static int ept_deleted = 0;
+static struct payload_seq rx_seq;
+
+static struct ping_latency latency;
 
 /* External functions */
 extern int init_system();
@@ -47,12 +54,20 @@ extern void cleanup_system();
 static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
 			     uint32_t src, void *priv)
 {
-	int i;
 	struct _payload *r_payload = (struct _payload *)data;
+	uint32_t seq;
+	int ret;
+	unsigned long long now = metal_get_timestamp();
 
 	(void)ept;
 	(void)src;
 	(void)priv;
+	if (latency.enabled) {
+		ping_latency_record(&latency, r_payload->num, r_payload->ts,
+				    now);
+		rnum = r_payload->num + 1;
+		return RPMSG_SUCCESS;
+	}
 	LPRINTF(" received payload number %lu of size %lu \r\n",
 		r_payload->num, (unsigned long)len);
 
@@ -61,13 +76,16 @@ static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
 		err_cnt++;
 		return RPMSG_SUCCESS;
 	}
-	/* Validate data buffer integrity. */
-	for (i = 0; i < (int)r_payload->size; i++) {
-		if (r_payload->data[i] != 0xA5) {
-			LPRINTF("Data corruption at index %d\r\n", i);
-			err_cnt++;
-			break;
-		}
+	/* Validate data buffer integrity and order. */
+	seq = r_payload->num;
+	ret = payload_verify(r_payload->data, r_payload->size,
+			     PAYLOAD_SEED_DEF, &seq);
+	if (!ret)
+		ret = payload_seq_check(&rx_seq, seq);
+	if (ret) {
+		LPERROR("Payload %lu verification failed %d\r\n",
+			r_payload->num, ret);
+		err_cnt++;
 	}
 	rnum = r_payload->num + 1;
 	return RPMSG_SUCCESS;
@@ -98,6 +116,40 @@ static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
 /*-----------------------------------------------------------------------------*
  *  Application
  *-----------------------------------------------------------------------------*/
+/* Round trip of one latency message, the payload is set by app_latency() */
+static int latency_round_trip(void *priv, unsigned long num,
+			      unsigned long long ts)
+{
+	int ret;
+
+	i_payload->num = num;
+	i_payload->ts = ts;
+	ret = rpmsg_send(&lept, i_payload,
+			 sizeof(struct _payload) + i_payload->size);
+	if (ret < 0) {
+		LPERROR("Failed to send data...\r\n");
+		return ret;
+	}
+	do {
+		platform_poll(priv);
+	} while ((rnum <= (int)num) && !err_cnt && !ept_deleted);
+	return err_cnt || ept_deleted ? -1 : 0;
+}
+
+static int app_latency(void *priv)
+{
+	int size = latency.size;
+
+	if (size < 0 || size + sizeof(struct _payload) >
+	    (unsigned int)rpmsg_get_tx_buffer_size(&lept)) {
+		LPERROR("Invalid payload size %d.\r\n", size);
+		return -1;
+	}
+	i_payload->size = size;
+	memset(&(i_payload->data[0]), 0xA5, size);
+	return ping_latency_run(&latency, latency_round_trip, priv);
+}
+
 int app (struct rpmsg_device *rdev, void *priv)
 {
 	int ret;
@@ -107,6 +159,8 @@ int app (struct rpmsg_device *rdev, void *priv)
 
 	LPRINTF(" 1 - Send data to remote core, retrieve the echo");
 	LPRINTF(" and validate its integrity ..\r\n");
+	payload_verify_init();
+	LPRINTF("payload CRC32C: %s\r\n", payload_verify_name());
 
 	/* Create RPMsg endpoint */
 	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
@@ -126,7 +180,7 @@ int app (struct rpmsg_device *rdev, void *priv)
 	max_size -= sizeof(struct _payload);
 	num_payloads = max_size - PAYLOAD_MIN_SIZE + 1;
 	i_payload =
-	    (struct _payload *)metal_allocate_memory(2 * sizeof(unsigned long) +
+	    (struct _payload *)metal_allocate_memory(sizeof(struct _payload) +
 				      max_size);
 
 	if (!i_payload) {
@@ -142,26 +196,28 @@ int app (struct rpmsg_device *rdev, void *priv)
 		platform_poll(priv);
 
 	LPRINTF("RPMSG endpoint is binded with remote.\r\n");
+	if (latency.enabled)
+		num_payloads = 0;
 	for (i = 0, size = PAYLOAD_MIN_SIZE; i < num_payloads; i++, size++) {
 		i_payload->num = i;
 		i_payload->size = size;
 
-		/* Mark the data buffer. */
-		memset(&(i_payload->data[0]), 0xA5, size);
+		/* Fill the data buffer with the pattern of the payload. */
+		payload_fill(i_payload->data, size, i, PAYLOAD_SEED_DEF);
 
 		LPRINTF("sending payload number %lu of size %lu\r\n",
 			i_payload->num,
-			(unsigned long)(2 * sizeof(unsigned long)) + size);
+			(unsigned long)sizeof(struct _payload) + size);
 
 		ret = rpmsg_send(&lept, i_payload,
-				 (2 * sizeof(unsigned long)) + size);
+				 sizeof(struct _payload) + size);
 
 		if (ret < 0) {
 			LPERROR("Failed to send data...\r\n");
 			break;
 		}
 		LPRINTF("echo test: sent : %lu\r\n",
-			(unsigned long)(2 * sizeof(unsigned long)) + size);
+			(unsigned long)sizeof(struct _payload) + size);
 
 		expect_rnum++;
 		do {
@@ -169,6 +225,8 @@ int app (struct rpmsg_device *rdev, void *priv)
 		} while ((rnum < expect_rnum) && !err_cnt && !ept_deleted);
 
 	}
+	if (latency.enabled)
+		ret = app_latency(priv);
 
 	LPRINTF("**********************************\r\n");
 	LPRINTF(" Test Results: Error count = %d \r\n", err_cnt);
@@ -178,17 +236,25 @@ int app (struct rpmsg_device *rdev, void *priv)
 	LPRINTF("Quitting application .. Echo test end\r\n");
 
 	metal_free_memory(i_payload);
-	return 0;
+	return ret < 0 ? ret : 0;
 }
 
 int main(int argc, char *argv[])
 {
 	void *platform;
 	struct rpmsg_device *rpdev;
-	int ret;
+	int opt, ret;
+
+	ping_latency_init(&latency);
+	while ((opt = getopt(argc, argv, PING_LATENCY_OPTS "h")) != -1) {
+		if (!ping_latency_option(&latency, opt, optarg)) {
+			ping_latency_help(argv[0]);
+			return -1;
+		}
+	}
 
-	/* Initialize platform */
-	ret = platform_init(argc, argv, &platform);
+	/* Initialize platform, with the remaining arguments */
+	ret = platform_init(argc - optind + 1, &argv[optind - 1], &platform);
 	if (ret) {
 		LPERROR("Failed to initialize platform.\r\n");
 		ret = -1;
@@ -201,9 +267,8 @@ int main(int argc, char *argv[])
 			LPERROR("Failed to create rpmsg virtio device.\r\n");
 			ret = -1;
 		} else {
-			app(rpdev, platform);
+			ret = app(rpdev, platform);
 			platform_release_rpmsg_vdev(rpdev, platform);
-			ret = 0;
 		}
 	}
 
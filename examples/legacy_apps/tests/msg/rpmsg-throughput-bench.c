@@ -0,0 +1,484 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * This is a benchmark application to measure the rpmsg throughput. For
+ * each payload size, it floods the echo application (msg-test-rpmsg-update)
+ * with messages, polling whenever no TX buffer is left, until the message
+ * count or the duration is reached and all the echoes are back. It reports
+ * msgs/s, MB/s of payload and the number of RPMSG_ERR_NO_BUFF retries per
+ * size, as text, CSV or JSON, so that the results can be compared between
+ * runs. With -p, the hardware performance counters of the send and poll
+ * phases are also printed per message. With -b, the occupancy of the TX
+ * vring is also printed per size, to tell whether the flood was limited by
+ * the buffers or by the echo.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openamp/open_amp.h>
+#include <metal/alloc.h>
+#include "bench-result.h"
+#include "perf-counters.h"
+#include "platform_info.h"
+#include "rpmsg-ping.h"
+
+#define LPRINTF(format, ...) printf(format, ##__VA_ARGS__)
+#define LPERROR(format, ...) LPRINTF("ERROR: " format, ##__VA_ARGS__)
+
+struct _payload {
+	unsigned long num;
+	unsigned long size;
+	unsigned char data[];
+};
+
+#define NUMS_MSGS		100000
+#define MAX_SIZES		32
+/* Payload size standing for the largest payload of the TX buffers */
+#define SIZE_MAX_PAYLOAD	-1
+#define DEF_SIZES		"16,64,256,max"
+#define TIME_CHECK_MSGS		64
+#define NS_PER_S		(1000 * 1000 * 1000)
+#define NS_PER_MS		(1000 * 1000)
+
+enum out_format {
+	OUT_TEXT,
+	OUT_CSV,
+	OUT_JSON,
+};
+
+struct bench_result {
+	int size;
+	unsigned long msgs;
+	unsigned long long elapsed_ns;
+	unsigned long no_buff;
+	int errors;
+};
+
+/* Globals */
+static struct rpmsg_endpoint lept;
+static struct _payload *i_payload;
+static unsigned long rnum;
+static int err_cnt;
+static int ept_deleted;
+static struct perf_counters perf;
+static struct perf_phase ph_send, ph_poll;
+static int use_buf_stats;
+
+static unsigned long long bench_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  RPMSG endpoint callbacks
+ *-----------------------------------------------------------------------------*/
+static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			     uint32_t src, void *priv)
+{
+	struct _payload *r_payload = (struct _payload *)data;
+
+	(void)ept;
+	(void)src;
+	(void)priv;
+
+	if (len < sizeof(*r_payload) || r_payload->num != rnum ||
+	    r_payload->size != i_payload->size) {
+		LPERROR("Unexpected payload %lu, expected %lu\r\n",
+			r_payload->num, rnum);
+		err_cnt++;
+	}
+	rnum = r_payload->num + 1;
+	return RPMSG_SUCCESS;
+}
+
+static void rpmsg_service_unbind(struct rpmsg_endpoint *ept)
+{
+	(void)ept;
+	rpmsg_destroy_ept(&lept);
+	LPRINTF("throughput bench: service is destroyed\r\n");
+	ept_deleted = 1;
+}
+
+static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
+				       const char *name, uint32_t dest)
+{
+	LPRINTF("new endpoint notification is received.\r\n");
+	if (strcmp(name, RPMSG_SERVICE_NAME))
+		LPERROR("Unexpected name service %s.\r\n", name);
+	else
+		(void)rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+				       RPMSG_ADDR_ANY, dest,
+				       rpmsg_endpoint_cb,
+				       rpmsg_service_unbind);
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Results
+ *-----------------------------------------------------------------------------*/
+static void print_result(FILE *out, enum out_format format,
+			 const struct bench_result *r, int first)
+{
+	unsigned long long msgs_s = 0, kb_s = 0;
+
+	if (r->elapsed_ns) {
+		msgs_s = (unsigned long long)r->msgs * NS_PER_S / r->elapsed_ns;
+		kb_s = (unsigned long long)r->msgs * r->size *
+		       (NS_PER_S / 1000) / r->elapsed_ns;
+	}
+	switch (format) {
+	case OUT_CSV:
+		fprintf(out, "%d,%lu,%llu,%llu,%llu.%03llu,%lu,%d\n",
+			r->size, r->msgs, r->elapsed_ns, msgs_s,
+			kb_s / 1000, kb_s % 1000, r->no_buff, r->errors);
+		break;
+	case OUT_JSON:
+		fprintf(out, "%s\n  {\"size\": %d, \"msgs\": %lu, "
+			"\"elapsed_ns\": %llu, \"msgs_per_s\": %llu, "
+			"\"mb_per_s\": %llu.%03llu, \"no_buff\": %lu, "
+			"\"errors\": %d}", first ? "" : ",",
+			r->size, r->msgs, r->elapsed_ns, msgs_s,
+			kb_s / 1000, kb_s % 1000, r->no_buff, r->errors);
+		break;
+	default:
+		fprintf(out, "%8d %10lu %12llu %10llu %6llu.%03llu %10lu %6d\n",
+			r->size, r->msgs, r->elapsed_ns / NS_PER_MS, msgs_s,
+			kb_s / 1000, kb_s % 1000, r->no_buff, r->errors);
+		break;
+	}
+}
+
+static void print_header(FILE *out, enum out_format format)
+{
+	switch (format) {
+	case OUT_CSV:
+		fprintf(out, "size,msgs,elapsed_ns,msgs_per_s,mb_per_s,"
+			"no_buff,errors\n");
+		break;
+	case OUT_JSON:
+		fprintf(out, "[");
+		break;
+	default:
+		fprintf(out, "%8s %10s %12s %10s %10s %10s %6s\n",
+			"size", "msgs", "elapsed_ms", "msgs/s", "MB/s",
+			"no_buff", "errors");
+		break;
+	}
+}
+
+static void print_footer(FILE *out, enum out_format format)
+{
+	if (format == OUT_JSON)
+		fprintf(out, "\n]\n");
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Application
+ *-----------------------------------------------------------------------------*/
+static void print_buf_stats(void *priv)
+{
+	struct platform_buf_stats bs;
+	unsigned int i;
+
+	if (platform_get_buf_stats(priv, 0, &bs))
+		return;
+	LPRINTF("  tx buffers: peak %u/%u, histogram by eighth:", bs.tx.peak,
+		bs.tx.num);
+	for (i = 0; i < PLATFORM_BUF_HIST; i++)
+		LPRINTF(" %lu", bs.tx.hist[i]);
+	if (bs.pool_size)
+		LPRINTF(", pool %zu/%zu bytes used", bs.pool_used,
+			bs.pool_size);
+	LPRINTF("\r\n");
+}
+
+/* Flood the echo with size bytes messages, wait for all the echoes */
+static int flood(void *priv, int size, unsigned long nums,
+		 unsigned long long duration_ns, struct bench_result *r)
+{
+	unsigned long long tstart, deadline;
+	unsigned long num = 0;
+	int ret = 0;
+
+	i_payload->size = size - sizeof(struct _payload);
+	rnum = 0;
+	perf_phase_init(&ph_send, "send");
+	perf_phase_init(&ph_poll, "poll");
+	tstart = bench_gettime();
+	deadline = duration_ns ? tstart + duration_ns : ULLONG_MAX;
+	while (num < nums && !err_cnt && !ept_deleted) {
+		if (!(num % TIME_CHECK_MSGS) && bench_gettime() >= deadline)
+			break;
+		i_payload->num = num;
+		perf_phase_begin(&perf, &ph_send);
+		ret = rpmsg_trysend(&lept, i_payload, size);
+		perf_phase_end(&perf, &ph_send);
+		if (ret == RPMSG_ERR_NO_BUFF) {
+			r->no_buff++;
+			perf_phase_begin(&perf, &ph_poll);
+			platform_poll(priv);
+			perf_phase_end(&perf, &ph_poll);
+			continue;
+		}
+		if (ret < 0) {
+			LPERROR("Failed to send data...\r\n");
+			break;
+		}
+		num++;
+	}
+	while (rnum < num && !err_cnt && !ept_deleted) {
+		perf_phase_begin(&perf, &ph_poll);
+		platform_poll(priv);
+		perf_phase_end(&perf, &ph_poll);
+	}
+	r->elapsed_ns = bench_gettime() - tstart;
+	r->msgs = rnum;
+	r->errors = err_cnt;
+	return (ret < 0 || err_cnt || ept_deleted) ? -1 : 0;
+}
+
+static int app(struct rpmsg_device *rdev, void *priv, int *sizes,
+	       unsigned int num_sizes, unsigned long nums,
+	       unsigned long long duration_ns, enum out_format format,
+	       FILE *out)
+{
+	struct bench_result r;
+	char params[32];
+	int max_size, size;
+	unsigned int i;
+	int ret;
+
+	/* Create RPMsg endpoint */
+	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+			       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
+			       rpmsg_endpoint_cb, rpmsg_service_unbind);
+	if (ret) {
+		LPERROR("Failed to create RPMsg endpoint.\r\n");
+		return ret;
+	}
+
+	while (!is_rpmsg_ept_ready(&lept))
+		platform_poll(priv);
+	LPRINTF("RPMSG endpoint is binded with remote.\r\n");
+
+	max_size = rpmsg_get_tx_buffer_size(&lept);
+	if (max_size < (int)sizeof(struct _payload)) {
+		LPERROR("No available buffer size.\r\n");
+		rpmsg_destroy_ept(&lept);
+		return -1;
+	}
+	i_payload = (struct _payload *)metal_allocate_memory(max_size);
+	if (!i_payload) {
+		LPERROR("memory allocation failed.\r\n");
+		rpmsg_destroy_ept(&lept);
+		return -1;
+	}
+	memset(i_payload->data, 0xA5, max_size - sizeof(struct _payload));
+
+	print_header(out, format);
+	for (i = 0; i < num_sizes; i++) {
+		if (sizes[i] == SIZE_MAX_PAYLOAD)
+			size = max_size;
+		else
+			size = sizes[i] + sizeof(struct _payload);
+		if (size > max_size) {
+			LPERROR("Payload size %d exceeds the buffer size.\r\n",
+				sizes[i]);
+			ret = -1;
+			break;
+		}
+		memset(&r, 0, sizeof(r));
+		r.size = size - sizeof(struct _payload);
+		if (use_buf_stats)
+			platform_reset_buf_stats(priv, 0);
+		ret = flood(priv, size, nums, duration_ns, &r);
+		print_result(out, format, &r, !i);
+		fflush(out);
+		if (!ret && r.elapsed_ns) {
+			snprintf(params, sizeof(params), "size=%d", r.size);
+			bench_result_add(params, "msgs_s", "1/s", BENCH_HIGHER,
+					 (double)r.msgs * NS_PER_S /
+					 r.elapsed_ns);
+			bench_result_add(params, "mb_s", "MB/s", BENCH_HIGHER,
+					 (double)r.msgs * r.size * 1000 /
+					 r.elapsed_ns);
+		}
+		perf_phase_print(&perf, &ph_send, r.msgs, "  ");
+		perf_phase_print(&perf, &ph_poll, r.msgs, "  ");
+		if (use_buf_stats)
+			print_buf_stats(priv);
+		if (ret)
+			break;
+	}
+	print_footer(out, format);
+
+	if (!ept_deleted)
+		rpmsg_destroy_ept(&lept);
+	metal_free_memory(i_payload);
+	return ret;
+}
+
+/* Parse a list of payload sizes, as "16,64,256,max" */
+static int parse_sizes(const char *list, int *sizes, unsigned int *num)
+{
+	char *end;
+
+	*num = 0;
+	while (*list) {
+		if (*num >= MAX_SIZES)
+			return -EINVAL;
+		if (!strncmp(list, "max", 3)) {
+			sizes[*num] = SIZE_MAX_PAYLOAD;
+			end = (char *)list + 3;
+		} else {
+			sizes[*num] = strtol(list, &end, 0);
+			if (end == list || sizes[*num] < 0)
+				return -EINVAL;
+		}
+		(*num)++;
+		list = end;
+		if (*list == ',')
+			list++;
+		else if (*list)
+			return -EINVAL;
+	}
+	return *num ? 0 : -EINVAL;
+}
+
+static const struct option long_options[] = {
+	BENCH_RESULT_LONG_OPTIONS,
+	{ NULL, 0, NULL, 0 },
+};
+
+static void print_help(const char *prog)
+{
+	LPRINTF("usage: %s [-s size[,size...|max]] [-n msgs] [-d duration_ms] "
+		"[-f text|csv|json] [-o file] [-p] [-b] " BENCH_RESULT_USAGE
+		" [proc_id [rsc_id]]\r\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	void *platform;
+	struct rpmsg_device *rpdev;
+	int sizes[MAX_SIZES];
+	unsigned int num_sizes;
+	unsigned long nums = 0;
+	unsigned long long duration_ns = 0;
+	enum out_format format = OUT_TEXT;
+	const char *out_path = NULL;
+	FILE *out = stdout;
+	int use_perf = 0;
+	int opt, ret, res;
+
+	parse_sizes(DEF_SIZES, sizes, &num_sizes);
+	while ((opt = getopt_long(argc, argv,
+				  "s:n:d:f:o:pbh" BENCH_RESULT_SHORT_OPTIONS,
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			if (parse_sizes(optarg, sizes, &num_sizes)) {
+				print_help(argv[0]);
+				return -1;
+			}
+			break;
+		case 'n':
+			nums = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration_ns = strtoull(optarg, NULL, 0) * NS_PER_MS;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "text")) {
+				format = OUT_TEXT;
+			} else if (!strcmp(optarg, "csv")) {
+				format = OUT_CSV;
+			} else if (!strcmp(optarg, "json")) {
+				format = OUT_JSON;
+			} else {
+				print_help(argv[0]);
+				return -1;
+			}
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'p':
+			use_perf = 1;
+			break;
+		case 'b':
+			use_buf_stats = 1;
+			break;
+		default:
+			if (!bench_result_option(opt, optarg))
+				break;
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+	/* With a duration only, run for the duration */
+	if (!nums)
+		nums = duration_ns ? ULONG_MAX : NUMS_MSGS;
+
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			LPERROR("Failed to open %s.\r\n", out_path);
+			return -1;
+		}
+	}
+
+	if (use_perf) {
+		ret = perf_counters_open(&perf);
+		if (ret)
+			LPRINTF("perf counters unavailable: %s\r\n",
+				strerror(-ret));
+		else
+			perf_counters_describe(&perf);
+	}
+
+	ret = bench_result_start("msg-bench-throughput");
+	if (ret)
+		return ret;
+
+	/* Initialize platform, with the remaining arguments */
+	ret = platform_init(argc - optind + 1, &argv[optind - 1], &platform);
+	if (ret) {
+		LPERROR("Failed to initialize platform.\r\n");
+		ret = -1;
+	} else {
+		rpdev = platform_create_rpmsg_vdev(platform, 0,
+						  VIRTIO_DEV_DRIVER,
+						  NULL,
+						  rpmsg_name_service_bind_cb);
+		if (!rpdev) {
+			LPERROR("Failed to create rpmsg virtio device.\r\n");
+			ret = -1;
+		} else {
+			ret = app(rpdev, platform, sizes, num_sizes, nums,
+				  duration_ns, format, out);
+			platform_release_rpmsg_vdev(rpdev, platform);
+		}
+	}
+
+	LPRINTF("Stopping application...\r\n");
+	platform_cleanup(platform);
+	res = bench_result_finish();
+	if (!ret)
+		ret = res;
+	if (out != stdout)
+		fclose(out);
+	if (perf.nr)
+		perf_counters_close(&perf);
+
+	return ret;
+}
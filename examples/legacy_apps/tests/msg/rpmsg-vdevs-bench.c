@@ -0,0 +1,436 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * This is a benchmark application to measure how the throughput of the
+ * Linux generic machine scales with the number of rpmsg vdevs of the
+ * resource table. Each vdev has its own vrings, buffer pool and IPI
+ * channel, and is served by its own thread with platform_poll_vdev(). The
+ * echo role echoes back the messages on every vdev, the ping role keeps a
+ * window of messages in flight per vdev and reports the rate of each vdev
+ * and the aggregate rate.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_setaffinity_np() */
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openamp/open_amp.h>
+#include <metal/alloc.h>
+#include "bench-result.h"
+#include "platform_info.h"
+#include "rpmsg-ping.h"
+
+#define LPRINTF(format, ...) printf(format, ##__VA_ARGS__)
+#define LPERROR(format, ...) LPRINTF("ERROR: " format, ##__VA_ARGS__)
+
+#define SHUTDOWN_MSG		0xEF56A55A
+#define PAYLOAD_DEF_SIZE	16
+#define NUMS_MSGS		100000
+#define WINDOW_DEF		8
+#define NS_PER_S		(1000 * 1000 * 1000)
+
+struct _payload {
+	unsigned long num;
+	unsigned long size;
+	unsigned char data[];
+};
+
+/* Per vdev state, only accessed by the thread of the vdev */
+struct bench_vdev {
+	unsigned int index;
+	pthread_t thread;
+	struct rpmsg_device *rdev;
+	struct rpmsg_endpoint ept;
+	struct _payload *payload;
+	unsigned long sent;
+	unsigned long rnum;
+	unsigned long long tstart;
+	unsigned long long tend;
+	int done;
+	int ept_deleted;
+	int err_cnt;
+};
+
+/* Globals */
+static void *platform;
+static struct bench_vdev *vdevs;
+static unsigned int num_vdevs;
+static unsigned int role = VIRTIO_DEV_DEVICE;
+static int payload_len;
+static unsigned long nums = NUMS_MSGS;
+static unsigned int window = WINDOW_DEF;
+static int first_cpu = -1;
+
+static unsigned long long bench_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+static struct bench_vdev *bench_find_vdev(struct rpmsg_device *rdev)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_vdevs; i++) {
+		if (vdevs[i].rdev == rdev)
+			return &vdevs[i];
+	}
+	return NULL;
+}
+
+static int bench_send_next(struct bench_vdev *bv)
+{
+	bv->payload->num = bv->sent;
+	if (rpmsg_send(&bv->ept, bv->payload, payload_len) < 0) {
+		LPERROR("Failed to send data on vdev %u...\r\n", bv->index);
+		bv->err_cnt++;
+		return -1;
+	}
+	bv->sent++;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  RPMSG endpoint callbacks
+ *-----------------------------------------------------------------------------*/
+static int echo_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			    uint32_t src, void *priv)
+{
+	struct bench_vdev *bv = priv;
+	int ret;
+
+	(void)src;
+
+	/* On reception of a shutdown the vdev is done */
+	if ((*(unsigned int *)data) == SHUTDOWN_MSG) {
+		bv->done = 1;
+		return RPMSG_SUCCESS;
+	}
+
+	/* Send data back to host */
+	do {
+		ret = rpmsg_send(ept, data, len);
+	} while (ret == RPMSG_ERR_NO_BUFF);
+	if (ret < 0) {
+		LPERROR("rpmsg_send, size %lu failed %d\r\n",
+			(unsigned long)len, ret);
+		bv->err_cnt++;
+	}
+	return RPMSG_SUCCESS;
+}
+
+static int ping_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			    uint32_t src, void *priv)
+{
+	struct _payload *r_payload = (struct _payload *)data;
+	struct bench_vdev *bv = priv;
+
+	(void)ept;
+	(void)src;
+
+	if (len < sizeof(*r_payload) || r_payload->num != bv->rnum) {
+		LPERROR("Unexpected payload %lu on vdev %u, expected %lu\r\n",
+			r_payload->num, bv->index, bv->rnum);
+		bv->err_cnt++;
+	}
+	bv->rnum = r_payload->num + 1;
+	/* Keep the window full */
+	if (bv->sent < nums)
+		bench_send_next(bv);
+	return RPMSG_SUCCESS;
+}
+
+static void rpmsg_service_unbind(struct rpmsg_endpoint *ept)
+{
+	struct bench_vdev *bv = ept->priv;
+
+	rpmsg_destroy_ept(ept);
+	bv->ept_deleted = 1;
+	bv->done = 1;
+}
+
+static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
+				       const char *name, uint32_t dest)
+{
+	struct bench_vdev *bv = bench_find_vdev(rdev);
+
+	if (!bv || strcmp(name, RPMSG_SERVICE_NAME)) {
+		LPERROR("Unexpected name service %s.\r\n", name);
+		return;
+	}
+	(void)rpmsg_create_ept(&bv->ept, rdev, RPMSG_SERVICE_NAME,
+			       RPMSG_ADDR_ANY, dest, ping_endpoint_cb,
+			       rpmsg_service_unbind);
+	bv->ept.priv = bv;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Application
+ *-----------------------------------------------------------------------------*/
+static void bench_pin_thread(struct bench_vdev *bv)
+{
+	cpu_set_t cpus;
+
+	if (first_cpu < 0)
+		return;
+	CPU_ZERO(&cpus);
+	CPU_SET(first_cpu + bv->index, &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+		LPERROR("Failed to pin vdev %u to CPU %u.\r\n", bv->index,
+			first_cpu + bv->index);
+}
+
+static void bench_echo(struct bench_vdev *bv)
+{
+	while (!bv->done && !bv->err_cnt)
+		platform_poll_vdev(platform, bv->index);
+}
+
+static void bench_ping(struct bench_vdev *bv)
+{
+	unsigned int shutdown_msg = SHUTDOWN_MSG;
+	unsigned int i;
+
+	bv->tstart = bench_gettime();
+	for (i = 0; i < window && bv->sent < nums; i++) {
+		if (bench_send_next(bv))
+			break;
+	}
+	while (bv->rnum < nums && !bv->err_cnt && !bv->done)
+		platform_poll_vdev(platform, bv->index);
+	bv->tend = bench_gettime();
+	rpmsg_send(&bv->ept, &shutdown_msg, sizeof(shutdown_msg));
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_vdev *bv = arg;
+
+	bench_pin_thread(bv);
+	if (role == VIRTIO_DEV_DRIVER)
+		bench_ping(bv);
+	else
+		bench_echo(bv);
+	return NULL;
+}
+
+static int bench_run(int payload_size)
+{
+	unsigned long long tstart = 0, tend = 0, tdiff, total = 0;
+	unsigned int i, started = 0;
+	struct bench_vdev *bv;
+	char params[64];
+	int err_cnt = 0;
+	int ret = 0;
+
+	payload_len = sizeof(struct _payload) + payload_size;
+	for (i = 0; i < num_vdevs; i++) {
+		bv = &vdevs[i];
+		ret = rpmsg_create_ept(&bv->ept, bv->rdev, RPMSG_SERVICE_NAME,
+				       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
+				       role == VIRTIO_DEV_DRIVER ?
+				       ping_endpoint_cb : echo_endpoint_cb,
+				       rpmsg_service_unbind);
+		if (ret) {
+			LPERROR("Failed to create endpoint %u.\r\n", i);
+			return ret;
+		}
+		bv->ept.priv = bv;
+		if (payload_len > rpmsg_get_tx_buffer_size(&bv->ept)) {
+			LPERROR("Payload size %d exceeds the buffer size.\r\n",
+				payload_size);
+			return -1;
+		}
+		bv->payload = metal_allocate_memory(payload_len);
+		if (!bv->payload) {
+			LPERROR("memory allocation failed.\r\n");
+			return -1;
+		}
+		bv->payload->size = payload_size;
+		memset(bv->payload->data, 0xA5, payload_size);
+	}
+
+	/* Bind all the endpoints first, so that the vdevs start together */
+	for (i = 0; i < num_vdevs && role == VIRTIO_DEV_DRIVER; i++) {
+		while (!is_rpmsg_ept_ready(&vdevs[i].ept))
+			platform_poll_vdev(platform, i);
+	}
+	if (role == VIRTIO_DEV_DRIVER)
+		LPRINTF("RPMSG endpoints are binded with remote.\r\n");
+
+	for (i = 0; i < num_vdevs; i++, started++) {
+		if (pthread_create(&vdevs[i].thread, NULL, bench_thread,
+				   &vdevs[i])) {
+			LPERROR("Failed to create thread %u.\r\n", i);
+			ret = -1;
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(vdevs[i].thread, NULL);
+
+	for (i = 0; i < num_vdevs; i++) {
+		bv = &vdevs[i];
+		err_cnt += bv->err_cnt;
+		if (!tstart || bv->tstart < tstart)
+			tstart = bv->tstart;
+		if (bv->tend > tend)
+			tend = bv->tend;
+		total += bv->rnum;
+	}
+
+	if (role == VIRTIO_DEV_DRIVER) {
+		LPRINTF("**********************************\r\n");
+		LPRINTF(" vdevs: %u, payload size: %d, window: %u\r\n",
+			num_vdevs, payload_size, window);
+		for (i = 0; i < num_vdevs && !err_cnt; i++) {
+			bv = &vdevs[i];
+			tdiff = bv->tend - bv->tstart;
+			LPRINTF(" vdev %u: %lu round trips, msgs/s: %llu\r\n",
+				i, bv->rnum,
+				tdiff ? (unsigned long long)bv->rnum * 2 *
+					NS_PER_S / tdiff : 0);
+		}
+		if (!err_cnt && tend > tstart) {
+			LPRINTF(" Aggregate msgs/s: %llu\r\n",
+				total * 2 * NS_PER_S / (tend - tstart));
+			snprintf(params, sizeof(params),
+				 "vdevs=%u,size=%d,window=%u", num_vdevs,
+				 payload_size, window);
+			bench_result_add(params, "msgs_s", "1/s",
+					 BENCH_HIGHER, (double)total * 2 *
+					 NS_PER_S / (tend - tstart));
+		}
+		LPRINTF(" Test Results: Error count = %d \r\n", err_cnt);
+		LPRINTF("**********************************\r\n");
+	} else {
+		LPRINTF("Echoed %llu messages on %u vdevs.\r\n", total,
+			num_vdevs);
+	}
+
+	for (i = 0; i < num_vdevs; i++) {
+		if (!vdevs[i].ept_deleted)
+			rpmsg_destroy_ept(&vdevs[i].ept);
+		metal_free_memory(vdevs[i].payload);
+	}
+	return err_cnt ? -1 : ret;
+}
+
+static const struct option long_options[] = {
+	BENCH_RESULT_LONG_OPTIONS,
+	{ NULL, 0, NULL, 0 },
+};
+
+static void print_help(const char *prog)
+{
+	LPRINTF("usage: %s [-r echo|ping] [-k vdevs] [-n msgs] "
+		"[-s payload_size] [-w window] [-c first_cpu] "
+		BENCH_RESULT_USAGE " [proc_id [rsc_id]]\r\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	int payload_size = PAYLOAD_DEF_SIZE;
+	unsigned int i, created = 0;
+	int opt, ret, res;
+
+	while ((opt = getopt_long(argc, argv,
+				  "r:k:n:s:w:c:h" BENCH_RESULT_SHORT_OPTIONS,
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			if (!strcmp(optarg, "echo")) {
+				role = VIRTIO_DEV_DEVICE;
+			} else if (!strcmp(optarg, "ping")) {
+				role = VIRTIO_DEV_DRIVER;
+			} else {
+				print_help(argv[0]);
+				return -1;
+			}
+			break;
+		case 'k':
+			setenv(RPMSG_VDEVS_ENV, optarg, 1);
+			break;
+		case 'n':
+			nums = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			payload_size = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			first_cpu = strtol(optarg, NULL, 0);
+			break;
+		default:
+			if (!bench_result_option(opt, optarg))
+				break;
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+	if (!nums || !window || payload_size < 0) {
+		print_help(argv[0]);
+		return -1;
+	}
+
+	ret = bench_result_start("msg-bench-vdevs");
+	if (ret)
+		return ret;
+
+	/* Initialize platform, with the remaining arguments */
+	ret = platform_init(argc - optind + 1, &argv[optind - 1], &platform);
+	if (ret) {
+		LPERROR("Failed to initialize platform.\r\n");
+		return -1;
+	}
+
+	num_vdevs = platform_get_num_vdevs(platform);
+	vdevs = metal_allocate_memory(num_vdevs * sizeof(*vdevs));
+	if (!vdevs) {
+		LPERROR("memory allocation failed.\r\n");
+		ret = -1;
+		goto out;
+	}
+	memset(vdevs, 0, num_vdevs * sizeof(*vdevs));
+
+	for (i = 0; i < num_vdevs; i++, created++) {
+		vdevs[i].index = i;
+		vdevs[i].rdev = platform_create_rpmsg_vdev(platform, i, role,
+							   NULL,
+							   rpmsg_name_service_bind_cb);
+		if (!vdevs[i].rdev) {
+			LPERROR("Failed to create rpmsg virtio device %u.\r\n",
+				i);
+			ret = -1;
+			goto out;
+		}
+	}
+
+	ret = bench_run(payload_size);
+
+out:
+	for (i = 0; i < created; i++)
+		platform_release_rpmsg_vdev(vdevs[i].rdev, platform);
+	metal_free_memory(vdevs);
+
+	LPRINTF("Stopping application...\r\n");
+	platform_cleanup(platform);
+	res = bench_result_finish();
+	if (!ret)
+		ret = res;
+
+	return ret;
+}
@@ -0,0 +1,519 @@
+/*
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * This is a benchmark application to compare the copy and zero-copy paths
+ * of rpmsg on identical workloads. For each payload size, the same number
+ * of messages is produced, sent to the echo application
+ * (msg-test-rpmsg-update) with a window of messages in flight, and the
+ * echoes are consumed, in four modes:
+ *  - copy: the payload is built in a local buffer and sent with
+ *    rpmsg_trysend(), the echo is copied out of the RX buffer in the
+ *    endpoint callback,
+ *  - zc-tx: the payload is built in a TX buffer from
+ *    rpmsg_get_tx_payload_buffer() and sent with rpmsg_send_nocopy(), the
+ *    echo is copied out as for copy,
+ *  - zc-rx: the payload is sent as for copy, the RX buffer is held and the
+ *    echo consumed in place, then released,
+ *  - zc: zero-copy on both paths.
+ * The cost is reported in cycles per round trip, and payload bytes per
+ * cycle. With -p, the hardware performance counters are also reported per
+ * message for each phase of the loop, to attribute the cost to the copy,
+ * the notification and the callback dispatch. With -b, the buffer telemetry
+ * is also reported for each mode: the sends which found no TX buffer, the
+ * RX buffers held and their age, and the peak occupancy of the vrings.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <openamp/open_amp.h>
+#include <metal/alloc.h>
+#include "bench-result.h"
+#include "perf-counters.h"
+#include "platform_info.h"
+#include "rpmsg-ept-stats.h"
+#include "rpmsg-held-ring.h"
+#include "rpmsg-ping.h"
+
+#define LPRINTF(format, ...) printf(format, ##__VA_ARGS__)
+#define LPERROR(format, ...) LPRINTF("ERROR: " format, ##__VA_ARGS__)
+
+struct _payload {
+	unsigned long num;
+	unsigned long size;
+	unsigned char data[];
+};
+
+#define NUMS_MSGS	100000
+#define WINDOW_DEF	8
+#define SIZE_MIN	16
+#define PAYLOAD_MARK	0xA5
+#define NS_PER_S	(1000 * 1000 * 1000)
+
+/*
+ * Cycle counter: the time stamp counter on x86, the virtual counter on
+ * aarch64, which ticks at the counter frequency rather than at the CPU
+ * frequency, nanoseconds otherwise.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_CYCLES_NAME	"tsc"
+static inline unsigned long long bench_cycles(void)
+{
+	return __builtin_ia32_rdtsc();
+}
+#elif defined(__aarch64__)
+#define BENCH_CYCLES_NAME	"cntvct"
+static inline unsigned long long bench_cycles(void)
+{
+	unsigned long long cnt;
+
+	__asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(cnt));
+	return cnt;
+}
+#else
+#define BENCH_CYCLES_NAME	"ns"
+static inline unsigned long long bench_cycles(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+#endif
+
+static const struct {
+	const char *name;
+	int tx_nocopy;
+	int rx_nocopy;
+} modes[] = {
+	{ "copy", 0, 0 },
+	{ "zc-tx", 1, 0 },
+	{ "zc-rx", 0, 1 },
+	{ "zc", 1, 1 },
+};
+
+#define NUM_MODES	(sizeof(modes) / sizeof(modes[0]))
+
+/* Phases of the loop the performance counters are reported for */
+enum {
+	PH_BUILD,	/* payload production in the TX buffer */
+	PH_SEND,	/* copy to a TX buffer if any and notification */
+	PH_POLL,	/* notification wait and dispatch, callback included */
+	PH_CALLBACK,	/* endpoint callback, RX copy if any */
+	PH_CONSUME,	/* consumption of the held RX buffers */
+	PH_NUM,
+};
+
+static const char *const phase_names[PH_NUM] = {
+	"build", "send", "poll", "callback", "consume",
+};
+
+/* Globals */
+static struct rpmsg_endpoint lept;
+static struct rpmsg_held_ring held_ring;
+static struct _payload *tx_payload;
+static struct _payload *rx_payload;
+static int rx_nocopy;
+static unsigned long rnum;
+/* Sum of the consumed bytes, so that the consumer is not optimized out */
+static volatile unsigned long consumed;
+static int err_cnt;
+static int ept_deleted;
+static struct perf_counters perf;
+static struct perf_phase mode_phases[NUM_MODES][PH_NUM];
+static struct perf_phase *phases = mode_phases[0];
+static int use_buf_stats;
+static struct rpmsg_ept_stats mode_ept_stats[NUM_MODES];
+static struct platform_buf_stats mode_buf_stats[NUM_MODES];
+static struct rpmsg_ept_stats *ept_stats = &mode_ept_stats[0];
+
+/*-----------------------------------------------------------------------------*
+ *  Workload, identical in all the modes
+ *-----------------------------------------------------------------------------*/
+static void payload_produce(struct _payload *payload, unsigned long num,
+			    size_t size)
+{
+	payload->num = num;
+	payload->size = size;
+	memset(payload->data, PAYLOAD_MARK, size);
+}
+
+static void payload_consume(const struct _payload *payload, size_t len)
+{
+	unsigned long sum = 0;
+	size_t i;
+
+	if (len < sizeof(*payload) ||
+	    payload->size != len - sizeof(*payload) ||
+	    payload->num != rnum) {
+		LPERROR("Unexpected payload %lu, expected %lu\r\n",
+			payload->num, rnum);
+		err_cnt++;
+		return;
+	}
+	for (i = 0; i < payload->size; i++)
+		sum += payload->data[i];
+	consumed += sum;
+	rnum++;
+}
+
+/*-----------------------------------------------------------------------------*
+ *  RPMSG endpoint callbacks
+ *-----------------------------------------------------------------------------*/
+static int rpmsg_endpoint_cb(struct rpmsg_endpoint *ept, void *data, size_t len,
+			     uint32_t src, void *priv)
+{
+	(void)src;
+	(void)priv;
+
+	perf_phase_begin(&perf, &phases[PH_CALLBACK]);
+	rpmsg_ept_stats_recv(ept_stats);
+	if (rx_nocopy) {
+		/* Consumed in place out of the callback, then released */
+		if (rpmsg_held_ring_push_ts(&held_ring, ept, data, len,
+					    use_buf_stats ? bench_cycles() : 0)) {
+			LPERROR("Held RX buffer ring is full.\r\n");
+			err_cnt++;
+		} else {
+			rpmsg_ept_stats_hold(ept_stats);
+		}
+	} else {
+		memcpy(rx_payload, data, len);
+		payload_consume(rx_payload, len);
+	}
+	perf_phase_end(&perf, &phases[PH_CALLBACK]);
+	return RPMSG_SUCCESS;
+}
+
+static void rpmsg_service_unbind(struct rpmsg_endpoint *ept)
+{
+	(void)ept;
+	rpmsg_destroy_ept(&lept);
+	LPRINTF("zero-copy bench: service is destroyed\r\n");
+	ept_deleted = 1;
+}
+
+static void rpmsg_name_service_bind_cb(struct rpmsg_device *rdev,
+				       const char *name, uint32_t dest)
+{
+	LPRINTF("new endpoint notification is received.\r\n");
+	if (strcmp(name, RPMSG_SERVICE_NAME))
+		LPERROR("Unexpected name service %s.\r\n", name);
+	else
+		(void)rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+				       RPMSG_ADDR_ANY, dest,
+				       rpmsg_endpoint_cb,
+				       rpmsg_service_unbind);
+}
+
+/*-----------------------------------------------------------------------------*
+ *  Application
+ *-----------------------------------------------------------------------------*/
+static void consume_held(void)
+{
+	struct rpmsg_held_buf *buf;
+	unsigned long long now;
+	unsigned int count, i;
+
+	count = rpmsg_held_ring_count(&held_ring);
+	if (!count)
+		return;
+	perf_phase_begin(&perf, &phases[PH_CONSUME]);
+	now = use_buf_stats ? bench_cycles() : 0;
+	for (i = 0; i < count; i++) {
+		buf = rpmsg_held_ring_at(&held_ring, i);
+		payload_consume(buf->data, buf->len);
+		rpmsg_ept_stats_release(ept_stats, now - buf->ts);
+	}
+	rpmsg_held_ring_release(&held_ring, count);
+	perf_phase_end(&perf, &phases[PH_CONSUME]);
+}
+
+/* Send the next message, return RPMSG_ERR_NO_BUFF if no TX buffer is left */
+static int send_next(int tx_nocopy, unsigned long num, size_t size)
+{
+	struct _payload *payload;
+	uint32_t buf_len;
+	int len = sizeof(struct _payload) + size;
+	int ret;
+
+	if (!tx_nocopy) {
+		perf_phase_begin(&perf, &phases[PH_BUILD]);
+		payload_produce(tx_payload, num, size);
+		perf_phase_end(&perf, &phases[PH_BUILD]);
+		perf_phase_begin(&perf, &phases[PH_SEND]);
+		ret = rpmsg_trysend(&lept, tx_payload, len);
+		perf_phase_end(&perf, &phases[PH_SEND]);
+		return rpmsg_ept_stats_send(ept_stats, ret);
+	}
+	perf_phase_begin(&perf, &phases[PH_SEND]);
+	payload = rpmsg_get_tx_payload_buffer(&lept, &buf_len, 0);
+	perf_phase_end(&perf, &phases[PH_SEND]);
+	if (!payload)
+		return rpmsg_ept_stats_send(ept_stats, RPMSG_ERR_NO_BUFF);
+	perf_phase_begin(&perf, &phases[PH_BUILD]);
+	payload_produce(payload, num, size);
+	perf_phase_end(&perf, &phases[PH_BUILD]);
+	perf_phase_begin(&perf, &phases[PH_SEND]);
+	ret = rpmsg_send_nocopy(&lept, payload, len);
+	if (ret < 0)
+		rpmsg_release_tx_buffer(&lept, payload);
+	perf_phase_end(&perf, &phases[PH_SEND]);
+	return rpmsg_ept_stats_send(ept_stats, ret);
+}
+
+static int run_mode(void *priv, unsigned int m, size_t size,
+		    unsigned long nums, unsigned int window,
+		    unsigned long long *cycles)
+{
+	unsigned long long cstart;
+	unsigned long sent = 0;
+	unsigned int p;
+	int ret;
+
+	phases = mode_phases[m];
+	for (p = 0; p < PH_NUM; p++)
+		perf_phase_init(&phases[p], phase_names[p]);
+	ept_stats = &mode_ept_stats[m];
+	memset(ept_stats, 0, sizeof(*ept_stats));
+	if (use_buf_stats)
+		platform_reset_buf_stats(priv, 0);
+	rx_nocopy = modes[m].rx_nocopy;
+	rnum = 0;
+	cstart = bench_cycles();
+	while (rnum < nums && !err_cnt && !ept_deleted) {
+		while (sent < nums && sent - rnum < window) {
+			ret = send_next(modes[m].tx_nocopy, sent, size);
+			if (ret == RPMSG_ERR_NO_BUFF)
+				break;
+			if (ret < 0) {
+				LPERROR("Failed to send data...\r\n");
+				return ret;
+			}
+			sent++;
+		}
+		perf_phase_begin(&perf, &phases[PH_POLL]);
+		platform_poll(priv);
+		perf_phase_end(&perf, &phases[PH_POLL]);
+		consume_held();
+	}
+	*cycles = bench_cycles() - cstart;
+	if (use_buf_stats)
+		platform_get_buf_stats(priv, 0, &mode_buf_stats[m]);
+	return (err_cnt || ept_deleted) ? -1 : 0;
+}
+
+static void print_phases(unsigned long nums)
+{
+	unsigned int m, p;
+
+	for (m = 0; m < NUM_MODES; m++) {
+		LPRINTF("%8s %s\r\n", "", modes[m].name);
+		for (p = 0; p < PH_NUM; p++)
+			perf_phase_print(&perf, &mode_phases[m][p], nums,
+					 "           ");
+	}
+}
+
+static void print_buf_stats(void)
+{
+	const struct platform_buf_stats *bs;
+	unsigned int m;
+
+	for (m = 0; m < NUM_MODES; m++) {
+		bs = &mode_buf_stats[m];
+		rpmsg_ept_stats_print(modes[m].name, &mode_ept_stats[m],
+				      BENCH_CYCLES_NAME);
+		LPRINTF("%s: vring peak tx %u/%u, rx held %u/%u\r\n",
+			modes[m].name, bs->tx.peak, bs->tx.num, bs->rx.peak,
+			bs->rx.num);
+	}
+}
+
+int app(struct rpmsg_device *rdev, void *priv, unsigned long nums,
+	unsigned int window, size_t size_max, int use_perf)
+{
+	unsigned long long cycles;
+	char params[64];
+	int max_size;
+	size_t size, next_size;
+	unsigned int m;
+	int ret;
+
+	/* Create RPMsg endpoint */
+	ret = rpmsg_create_ept(&lept, rdev, RPMSG_SERVICE_NAME,
+			       RPMSG_ADDR_ANY, RPMSG_ADDR_ANY,
+			       rpmsg_endpoint_cb, rpmsg_service_unbind);
+	if (ret) {
+		LPERROR("Failed to create RPMsg endpoint.\r\n");
+		return ret;
+	}
+	while (!is_rpmsg_ept_ready(&lept))
+		platform_poll(priv);
+	LPRINTF("RPMSG endpoint is binded with remote.\r\n");
+
+	max_size = rpmsg_get_tx_buffer_size(&lept);
+	if (max_size < (int)(sizeof(struct _payload) + SIZE_MIN)) {
+		LPERROR("No available buffer size.\r\n");
+		ret = -1;
+		goto out;
+	}
+	max_size -= sizeof(struct _payload);
+	if (!size_max || size_max > (size_t)max_size)
+		size_max = max_size;
+	tx_payload = metal_allocate_memory(sizeof(struct _payload) + size_max);
+	rx_payload = metal_allocate_memory(sizeof(struct _payload) + size_max);
+	if (!tx_payload || !rx_payload || rpmsg_held_ring_init(&held_ring, rdev)) {
+		LPERROR("memory allocation failed.\r\n");
+		ret = -1;
+		goto out_free;
+	}
+
+	LPRINTF("%lu round trips per size, window %u, %s cycles\r\n", nums,
+		window, BENCH_CYCLES_NAME);
+	if (use_perf) {
+		ret = perf_counters_open(&perf);
+		if (ret)
+			LPRINTF("perf counters unavailable: %s\r\n",
+				strerror(-ret));
+		else
+			perf_counters_describe(&perf);
+		ret = 0;
+	}
+	LPRINTF("%8s", "size");
+	for (m = 0; m < NUM_MODES; m++)
+		LPRINTF(" %18s", modes[m].name);
+	LPRINTF("\r\n%8s", "");
+	for (m = 0; m < NUM_MODES; m++)
+		LPRINTF(" %18s", "cyc/msg    B/cyc");
+	LPRINTF("\r\n");
+
+	for (size = SIZE_MIN; size <= size_max && !ret; size = next_size) {
+		LPRINTF("%8lu", (unsigned long)size);
+		for (m = 0; m < NUM_MODES; m++) {
+			ret = run_mode(priv, m, size, nums, window, &cycles);
+			if (ret)
+				break;
+			LPRINTF(" %9.1f %8.3f", (double)cycles / nums,
+				(double)size * nums / cycles);
+			snprintf(params, sizeof(params),
+				 "size=%lu,mode=%s,window=%u",
+				 (unsigned long)size, modes[m].name, window);
+			bench_result_add(params, "cycles_msg", BENCH_CYCLES_NAME,
+					 BENCH_LOWER, (double)cycles / nums);
+		}
+		LPRINTF("\r\n");
+		if (!ret && perf.nr)
+			print_phases(nums);
+		if (!ret && use_buf_stats)
+			print_buf_stats();
+		/* Powers of two, ending on the largest payload */
+		next_size = size * 2;
+		if (size < size_max && next_size > size_max)
+			next_size = size_max;
+	}
+
+	LPRINTF("**********************************\r\n");
+	LPRINTF(" Test Results: Error count = %d \r\n", err_cnt);
+	LPRINTF("**********************************\r\n");
+
+	if (perf.nr)
+		perf_counters_close(&perf);
+	rpmsg_held_ring_deinit(&held_ring);
+out_free:
+	metal_free_memory(tx_payload);
+	metal_free_memory(rx_payload);
+out:
+	if (!ept_deleted)
+		rpmsg_destroy_ept(&lept);
+	return ret;
+}
+
+static const struct option long_options[] = {
+	BENCH_RESULT_LONG_OPTIONS,
+	{ NULL, 0, NULL, 0 },
+};
+
+static void print_help(const char *prog)
+{
+	LPRINTF("usage: %s [-n msgs] [-w window] [-s max_size] [-p] [-b] "
+		BENCH_RESULT_USAGE " [proc_id [rsc_id]]\r\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long nums = NUMS_MSGS;
+	unsigned int window = WINDOW_DEF;
+	size_t size_max = 0;
+	int use_perf = 0;
+	void *platform;
+	struct rpmsg_device *rpdev;
+	int opt, ret, res;
+
+	while ((opt = getopt_long(argc, argv,
+				  "n:w:s:pbh" BENCH_RESULT_SHORT_OPTIONS,
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			nums = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			use_perf = 1;
+			break;
+		case 'b':
+			use_buf_stats = 1;
+			break;
+		default:
+			if (!bench_result_option(opt, optarg))
+				break;
+			print_help(argv[0]);
+			return -1;
+		}
+	}
+	if (!nums || !window) {
+		print_help(argv[0]);
+		return -1;
+	}
+
+	ret = bench_result_start("msg-bench-zerocopy");
+	if (ret)
+		return ret;
+
+	/* Initialize platform, with the remaining arguments */
+	ret = platform_init(argc - optind + 1, &argv[optind - 1], &platform);
+	if (ret) {
+		LPERROR("Failed to initialize platform.\r\n");
+		ret = -1;
+	} else {
+		rpdev = platform_create_rpmsg_vdev(platform, 0,
+						  VIRTIO_DEV_DRIVER,
+						  NULL,
+						  rpmsg_name_service_bind_cb);
+		if (!rpdev) {
+			LPERROR("Failed to create rpmsg virtio device.\r\n");
+			ret = -1;
+		} else {
+			ret = app(rpdev, platform, nums, window, size_max,
+				  use_perf);
+			platform_release_rpmsg_vdev(rpdev, platform);
+		}
+	}
+
+	LPRINTF("Stopping application...\r\n");
+	platform_cleanup(platform);
+	res = bench_result_finish();
+	if (!ret)
+		ret = res;
+
+	return ret;
+}
@@ -12,7 +12,8 @@
  * 2. Open the IRQ device.
  * 3. Register the IRQ interrupt handler.
  * 4. Write a message to the shared memory.
- * 5. Kick the IRQ to notify the remote there is a new message.
+ * 5. Kick the IRQ to notify the remote there is a new message, unless the
+ *    remote is still draining the earlier ones.
  * 6. Wait until the remote notifies that the message was echoed back.
  * 7. Read the message from shared memory.
  * 8. Verify the message.
@@ -20,12 +21,25 @@
  * 10. Clean up: deregister the IRQ handler, close the IRQ device, and close the
  *     shared memory device.
  *
+ * With -m, the demo measures instead, for each payload size up to the
+ * largest message the remote echoes: the round trip latency of one message
+ * at a time, then the throughput with as many messages in flight as the
+ * shared memory holds, published in batches of -b messages with one kick.
+ *
+ * Each channel of the platform is served by a lane, and each lane by its
+ * own thread; with -p, pinned to the CPU given plus the index of the lane.
+ * The demo runs on the first -c lanes at once; with -m, the aggregate
+ * throughput of 1 to -c lanes follows the single channel measurements.
+ *
  * Shared-memory partitioning details are documented in machine/host/
  * amd_linux_userspace/README.md.
  */
 
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <metal/sys.h>
 #include <metal/io.h>
 #include <metal/alloc.h>
@@ -36,6 +50,7 @@
 
 #include "common.h"
 #include "platform_init.h"
+#include "../shm_ring.h"
 
 /* Shared memory offsets */
 #define SHM_DESC_OFFSET_TX 0x0
@@ -47,13 +62,19 @@
 #define SHM_DESC_AVAIL_OFFSET 0x00
 #define SHM_DESC_USED_OFFSET  0x04
 #define SHM_DESC_ADDR_ARRAY_OFFSET 0x08
+/* Event index, last word of a descriptor area */
+#define SHM_DESC_EVENT_OFFSET(size) ((size) - sizeof(uint32_t))
+
+#ifndef SHM_PAYLOAD_HALF_SIZE
+#define SHM_PAYLOAD_HALF_SIZE (SHM_PAYLOAD_SIZE / 2)
+#endif
 
 /* Descriptor regions for each direction. */
 /* Note that H_TO_R_ is host to remote and R_TO_H_ is vice versa. */
 #define H_TO_R_DESC_ADDR_START SHM_DESC_ADDR_ARRAY_OFFSET
-#define H_TO_R_DESC_ADDR_END   SHM0_DESC_SIZE
+#define H_TO_R_DESC_ADDR_END   SHM_DESC_EVENT_OFFSET(SHM0_DESC_SIZE)
 #define R_TO_H_DESC_ADDR_START SHM_DESC_ADDR_ARRAY_OFFSET
-#define R_TO_H_DESC_ADDR_END   SHM1_DESC_SIZE
+#define R_TO_H_DESC_ADDR_END   SHM_DESC_EVENT_OFFSET(SHM1_DESC_SIZE)
 
 /* Split of the data / payload area for each direction */
 #define H_TO_R_PAYLOAD_START   SHM_PAYLOAD_RX_OFFSET
@@ -61,11 +82,19 @@
 #define R_TO_H_PAYLOAD_START   SHM_PAYLOAD_TX_OFFSET
 #define R_TO_H_PAYLOAD_END     (SHM_PAYLOAD_TX_OFFSET + SHM_PAYLOAD_HALF_SIZE)
 
+/* Number of buffers of a descriptor address array */
+#define H_TO_R_DESC_NUM \
+	((H_TO_R_DESC_ADDR_END - H_TO_R_DESC_ADDR_START) / sizeof(uint32_t))
+
 #define PKGS_TOTAL 1024
 
 #define BUF_SIZE_MAX 512
 #define SHUTDOWN "shutdown"
 
+/* Payload sizes of the measurements, from the timestamp to BUF_SIZE_MAX */
+#define PAYLOAD_SIZE_MIN sizeof(unsigned long long)
+#define PAYLOAD_SIZE_MAX (BUF_SIZE_MAX - sizeof(struct msg_hdr_s))
+
 #define NS_PER_S  (1000 * 1000 * 1000)
 
 struct msg_hdr_s {
@@ -73,24 +102,55 @@ struct msg_hdr_s {
 	uint32_t len;
 };
 
+/* State of one direction of the shared memory */
+struct shm_queue_s {
+	unsigned long addr_offset; /* next entry of the address array */
+	uint32_t count; /* number of messages sent or received */
+	uint32_t avail; /* number of messages published to the remote */
+	unsigned long kicks; /* kicks of the remote */
+};
+
+/* Results of a run */
+struct echo_result_s {
+	struct metal_stat rtt;
+	struct latency_hist *hist;
+	unsigned long long tstart;
+	unsigned long long elapsed;
+	unsigned long full; /* sends which waited for the remote to use */
+	unsigned long kicks; /* kicks of the remote */
+	unsigned long waits; /* waits for a kick of the remote */
+};
+
+/* State of a channel served by the demo, a lane */
+struct echo_lane_s {
+	struct channel_s *ch;
+	struct shm_queue_s txq;
+	struct shm_ring_s txring;
+	struct shm_queue_s rxq;
+	void *txbuf, *rxbuf;
+	/* Run of the lane thread, see lanes_run() */
+	uint32_t len, nums, window, batch;
+	struct echo_result_s res;
+	int ret;
+	pthread_t thread;
+};
+
+/* CPU the thread of the first lane is pinned to, -1 for none */
+static int lanes_cpu = -1;
+
 /**
  * @brief wait_for_notified() - Loop until notified bit in channel is set.
  *
+ * The flag is the lane's own and is cleared by the IRQ handler with an
+ * atomic operation, so the wait takes no lock: the lanes of the other
+ * channels wait on their own flags concurrently.
+ *
  * @param[in] notified - pointer to the notified variable
  */
 static inline void wait_for_notified(atomic_flag *notified)
 {
-	unsigned int flags;
-
-	do {
-		flags = metal_irq_save_disable();
-		if (!atomic_flag_test_and_set(notified)) {
-			metal_irq_restore_enable(flags);
-			break;
-		}
+	while (atomic_flag_test_and_set(notified))
 		metal_cpu_yield();
-		metal_irq_restore_enable(flags);
-	} while (1);
 }
 
 /**
@@ -113,281 +173,711 @@ static inline void dump_buffer(void *buf, unsigned int len)
 }
 
 /**
- * @brief   irq_shmem_echo() - shared memory IRQ demo
- *          This task will:
- *          * Get the timestamp and put it into the ping shared memory
- *          * Update the shared memory descriptor for the new available
- *            ping buffer.
- *          * Trigger IRQ to notifty the remote.
- *          * Repeat the above steps until it sends out all the packages.
- *          * Monitor IRQ interrupt, verify every received package.
- *          * After all the packages are received, it sends out shutdown
- *            message to the remote.
+ * @brief build_msg() - construct a message in the local TX buffer
  *
- * @param[in] ch - communication channel used
- * @return - return 0 on success, otherwise return error number indicating
- *           type of error.
+ * The payload starts with the send timestamp, followed by a pattern
+ * derived from the message index.
+ *
+ * @param[in] ln - lane used
+ * @param[in] index - index of the message
+ * @param[in] len - payload length, at least PAYLOAD_SIZE_MIN
+ */
+static void build_msg(struct echo_lane_s *ln, uint32_t index, uint32_t len)
+{
+	struct msg_hdr_s *msg_hdr = ln->txbuf;
+	unsigned char *payload = ln->txbuf + sizeof(*msg_hdr);
+	unsigned long long tstart;
+	uint32_t i;
+
+	msg_hdr->index = index;
+	msg_hdr->len = len;
+	for (i = sizeof(tstart); i < len; i++)
+		payload[i] = (unsigned char)(index + i);
+	tstart = platform_gettime();
+	memcpy(payload, &tstart, sizeof(tstart));
+}
+
+/**
+ * @brief publish_msgs() - make the queued messages available to the remote
+ *        and kick it if it waits for one of them
+ *
+ * @param[in] ln - lane used
+ */
+static void publish_msgs(struct echo_lane_s *ln)
+{
+	struct channel_s *ch = ln->ch;
+	uint32_t old_avail = ln->txq.avail, event;
+
+	if (ln->txq.count == old_avail)
+		return;
+
+	/* Increase number of available buffers */
+	ln->txq.avail = ln->txq.count;
+	metal_io_write32(ch->host_to_remote_desc_io, SHM_DESC_AVAIL_OFFSET,
+			 ln->txq.avail);
+	/* Kick IRQ only if the remote has drained and waits for data */
+	event = metal_io_read32(ch->host_to_remote_desc_io,
+				SHM_DESC_EVENT_OFFSET(SHM0_DESC_SIZE));
+	if (shm_need_kick(event, ln->txq.avail, old_avail)) {
+		irq_kick(ch);
+		ln->txq.kicks++;
+	}
+}
+
+/**
+ * @brief queue_msg() - copy the local TX buffer to the shared memory,
+ *        to be made available to the remote by publish_msgs()
+ *
+ * @param[in] ln - lane used
+ * @return - 0 on success, -EAGAIN if the remote has not used enough
+ *           messages yet for this one to fit, otherwise a negative error
+ *           number
+ */
+static int queue_msg(struct echo_lane_s *ln)
+{
+	struct channel_s *ch = ln->ch;
+	struct metal_io_region *payload_io = ch->shm_io;
+	struct msg_hdr_s *msg_hdr = ln->txbuf;
+	uint32_t msg_len = sizeof(*msg_hdr) + msg_hdr->len;
+	unsigned long data_offset, slot, tail = 0;
+	uint32_t tx_phy_addr_32, inflight;
+	int ret;
+
+	/*
+	 * Reclaim the messages the remote used and echoed: a remote echoing
+	 * in place hands the buffer back with the echo. The oldest one still
+	 * in flight is the tail of the payload ring.
+	 */
+	inflight = ln->txq.count - metal_io_read32(ch->host_to_remote_desc_io,
+						   SHM_DESC_USED_OFFSET);
+	if (ln->txq.count - ln->rxq.count > inflight)
+		inflight = ln->txq.count - ln->rxq.count;
+	if (inflight && inflight < H_TO_R_DESC_NUM) {
+		slot = shm_ring_tail_slot(ln->txq.addr_offset, inflight,
+					  H_TO_R_DESC_ADDR_START,
+					  H_TO_R_DESC_ADDR_END);
+		tx_phy_addr_32 = metal_io_read32(ch->host_to_remote_desc_io,
+						 slot);
+		tail = metal_io_phys_to_offset(payload_io,
+					       (metal_phys_addr_t)tx_phy_addr_32);
+	}
+	ret = shm_ring_alloc(&ln->txring, inflight, tail, msg_len, &data_offset);
+	if (ret) {
+		ln->txring.full++;
+		return ret;
+	}
+
+	/* Copy message to shared buffer. */
+	ret = metal_io_block_write(payload_io, data_offset, msg_hdr, msg_len);
+	if (ret < 0) {
+		metal_err("HOST: Failed to copy message to shared buffer.\n");
+		return ret;
+	}
+
+	/* Write to the address array to tell the other end the buffer address. */
+	tx_phy_addr_32 = (uint32_t)metal_io_phys(payload_io, data_offset);
+	if (tx_phy_addr_32 == (uint32_t)METAL_BAD_PHYS) {
+		metal_err("HOST: Failed to get offset.\n");
+		return -EINVAL;
+	}
+	metal_io_write32(ch->host_to_remote_desc_io, ln->txq.addr_offset,
+			 tx_phy_addr_32);
+	shm_ring_commit(&ln->txring, data_offset, msg_len);
+	ln->txq.addr_offset += sizeof(uint32_t);
+	if (ln->txq.addr_offset >= H_TO_R_DESC_ADDR_END)
+		ln->txq.addr_offset = H_TO_R_DESC_ADDR_START;
+
+	ln->txq.count++;
+	return 0;
+}
+
+/**
+ * @brief wait_for_echo() - wait until the remote published an echo not
+ *        received yet
+ *
+ * The event index tells the remote to kick on the next echo; it is written
+ * before the avail counter is read again, so that an echo published in
+ * between is either seen here or kicked.
+ *
+ * @param[in] ln - lane used
+ * @param[in] res - results of the run
+ * @return - avail counter of the remote
+ */
+static uint32_t wait_for_echo(struct echo_lane_s *ln,
+			      struct echo_result_s *res)
+{
+	struct channel_s *ch = ln->ch;
+	uint32_t rx_avail;
+
+	metal_io_write32(ch->remote_to_host_desc_io,
+			 SHM_DESC_EVENT_OFFSET(SHM1_DESC_SIZE), ln->rxq.count);
+	rx_avail = metal_io_read32(ch->remote_to_host_desc_io,
+				   SHM_DESC_AVAIL_OFFSET);
+	if (rx_avail != ln->rxq.count)
+		return rx_avail;
+
+	wait_for_notified(&ch->remote_nkicked);
+	res->waits++;
+	return metal_io_read32(ch->remote_to_host_desc_io,
+			       SHM_DESC_AVAIL_OFFSET);
+}
+
+/**
+ * @brief recv_msg() - read the next echoed message, verify it and record
+ *        its round trip time
+ *
+ * @param[in] ln - lane used
+ * @param[in] res - results of the run
+ * @return - 0 on success, otherwise a negative error number
  */
-static int irq_shmem_echo(struct channel_s *ch)
+static int recv_msg(struct echo_lane_s *ln, struct echo_result_s *res)
 {
-	struct metal_io_region *desc_host_to_remote = ch->host_to_remote_desc_io;
-	struct metal_io_region *desc_remote_to_host = ch->remote_to_host_desc_io;
+	struct channel_s *ch = ln->ch;
 	struct metal_io_region *payload_io = ch->shm_io;
-	unsigned long tx_avail_offset, rx_avail_offset;
-	unsigned long tx_addr_offset, rx_addr_offset;
-	unsigned long tx_data_offset, rx_data_offset;
-	void *txbuf = NULL, *rxbuf = NULL, *tmpptr;
-	long long tdiff_avg_s = 0, tdiff_avg_ns = 0;
 	unsigned long long tstart, tend;
-	unsigned long rx_used_offset;
+	unsigned long rx_data_offset;
 	struct msg_hdr_s *msg_hdr;
-	uint32_t tx_phy_addr_32;
-	uint32_t rx_avail;
-	long long tdiff;
+	uint32_t rx_phy_addr_32;
+	unsigned char *payload;
 	uint32_t i;
 	int ret;
 
-	txbuf = metal_allocate_memory(BUF_SIZE_MAX);
-	if (!txbuf) {
-		metal_err("HOST: Failed to allocate local tx buffer for msg.\n");
-		ret = -ENOMEM;
-		goto out;
+	/* Get the buffer location from the shared memory RX address array. */
+	rx_phy_addr_32 = metal_io_read32(ch->remote_to_host_desc_io,
+					 ln->rxq.addr_offset);
+	rx_data_offset = metal_io_phys_to_offset(payload_io,
+						 (metal_phys_addr_t)rx_phy_addr_32);
+	if (rx_data_offset == METAL_BAD_OFFSET) {
+		metal_err("HOST: failed to get rx [%u] offset: 0x%x.\n",
+			  ln->rxq.count, rx_phy_addr_32);
+		return -EINVAL;
 	}
-	rxbuf = metal_allocate_memory(BUF_SIZE_MAX);
-	if (!rxbuf) {
-		metal_err("HOST: Failed to allocate local rx buffer for msg.\n");
-		ret = -ENOMEM;
-		goto out;
+	ln->rxq.addr_offset += sizeof(rx_phy_addr_32);
+	if (ln->rxq.addr_offset >= R_TO_H_DESC_ADDR_END)
+		ln->rxq.addr_offset = R_TO_H_DESC_ADDR_START;
+
+	/* Read message header from shared memory */
+	ret = metal_io_block_read(payload_io, rx_data_offset, ln->rxbuf,
+				  sizeof(struct msg_hdr_s));
+	if (ret < 0) {
+		metal_err("HOST: Failed to read from shared memory.\n");
+		return ret;
+	}
+	msg_hdr = (struct msg_hdr_s *)ln->rxbuf;
+
+	/* Check if the message header is valid */
+	if (msg_hdr->index != ln->rxq.count) {
+		metal_err("HOST: wrong msg: expected: %u, actual: %u\n",
+			  ln->rxq.count, msg_hdr->index);
+		return -EINVAL;
+	}
+	if (msg_hdr->len < PAYLOAD_SIZE_MIN || msg_hdr->len > PAYLOAD_SIZE_MAX) {
+		metal_err("HOST: wrong msg: length invalid: %u.\n",
+			  msg_hdr->len);
+		return -EINVAL;
+	}
+	/* Read message */
+	ret = metal_io_block_read(payload_io, rx_data_offset + sizeof(*msg_hdr),
+				  ln->rxbuf + sizeof(*msg_hdr), msg_hdr->len);
+	if (ret < 0) {
+		metal_err("HOST: Failed to read from shared memory.\n");
+		return ret;
+	}
+	tend = platform_gettime();
+
+	/* Increase RX used count to indicate it has consumed the received data. */
+	ln->rxq.count++;
+	metal_io_write32(ch->remote_to_host_desc_io, SHM_DESC_USED_OFFSET,
+			 ln->rxq.count);
+
+	/* Verify message */
+	payload = ln->rxbuf + sizeof(*msg_hdr);
+	for (i = sizeof(tstart); i < msg_hdr->len; i++) {
+		if (payload[i] != (unsigned char)(msg_hdr->index + i)) {
+			metal_err("HOST: data[%u] verification failed.\n",
+				  msg_hdr->index);
+			metal_info("HOST: Actual:");
+			dump_buffer(ln->rxbuf, sizeof(*msg_hdr) + msg_hdr->len);
+			return -EINVAL;
+		}
 	}
 
+	/* The round trip time of each message, from its own timestamp */
+	memcpy(&tstart, payload, sizeof(tstart));
+	update_stat(&res->rtt, tend - tstart);
+	if (res->hist)
+		latency_hist_record(res->hist, tend - tstart);
+	return 0;
+}
+
+/**
+ * @brief echo_run() - echo messages with the remote
+ *
+ * @param[in] ln - lane used
+ * @param[in] len - payload length of the messages
+ * @param[in] nums - number of messages
+ * @param[in] window - number of messages in flight, 1 for a closed loop
+ * @param[in] batch - messages published with one kick at most, 0 for all
+ *            the messages sent before waiting for the echoes
+ * @param[out] res - results of the run
+ * @return - 0 on success, otherwise a negative error number
+ */
+static int echo_run(struct echo_lane_s *ln, uint32_t len, uint32_t nums,
+		    uint32_t window, uint32_t batch, struct echo_result_s *res)
+{
+	uint32_t tx_first = ln->txq.count, rx_first = ln->rxq.count;
+	unsigned long full_first = ln->txring.full, kicks_first = ln->txq.kicks;
+	struct metal_stat stat_init = STAT_INIT;
+	uint32_t rx_avail;
+	int ret;
+
+	res->rtt = stat_init;
+	res->waits = 0;
+	if (res->hist)
+		latency_hist_reset(res->hist);
+	res->tstart = platform_gettime();
+	while (ln->rxq.count - rx_first != nums) {
+		while (ln->txq.count - tx_first != nums &&
+		       ln->txq.count - ln->rxq.count < window) {
+			build_msg(ln, ln->txq.count, len);
+			ret = queue_msg(ln);
+			/* No room left, the remote echoes free some */
+			if (ret == -EAGAIN)
+				break;
+			if (ret)
+				return ret;
+			if (batch && ln->txq.count - ln->txq.avail >= batch)
+				publish_msgs(ln);
+		}
+		publish_msgs(ln);
+
+		rx_avail = wait_for_echo(ln, res);
+		while (ln->rxq.count != rx_avail) {
+			ret = recv_msg(ln, res);
+			if (ret)
+				return ret;
+		}
+	}
+	res->elapsed = platform_gettime() - res->tstart;
+	res->full = ln->txring.full - full_first;
+	res->kicks = ln->txq.kicks - kicks_first;
+	return 0;
+}
+
+/**
+ * @brief send_shutdown() - send the shutdown message to the remote
+ *
+ * @param[in] ln - lane used
+ * @return - 0 on success, otherwise a negative error number
+ */
+static int send_shutdown(struct echo_lane_s *ln)
+{
+	struct msg_hdr_s *msg_hdr = ln->txbuf;
+	int ret;
+
+	msg_hdr->index = ln->txq.count;
+	msg_hdr->len = strlen(SHUTDOWN);
+	memcpy(ln->txbuf + sizeof(*msg_hdr), SHUTDOWN, strlen(SHUTDOWN));
+	ret = queue_msg(ln);
+	if (!ret)
+		publish_msgs(ln);
+	return ret;
+}
+
+/**
+ * @brief lane_init() - clear the shared memory of a channel and set up the
+ *        lane serving it
+ *
+ * @param[in] ln - lane to set up
+ * @param[in] ch - channel served by the lane
+ * @return - 0 on success, otherwise a negative error number
+ */
+static int lane_init(struct echo_lane_s *ln, struct channel_s *ch)
+{
+	int ret;
+
+	memset(ln, 0, sizeof(*ln));
+	ln->ch = ch;
+	ln->txq.addr_offset = H_TO_R_DESC_ADDR_START;
+	ln->txring = (struct shm_ring_s)SHM_RING_INIT(H_TO_R_PAYLOAD_START,
+						      H_TO_R_PAYLOAD_END,
+						      H_TO_R_DESC_NUM);
+	ln->rxq.addr_offset = R_TO_H_DESC_ADDR_START;
+
 	if (!ch || !ch->shm_io || !ch->host_to_remote_desc_io ||
-	    !ch->remote_to_host_desc_io || !ch->ipi_io) {
+	    !ch->remote_to_host_desc_io || !ch->ipi_io)
 		return -EINVAL;
+
+	ln->txbuf = metal_allocate_memory(BUF_SIZE_MAX);
+	ln->rxbuf = metal_allocate_memory(BUF_SIZE_MAX);
+	if (!ln->txbuf || !ln->rxbuf) {
+		metal_err("HOST: Failed to allocate local buffers for msg.\n");
+		return -ENOMEM;
 	}
 
 	/* Clear shared memory and descriptors */
 	ret = metal_io_block_set(ch->shm_io, 0, 0, SHM_PAYLOAD_SIZE);
 	if (ret < 0) {
 		metal_err("HOST: Failed to clear payload area.\n");
-		goto out;
+		return ret;
 	}
 
 	ret = metal_io_block_set(ch->host_to_remote_desc_io, 0, 0, SHM0_DESC_SIZE);
 	if (ret < 0) {
 		metal_err("HOST: Failed to clear host to remote descriptor area.\n");
-		goto out;
+		return ret;
 	}
 
 	ret = metal_io_block_set(ch->remote_to_host_desc_io, 0, 0, SHM1_DESC_SIZE);
 	if (ret < 0) {
 		metal_err("HOST: Failed to clear remote to host descriptor area.\n");
-		goto out;
+		return ret;
 	}
+	return 0;
+}
 
-	/* Set tx/rx buffer address offset */
-	tx_avail_offset = SHM_DESC_AVAIL_OFFSET;
-	rx_avail_offset = SHM_DESC_AVAIL_OFFSET;
-	rx_used_offset = SHM_DESC_USED_OFFSET;
-	tx_addr_offset = H_TO_R_DESC_ADDR_START;
-	rx_addr_offset = R_TO_H_DESC_ADDR_START;
-	tx_data_offset = H_TO_R_PAYLOAD_START;
-	rx_data_offset = R_TO_H_PAYLOAD_START;
+/**
+ * @brief lane_cleanup() - free the local buffers of a lane
+ *
+ * @param[in] ln - lane to clean up
+ */
+static void lane_cleanup(struct echo_lane_s *ln)
+{
+	if (ln->txbuf)
+		metal_free_memory(ln->txbuf);
+	if (ln->rxbuf)
+		metal_free_memory(ln->rxbuf);
+	ln->txbuf = NULL;
+	ln->rxbuf = NULL;
+}
 
-	metal_info("HOST: Start echo flood testing....\n");
-	metal_info("HOST: Sending msgs to the remote.\n");
+static void *lane_thread(void *arg)
+{
+	struct echo_lane_s *ln = arg;
 
-	for (i = 0; i < PKGS_TOTAL; i++) {
-
-		/* Construct a message to send */
-		tmpptr = txbuf;
-		msg_hdr = tmpptr;
-		msg_hdr->index = i;
-		msg_hdr->len = sizeof(tstart);
-		tmpptr += sizeof(struct msg_hdr_s);
-		tstart = platform_gettime();
-		*(unsigned long long *)tmpptr = tstart;
-
-		/* Copy message to shared buffer. */
-		ret = metal_io_block_write(payload_io, tx_data_offset, msg_hdr,
-					   sizeof(struct msg_hdr_s) + msg_hdr->len);
-		if (ret < 0) {
-			metal_err("HOST: Failed to copy message to shared buffer.\n");
-			goto out;
-		}
+	ln->ret = echo_run(ln, ln->len, ln->nums, ln->window, ln->batch,
+			   &ln->res);
+	return NULL;
+}
 
-		/* Write to the address array to tell the other end the buffer address. */
-		tx_phy_addr_32 = (uint32_t)metal_io_phys(payload_io,
-							 tx_data_offset);
-		if (tx_phy_addr_32 == (uint32_t)METAL_BAD_PHYS) {
-			metal_err("HOST: Failed to get offset.\n");
-			ret = -EINVAL;
-			goto out;
+/**
+ * @brief lanes_run() - echo messages on several lanes at once, each served
+ *        by its own thread, pinned to its own CPU from lanes_cpu
+ *
+ * @param[in] lanes - lanes to run, with their results on return
+ * @param[in] n - number of lanes
+ * @param[in] len - payload length of the messages
+ * @param[in] nums - number of messages of each lane
+ * @param[in] window - number of messages in flight of each lane
+ * @param[in] batch - messages published with one kick at most
+ * @return - 0 on success, otherwise the first negative error number
+ */
+static int lanes_run(struct echo_lane_s *lanes, unsigned int n, uint32_t len,
+		     uint32_t nums, uint32_t window, uint32_t batch)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct echo_lane_s *ln;
+	unsigned int i, started;
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int ret = 0;
+
+	if (ncpus < 1)
+		ncpus = 1;
+	for (started = 0; started < n; started++) {
+		ln = &lanes[started];
+		ln->len = len;
+		ln->nums = nums;
+		ln->window = window;
+		ln->batch = batch;
+		pthread_attr_init(&attr);
+		if (lanes_cpu >= 0) {
+			CPU_ZERO(&cpus);
+			CPU_SET((lanes_cpu + started) % ncpus, &cpus);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		}
+		ret = -pthread_create(&ln->thread, &attr, lane_thread, ln);
+		pthread_attr_destroy(&attr);
+		if (ret) {
+			metal_err("HOST: Failed to start the lane %u thread.\n",
+				  started);
+			break;
 		}
+	}
 
-		metal_io_write32(desc_host_to_remote, tx_addr_offset, tx_phy_addr_32);
-		tx_data_offset += sizeof(struct msg_hdr_s) + msg_hdr->len;
-		tx_addr_offset += sizeof(uint32_t);
-		if (tx_addr_offset >= H_TO_R_DESC_ADDR_END)
-			tx_addr_offset = H_TO_R_DESC_ADDR_START;
+	for (i = 0; i < started; i++) {
+		pthread_join(lanes[i].thread, NULL);
+		if (!ret)
+			ret = lanes[i].ret;
+	}
+	return ret;
+}
 
-		/* Increase number of available buffers */
-		metal_io_write32(desc_host_to_remote, tx_avail_offset, (i + 1));
-		/* Kick IRQ to notify data has been put to shared buffer */
-		irq_kick(ch);
+/**
+ * @brief irq_shmem_measure() - latency and throughput measurements
+ *        For each payload size, runs on the first lane a closed loop
+ *        latency phase, one message at a time, then an open loop
+ *        throughput phase, with as many messages in flight as the payload
+ *        ring holds or the given window. With several lanes, the aggregate
+ *        throughput of 1 to nlanes lanes at once follows, for the smallest
+ *        and the largest payload.
+ *
+ * @param[in] lanes - lanes to use
+ * @param[in] nlanes - number of lanes
+ * @param[in] nums - number of messages per phase and lane
+ * @param[in] window - number of messages in flight of the throughput
+ *            phase, 0 for the most the payload ring holds
+ * @param[in] batch - messages published with one kick at most in the
+ *            throughput phase, 0 for the whole window
+ * @return - 0 on success, otherwise a negative error number
+ */
+static int irq_shmem_measure(struct echo_lane_s *lanes, unsigned int nlanes,
+			     uint32_t nums, uint32_t window, uint32_t batch)
+{
+	static const uint32_t agg_lens[] = { PAYLOAD_SIZE_MIN, PAYLOAD_SIZE_MAX };
+	struct echo_result_s *res = &lanes[0].res;
+	unsigned long long first, last, end, msgs;
+	uint32_t len, next_len, win;
+	unsigned long kicks;
+	unsigned int i, l, n;
+	uint64_t avg;
+	int ret = 0;
+
+	res->hist = metal_allocate_memory(sizeof(*res->hist));
+	if (!res->hist) {
+		metal_err("HOST: Failed to allocate the histogram.\n");
+		return -ENOMEM;
 	}
-	metal_info("HOST: Waiting for messages to echo back and verify.\n");
-	i = 0;
-	tx_data_offset = H_TO_R_PAYLOAD_START;
-
-	while (i != PKGS_TOTAL) {
-
-		wait_for_notified(&ch->remote_nkicked);
-
-		rx_avail = metal_io_read32(desc_remote_to_host, rx_avail_offset);
-		while (i != rx_avail) {
-			uint32_t rx_phy_addr_32;
-
-			/* Received pong from the other side */
-
-			/*
-			 * Get the buffer location from the shared memory RX address array.
-			 */
-			rx_phy_addr_32 = metal_io_read32(desc_remote_to_host,
-							 rx_addr_offset);
-			rx_data_offset = metal_io_phys_to_offset(payload_io,
-								 (metal_phys_addr_t)rx_phy_addr_32);
-			if (rx_data_offset == METAL_BAD_OFFSET) {
-				metal_err("HOST: failed to get rx [%d] offset: 0x%x.\n",
-					  i, rx_phy_addr_32);
-				ret = -EINVAL;
-				goto out;
-			}
-			rx_addr_offset += sizeof(rx_phy_addr_32);
 
-			/* Read message header from shared memory */
-			ret = metal_io_block_read(payload_io, rx_data_offset, rxbuf,
-						  sizeof(struct msg_hdr_s));
-			if (ret < 0) {
-				metal_err("HOST: Failed to read from shared memory.\n");
-				goto out;
-			}
+	win = H_TO_R_DESC_NUM;
+	if (window && window < win)
+		win = window;
 
-			msg_hdr = (struct msg_hdr_s *)rxbuf;
+	metal_info("HOST: %u messages per phase, round trip times in ns\n",
+		   nums);
+	for (len = PAYLOAD_SIZE_MIN; len <= PAYLOAD_SIZE_MAX; len = next_len) {
+		ret = lanes_run(lanes, 1, len, nums, 1, 0);
+		if (ret)
+			goto out;
+		avg = res->rtt.st_sum / res->rtt.st_cnt;
+		metal_info("HOST: size %u latency: min %llu avg %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+			   len,
+			   (unsigned long long)res->rtt.st_min,
+			   (unsigned long long)avg,
+			   (unsigned long long)latency_hist_value_at(res->hist, 500000),
+			   (unsigned long long)latency_hist_value_at(res->hist, 900000),
+			   (unsigned long long)latency_hist_value_at(res->hist, 990000),
+			   (unsigned long long)latency_hist_value_at(res->hist, 999000),
+			   (unsigned long long)res->rtt.st_max);
+
+		ret = lanes_run(lanes, 1, len, nums, win, batch);
+		if (ret)
+			goto out;
+		/* A coarse or stopped timer measures no time at all */
+		if (!res->elapsed)
+			metal_err("HOST: size %u throughput: no elapsed time, check the timer\n",
+				  len);
+		else
+			metal_info("HOST: size %u throughput: window %u, ring full %lu, kicks/msg %.3f, waits/msg %.3f, %llu msgs/s, %llu KB/s, rtt avg %llu max %llu\n",
+				   len, win, res->full,
+				   (double)res->kicks / nums,
+				   (double)res->waits / nums,
+				   (unsigned long long)nums * NS_PER_S /
+				   res->elapsed,
+				   (unsigned long long)nums * len *
+				   (NS_PER_S / 1000) / res->elapsed,
+				   (unsigned long long)(res->rtt.st_sum /
+							res->rtt.st_cnt),
+				   (unsigned long long)res->rtt.st_max);
+
+		/* Powers of two, ending on the largest payload */
+		next_len = len * 2;
+		if (len < PAYLOAD_SIZE_MAX && next_len > PAYLOAD_SIZE_MAX)
+			next_len = PAYLOAD_SIZE_MAX;
+	}
 
-			/* Check if the message header is valid */
-			if (msg_hdr->index != (uint32_t)i) {
-				metal_err("HOST: wrong msg: expected: %d, actual: %d\n",
-					  i, msg_hdr->index);
-				ret = -EINVAL;
+	/* Aggregate throughput, from the first lane start to the last end */
+	for (l = 0; nlanes > 1 && l < sizeof(agg_lens) / sizeof(agg_lens[0]); l++) {
+		len = agg_lens[l];
+		for (n = 1; n <= nlanes; n++) {
+			ret = lanes_run(lanes, n, len, nums, win, batch);
+			if (ret)
 				goto out;
+			first = lanes[0].res.tstart;
+			last = first + lanes[0].res.elapsed;
+			kicks = 0;
+			for (i = 0; i < n; i++) {
+				end = lanes[i].res.tstart + lanes[i].res.elapsed;
+				if (lanes[i].res.tstart < first)
+					first = lanes[i].res.tstart;
+				if (end > last)
+					last = end;
+				kicks += lanes[i].res.kicks;
 			}
-			if (msg_hdr->len != sizeof(tstart)) {
-				metal_err("HOST: wrong msg: length invalid: %lu, %u.\n",
-					  sizeof(tstart), msg_hdr->len);
-				ret = -EINVAL;
-				goto out;
-			}
-			/* Read message */
-			rx_data_offset += sizeof(*msg_hdr);
-			ret = metal_io_block_read(payload_io,
-						  rx_data_offset,
-						  rxbuf + sizeof(*msg_hdr), msg_hdr->len);
-			if (ret < 0) {
-				metal_err("HOST: Failed to read from shared memory.\n");
-				goto out;
+			msgs = (unsigned long long)n * nums;
+			if (last == first) {
+				metal_err("HOST: size %u channels %u throughput: no elapsed time, check the timer\n",
+					  len, n);
+				continue;
 			}
+			metal_info("HOST: size %u channels %u throughput: window %u, kicks/msg %.3f, %llu msgs/s, %llu KB/s\n",
+				   len, n, win, (double)kicks / msgs,
+				   msgs * NS_PER_S / (last - first),
+				   msgs * len * (NS_PER_S / 1000) /
+				   (last - first));
+		}
+	}
 
-			rx_data_offset += msg_hdr->len;
-			/*
-			 * Increase RX used count to indicate it has consumed the received data.
-			 */
-			metal_io_write32(desc_remote_to_host, rx_used_offset, (i + 1));
-
-			/* Verify message */
-			/* Get tx message previously sent*/
-			ret = metal_io_block_read(payload_io, tx_data_offset, txbuf,
-						  sizeof(*msg_hdr) + sizeof(tstart));
-			if (ret < 0) {
-				metal_err("HOST: Failed to read tx data.\n");
-				goto out;
-			}
+out:
+	metal_free_memory(res->hist);
+	res->hist = NULL;
+	return ret;
+}
 
-			tx_data_offset += sizeof(*msg_hdr) + sizeof(tstart);
-			/* Compare the received message and the sent message */
-			ret = memcmp(rxbuf, txbuf, sizeof(*msg_hdr) + sizeof(tstart));
-			if (ret) {
-				metal_err("HOST: data[%u] verification failed.\n", i);
-				metal_info("HOST: Expected:");
-				dump_buffer(txbuf,	sizeof(*msg_hdr) + sizeof(tstart));
-				metal_info("HOST: Actual:");
-				dump_buffer(rxbuf, sizeof(*msg_hdr) + sizeof(tstart));
-				ret = -EINVAL;
-				goto out;
-			}
+/**
+ * @brief   irq_shmem_echo() - shared memory IRQ demo
+ *          This task will, on each lane at once:
+ *          * Get the timestamp and put it into the ping shared memory
+ *          * Update the shared memory descriptor for the new available
+ *            ping buffer.
+ *          * Trigger IRQ to notifty the remote.
+ *          * Repeat the above steps until it sends out all the packages.
+ *          * Monitor IRQ interrupt, verify every received package.
+ *
+ * @param[in] lanes - lanes to use
+ * @param[in] nlanes - number of lanes
+ * @return - return 0 on success, otherwise return error number indicating
+ *           type of error.
+ */
+static int irq_shmem_echo(struct echo_lane_s *lanes, unsigned int nlanes)
+{
+	struct echo_result_s *res;
+	unsigned int i;
+	int ret;
 
-			i++;
-		}
+	metal_info("HOST: Start echo flood testing....\n");
+	metal_info("HOST: Sending msgs to the remote.\n");
+
+	/*
+	 * As many packages as the payload ring holds are sent before their
+	 * echoes are verified
+	 */
+	ret = lanes_run(lanes, nlanes, PAYLOAD_SIZE_MIN, PKGS_TOTAL,
+			H_TO_R_DESC_NUM, 0);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nlanes; i++) {
+		res = &lanes[i].res;
+		metal_info("HOST: Channel %u total packages: %u, rtt min %lluns, avg %lluns, max %lluns, total %lluns\n",
+			   i, lanes[i].rxq.count,
+			   (unsigned long long)res->rtt.st_min,
+			   (unsigned long long)(res->rtt.st_sum / res->rtt.st_cnt),
+			   (unsigned long long)res->rtt.st_max, res->elapsed);
 	}
-	tend = platform_gettime();
-	tdiff = tend - tstart;
+	return 0;
+}
 
-	/* Send shutdown message */
-	tmpptr = txbuf;
-	msg_hdr = tmpptr;
-	msg_hdr->index = i;
-	msg_hdr->len = strlen(SHUTDOWN);
-	tmpptr += sizeof(struct msg_hdr_s);
-	sprintf(tmpptr, SHUTDOWN);
-	/* copy message to shared buffer */
-	ret = metal_io_block_write(payload_io, tx_data_offset, msg_hdr,
-				   sizeof(struct msg_hdr_s) + msg_hdr->len);
-	if (ret < 0) {
-		metal_err("HOST: Failed to write to tx data.\n");
-		goto out;
+/**
+ * @brief irq_shmem_run() - run the demo on the first lanes, then send the
+ *        shutdown message on all the channels, the remote serving them all
+ *
+ * @param[in] ch - PLATFORM_CHANNELS channels
+ * @param[in] nlanes - number of lanes to run the demo on
+ * @param[in] measure - measure instead of the echo flood
+ * @param[in] nums - number of messages per phase and lane
+ * @param[in] window - number of messages in flight of the throughput phase
+ * @param[in] batch - messages published with one kick at most
+ * @return - 0 on success, otherwise a negative error number
+ */
+static int irq_shmem_run(struct channel_s *ch, unsigned int nlanes,
+			 int measure, uint32_t nums, uint32_t window,
+			 uint32_t batch)
+{
+	struct echo_lane_s lanes[PLATFORM_CHANNELS];
+	unsigned int i;
+	int ret = 0, err;
+
+	for (i = 0; i < PLATFORM_CHANNELS; i++) {
+		err = lane_init(&lanes[i], &ch[i]);
+		if (err && !ret)
+			ret = err;
 	}
+	if (ret)
+		goto out;
 
-	tx_phy_addr_32 = (uint32_t)metal_io_phys(payload_io, tx_data_offset);
-	if (tx_phy_addr_32 == (uint32_t)METAL_BAD_PHYS) {
-		metal_err("HOST: failed to get offset.\n");
-		ret = -EINVAL;
+	if (measure)
+		ret = irq_shmem_measure(lanes, nlanes, nums, window, batch);
+	else
+		ret = irq_shmem_echo(lanes, nlanes);
+	if (ret)
 		goto out;
-	}
 
-	metal_io_write32(desc_host_to_remote, tx_addr_offset, tx_phy_addr_32);
-	metal_io_write32(desc_host_to_remote, tx_avail_offset, PKGS_TOTAL + 1);
 	metal_info("HOST: Kick remote to notify shutdown message sent...\n");
-	irq_kick(ch);
+	for (i = 0; i < PLATFORM_CHANNELS && !ret; i++)
+		ret = send_shutdown(&lanes[i]);
 
-	tdiff /= PKGS_TOTAL;
-	tdiff_avg_s = tdiff / NS_PER_S;
-	tdiff_avg_ns = tdiff % NS_PER_S;
-	metal_info("HOST: Total packages: %d, time_avg = %lds, %ldns\n",
-		   i, (long int)tdiff_avg_s, (long int)tdiff_avg_ns);
-
-	ret = 0;
 out:
-	if (txbuf)
-		metal_free_memory(txbuf);
-	if (rxbuf)
-		metal_free_memory(rxbuf);
+	for (i = 0; i < PLATFORM_CHANNELS; i++)
+		lane_cleanup(&lanes[i]);
 
 	return ret;
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
-	struct channel_s ch_s;
-	int ret = 0;
+	uint32_t nums = PKGS_TOTAL, window = 0, batch = 0;
+	struct channel_s ch_s[PLATFORM_CHANNELS];
+	unsigned int nlanes = PLATFORM_CHANNELS;
+	int measure = 0;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "mn:w:b:c:p:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			measure = 1;
+			break;
+		case 'n':
+			nums = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			nlanes = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			lanes_cpu = strtol(optarg, NULL, 0);
+			break;
+		default:
+			printf("usage: %s [-c channels] [-p cpu] [-m [-n msgs] [-w window] [-b batch]]\n",
+			       argv[0]);
+			return -EINVAL;
+		}
+	}
+	if (!nums) {
+		metal_err("HOST: Invalid number of messages.\n");
+		return -EINVAL;
+	}
+	if (!nlanes || nlanes > PLATFORM_CHANNELS) {
+		metal_err("HOST: Invalid number of channels, 1 to %u.\n",
+			  PLATFORM_CHANNELS);
+		return -EINVAL;
+	}
 
 	/* platform_init will set the OS agnostic channel information */
-	ret = platform_init(&ch_s);
+	ret = platform_init(ch_s);
 	if (ret) {
 		metal_err("HOST: Failed to initialize system.\n");
 		return ret;
 	}
 
-	metal_info("HOST: IRQ and shared memory\n");
-	ret = irq_shmem_echo(&ch_s);
-	platform_cleanup(&ch_s);
+	metal_info("HOST: IRQ and shared memory, %u of %u channels\n", nlanes,
+		   PLATFORM_CHANNELS);
+	ret = irq_shmem_run(ch_s, nlanes, measure, nums, window, batch);
+	platform_cleanup(ch_s);
 	return ret;
 }
@@ -16,6 +16,7 @@
 #include <stdbool.h>
 
 #include "common.h"
+#include "../shm_ring.h"
 
 #define BUF_SIZE_MAX 512
 #define SHUTDOWN "shutdown"
@@ -29,6 +30,8 @@
 #define SHM_DESC_AVAIL_OFFSET 0x00
 #define SHM_DESC_USED_OFFSET  0x04
 #define SHM_DESC_ADDR_ARRAY_OFFSET 0x08
+/* Event index, last word of a descriptor area */
+#define SHM_DESC_EVENT_OFFSET(size) ((size) - sizeof(uint32_t))
 
 /* Descriptor 0 (Host to Remote) resides at SHM0_DESC_OFFSET.
  * Descriptor 1 (Remote to Host) resides at SHM1_DESC_OFFSET.
@@ -45,183 +48,382 @@
 #define H_TO_R_DESC_ADDR_START \
 	(SHM_DESC_OFFSET_H_TO_R + SHM_DESC_ADDR_ARRAY_OFFSET)
 #define H_TO_R_DESC_ADDR_END \
-	(SHM_DESC_OFFSET_H_TO_R + SHM0_DESC_SIZE)
+	(SHM_DESC_OFFSET_H_TO_R + SHM_DESC_EVENT_OFFSET(SHM0_DESC_SIZE))
 #define R_TO_H_DESC_ADDR_START \
 	(SHM_DESC_OFFSET_R_TO_H + SHM_DESC_ADDR_ARRAY_OFFSET)
 #define R_TO_H_DESC_ADDR_END \
-	(SHM_DESC_OFFSET_R_TO_H + SHM1_DESC_SIZE)
+	(SHM_DESC_OFFSET_R_TO_H + SHM_DESC_EVENT_OFFSET(SHM1_DESC_SIZE))
 
 #define H_TO_R_PAYLOAD_START   SHM_PAYLOAD_H_TO_R
 #define H_TO_R_PAYLOAD_END     (SHM_PAYLOAD_H_TO_R + SHM_PAYLOAD_HALF_SIZE)
 #define R_TO_H_PAYLOAD_START   SHM_PAYLOAD_R_TO_H
 #define R_TO_H_PAYLOAD_END     (SHM_PAYLOAD_R_TO_H + SHM_PAYLOAD_HALF_SIZE)
+
+/* Number of buffers of the remote to host address array */
+#define R_TO_H_DESC_NUM \
+	((R_TO_H_DESC_ADDR_END - R_TO_H_DESC_ADDR_START) / sizeof(uint32_t))
 #define PKGS_TOTAL 1024
 
+/*
+ * With IRQ_SHMEM_ZERO_COPY, the messages are echoed in place: the address
+ * of the host buffer is forwarded to the remote to host address array, and
+ * only the header is read, so that the cost of an echo does not depend on
+ * the payload size. The host reclaims its buffers once their echo is
+ * received.
+ */
+#ifdef IRQ_SHMEM_ZERO_COPY
+#define ZERO_COPY_ECHO true
+#else
+#define ZERO_COPY_ECHO false
+#endif
+
+/* State of the remote to host direction */
+struct tx_queue_s {
+	struct shm_ring_s ring; /* payload ring */
+	unsigned long addr_offset; /* next entry of the address array */
+	uint32_t count; /* number of echoes written */
+	uint32_t avail; /* number of echoes published to the host */
+	unsigned long kicks; /* kicks of the host */
+};
+
 /**
- * @brief   demo() - shared memory IRQ demo
- *	  This task will:
- *	  * Wait for an IRQ interrupt from the host.
- *	  * Copy the ping buffer into the pong buffer after each notification.
- *	  * Update the shared memory descriptor for the new available pong buffer.
- *	  * Trigger an IRQ to notify the host.
+ * @brief tx_publish() - make the written echoes available to the host and
+ *        kick it if it waits for one of them
+ *
  * @param[in] ch - channel structure
- * @return - return 0 on success, otherwise return error number indicating
- *		 type of error.
+ * @param[in] txq - remote to host queue
  */
-int demo(void *arg)
+static void tx_publish(struct channel_s *ch, struct tx_queue_s *txq)
 {
-	unsigned long tx_data_offset, rx_data_offset, rx_used_offset;
-	unsigned long tx_avail_offset, rx_avail_offset;
-	unsigned long tx_addr_offset, rx_addr_offset;
-	struct channel_s ch_s = {0x0};
-	struct channel_s *ch = &ch_s;
-	bool platform_ready = false;
-	uint32_t rx_count, rx_avail;
-	struct msg_hdr_s *msg_hdr;
-	void *lbuf = NULL;
-	char *payload;
-	int ret = 0;
-
-	/* platform_init will set the OS agnostic channel information */
-	ret = platform_init(ch);
-	if (ret) {
-		metal_err("REMOTE: Failed to initialize system.\n");
-		goto out;
-	}
-
-	platform_ready = true;
-
-	/* OS specific setup for system suspend/resume done here. */
-	ret = amp_os_init(ch, arg);
-	if (ret) {
-		metal_err("REMOTE: Failed to set task to system.\n");
-		goto out;
+	uint32_t old_avail = txq->avail, event;
+
+	if (txq->count == old_avail)
+		return;
+
+	/* Increase number of available buffers. */
+	txq->avail = txq->count;
+	metal_io_write32(ch->shm_io,
+			 SHM_DESC_OFFSET_R_TO_H + SHM_DESC_AVAIL_OFFSET,
+			 txq->avail);
+	/* Kick IRQ only if the host has drained and waits for data. */
+	event = metal_io_read32(ch->shm_io, SHM_DESC_OFFSET_R_TO_H +
+				SHM_DESC_EVENT_OFFSET(SHM1_DESC_SIZE));
+	if (shm_need_kick(event, txq->avail, old_avail)) {
+		irq_kick(ch);
+		txq->kicks++;
 	}
+}
 
-	metal_info("REMOTE: IRQ and shared memory\n");
+/**
+ * @brief tx_alloc() - find room for the next echo in the remote to host
+ *        payload ring, waiting for the host to use the older ones
+ *
+ * The echoes written so far are published before waiting: the host uses
+ * the echoes published to it, so the wait always ends.
+ *
+ * @param[in] ch - channel structure
+ * @param[in] txq - remote to host queue
+ * @param[in] len - length of the echo, header included, 0 for an echo in
+ *            place which only takes an address array entry
+ * @return - payload offset of the echo, 0 for an echo in place, or
+ *           METAL_BAD_OFFSET
+ */
+static unsigned long tx_alloc(struct channel_s *ch, struct tx_queue_s *txq,
+			      unsigned long len)
+{
+	unsigned long offset, slot, tail = 0;
+	uint32_t inflight, buf_phy_addr;
+	bool waited = false;
 
-	lbuf = metal_allocate_memory(BUF_SIZE_MAX);
-	if (!lbuf) {
-		metal_err("REMOTE: Failed to allocate local buffer for msg.\n");
-		ret = -ENOMEM;
-		goto out;
+	while (1) {
+		inflight = txq->count - metal_io_read32(ch->shm_io,
+							SHM_DESC_OFFSET_R_TO_H +
+							SHM_DESC_USED_OFFSET);
+		if (!len) {
+			if (inflight < R_TO_H_DESC_NUM)
+				return 0;
+		} else if (inflight && inflight < R_TO_H_DESC_NUM) {
+			slot = shm_ring_tail_slot(txq->addr_offset, inflight,
+						  R_TO_H_DESC_ADDR_START,
+						  R_TO_H_DESC_ADDR_END);
+			buf_phy_addr = metal_io_read32(ch->shm_io, slot);
+			tail = metal_io_phys_to_offset(ch->shm_io,
+						       (metal_phys_addr_t)buf_phy_addr);
+			if (tail == METAL_BAD_OFFSET)
+				return METAL_BAD_OFFSET;
+		}
+		if (len && !shm_ring_alloc(&txq->ring, inflight, tail, len,
+					   &offset))
+			return offset;
+		if (!waited) {
+			txq->ring.full++;
+			tx_publish(ch, txq);
+		}
+		waited = true;
+		metal_cpu_yield();
 	}
+}
 
-	/* Set tx/rx buffer address offset */
-	tx_addr_offset = R_TO_H_DESC_ADDR_START;
-	rx_addr_offset = H_TO_R_DESC_ADDR_START;
-	tx_data_offset = R_TO_H_PAYLOAD_START;
-
-	metal_info("REMOTE: Wait for echo test to start.\n");
-	rx_count = 0;
-	while (1) {
-		system_suspend(ch);
-
-		rx_avail = metal_io_read32(ch->shm_io,
-					   SHM_DESC_OFFSET_H_TO_R +
-					   SHM_DESC_AVAIL_OFFSET);
-		while (rx_count != rx_avail) {
-			uint32_t buf_phy_addr;
-			/* Get the buffer location from the rx addr array. */
-			buf_phy_addr = metal_io_read32(ch->shm_io, rx_addr_offset);
-			rx_data_offset = metal_io_phys_to_offset(ch->shm_io,
-								 (metal_phys_addr_t)buf_phy_addr);
-			if (rx_data_offset == METAL_BAD_OFFSET) {
-				metal_err("REMOTE: [%u]failed to get rx offset: 0x%x, 0x%lx.\n",
-					  rx_count, buf_phy_addr,
-					  metal_io_phys(ch->shm_io, rx_addr_offset));
-				ret = -EINVAL;
-				goto out;
-			}
-			rx_addr_offset += sizeof(buf_phy_addr);
+/* State of a channel served by the demo */
+struct echo_chan_s {
+	struct channel_s *ch;
+	unsigned long rx_addr_offset; /* next entry of the address array */
+	uint32_t rx_count; /* number of messages received */
+	struct tx_queue_s txq; /* remote to host direction */
+	bool done; /* shutdown message received */
+};
 
-			/* Read message header from shared memory */
-			ret = metal_io_block_read(ch->shm_io, rx_data_offset, lbuf,
-						  sizeof(struct msg_hdr_s));
-			if (ret < 0) {
-				metal_err("REMOTE: failed to read message header\n");
-				ret = -EINVAL;
-				goto out;
-			}
+/**
+ * @brief echo_drain() - echo the messages the host published on a channel
+ *        and publish the echoes at once
+ *
+ * @param[in] ec - channel to serve
+ * @param[in] lbuf - local buffer of BUF_SIZE_MAX bytes
+ * @return - number of messages received, otherwise a negative error number
+ */
+static int echo_drain(struct echo_chan_s *ec, void *lbuf)
+{
+	struct channel_s *ch = ec->ch;
+	unsigned long tx_data_offset, rx_data_offset;
+	uint32_t rx_avail, rx_first = ec->rx_count;
+	struct msg_hdr_s *msg_hdr;
+	char *payload;
+	int ret;
+
+	rx_avail = metal_io_read32(ch->shm_io,
+				   SHM_DESC_OFFSET_H_TO_R +
+				   SHM_DESC_AVAIL_OFFSET);
+	while (ec->rx_count != rx_avail) {
+		uint32_t buf_phy_addr;
+		/* Get the buffer location from the rx addr array. */
+		buf_phy_addr = metal_io_read32(ch->shm_io, ec->rx_addr_offset);
+		rx_data_offset = metal_io_phys_to_offset(ch->shm_io,
+							 (metal_phys_addr_t)buf_phy_addr);
+		if (rx_data_offset == METAL_BAD_OFFSET) {
+			metal_err("REMOTE: [%u]failed to get rx offset: 0x%x, 0x%lx.\n",
+				  ec->rx_count, buf_phy_addr,
+				  metal_io_phys(ch->shm_io, ec->rx_addr_offset));
+			return -EINVAL;
+		}
+		ec->rx_addr_offset += sizeof(buf_phy_addr);
+		if (ec->rx_addr_offset >= H_TO_R_DESC_ADDR_END)
+			ec->rx_addr_offset = H_TO_R_DESC_ADDR_START;
+
+		/* Read message header from shared memory */
+		ret = metal_io_block_read(ch->shm_io, rx_data_offset, lbuf,
+					  sizeof(struct msg_hdr_s));
+		if (ret < 0) {
+			metal_err("REMOTE: failed to read message header\n");
+			return -EINVAL;
+		}
 
-			msg_hdr = (struct msg_hdr_s *)lbuf;
+		msg_hdr = (struct msg_hdr_s *)lbuf;
 
-			/* Check if the message header is valid */
-			if (msg_hdr->len > (BUF_SIZE_MAX - sizeof(*msg_hdr))) {
-				metal_err("REMOTE: wrong msg: length invalid: %u, %u.\n",
-					  BUF_SIZE_MAX - sizeof(*msg_hdr), msg_hdr->len);
-				ret = -EINVAL;
-				goto out;
-			}
-			rx_data_offset += sizeof(*msg_hdr);
-			/* Read message body. */
-			ret = metal_io_block_read(ch->shm_io, rx_data_offset,
+		/* Check if the message header is valid */
+		if (msg_hdr->len > (BUF_SIZE_MAX - sizeof(*msg_hdr))) {
+			metal_err("REMOTE: wrong msg: length invalid: %u, %u.\n",
+				  (unsigned int)(BUF_SIZE_MAX - sizeof(*msg_hdr)),
+				  msg_hdr->len);
+			return -EINVAL;
+		}
+		/*
+		 * Read message body, echoing in place only as much as
+		 * could be the shutdown message.
+		 */
+		if (!ZERO_COPY_ECHO || msg_hdr->len == strlen(SHUTDOWN)) {
+			ret = metal_io_block_read(ch->shm_io,
+						  rx_data_offset +
+						  sizeof(*msg_hdr),
 						  lbuf + sizeof(*msg_hdr),
 						  msg_hdr->len);
 			if (ret < 0) {
 				metal_err("REMOTE: failed to read message body\n");
-				ret = -EINVAL;
-				goto out;
+				return -EINVAL;
 			}
+		}
 
-			rx_data_offset += msg_hdr->len;
-			payload = (char *)lbuf + sizeof(*msg_hdr);
-			rx_count++;
-			/* Increase rx used count to indicate received data was used. */
-			metal_io_write32(ch->shm_io,
-					 SHM_DESC_OFFSET_H_TO_R + SHM_DESC_USED_OFFSET,
-					 rx_count);
-
-			/* Check if it is the shutdown message. */
-			if (msg_hdr->len == strlen(SHUTDOWN) && !strncmp(SHUTDOWN,
-									 payload,
-									 strlen(SHUTDOWN))) {
-				metal_info("REMOTE: Received shutdown message\n");
-				ret = 0;
-				goto out;
-			}
-			/* Copy the message back to the other end. */
-			ret = metal_io_block_write(ch->shm_io, tx_data_offset, msg_hdr,
+		payload = (char *)lbuf + sizeof(*msg_hdr);
+		ec->rx_count++;
+		/* Increase rx used count to indicate received data was used. */
+		metal_io_write32(ch->shm_io,
+				 SHM_DESC_OFFSET_H_TO_R + SHM_DESC_USED_OFFSET,
+				 ec->rx_count);
+
+		/* Check if it is the shutdown message. */
+		if (msg_hdr->len == strlen(SHUTDOWN) && !strncmp(SHUTDOWN,
+								 payload,
+								 strlen(SHUTDOWN))) {
+			ec->done = true;
+			break;
+		}
+		/*
+		 * Copy the message back to the other end, in the
+		 * remote to host payload ring, or echo the host buffer
+		 * itself.
+		 */
+		tx_data_offset = tx_alloc(ch, &ec->txq, ZERO_COPY_ECHO ? 0 :
+					  sizeof(struct msg_hdr_s) +
+					  msg_hdr->len);
+		if (tx_data_offset == METAL_BAD_OFFSET) {
+			metal_err("REMOTE: failed to get the ring tail.\n");
+			return -EINVAL;
+		}
+		if (!ZERO_COPY_ECHO) {
+			ret = metal_io_block_write(ch->shm_io, tx_data_offset,
+						   msg_hdr,
 						   sizeof(struct msg_hdr_s) +
 						   msg_hdr->len);
 			if (ret < 0) {
 				metal_err("REMOTE: failed to send message\n");
-				ret = -EINVAL;
-				goto out;
+				return -EINVAL;
 			}
-
-			/* Write to address array to tell host the buffer address. */
 			buf_phy_addr = (uint32_t)metal_io_phys(ch->shm_io,
 							       tx_data_offset);
 			if (buf_phy_addr == METAL_BAD_PHYS) {
 				metal_err("REMOTE: failed to get offset.\n");
-				ret = -EINVAL;
-				goto out;
+				return -EINVAL;
 			}
+			shm_ring_commit(&ec->txq.ring, tx_data_offset,
+					sizeof(struct msg_hdr_s) +
+					msg_hdr->len);
+		}
+
+		/* Write to address array to tell host the buffer address. */
+		metal_io_write32(ch->shm_io, ec->txq.addr_offset, buf_phy_addr);
+		ec->txq.addr_offset += sizeof(uint32_t);
+		if (ec->txq.addr_offset >= R_TO_H_DESC_ADDR_END)
+			ec->txq.addr_offset = R_TO_H_DESC_ADDR_START;
+		ec->txq.count++;
+	}
+
+	/* Publish the echoes of the drained messages with one kick. */
+	tx_publish(ch, &ec->txq);
+	return ec->rx_count - rx_first;
+}
 
-			metal_io_write32(ch->shm_io, tx_addr_offset, buf_phy_addr);
-			tx_data_offset += sizeof(struct msg_hdr_s) + msg_hdr->len;
-			tx_addr_offset += sizeof(uint32_t);
+/**
+ * @brief echo_idle() - ask the host to kick on its next message on a
+ *        channel, then read the avail counter again: a message published
+ *        in between is either seen here or kicked
+ *
+ * @param[in] ec - channel served
+ * @return - true if no message is pending on the channel
+ */
+static bool echo_idle(struct echo_chan_s *ec)
+{
+	struct channel_s *ch = ec->ch;
 
-			/* Increase number of available buffers. */
-			metal_io_write32(ch->shm_io,
-					 SHM_DESC_OFFSET_R_TO_H + SHM_DESC_AVAIL_OFFSET,
-					 rx_count);
+	metal_io_write32(ch->shm_io, SHM_DESC_OFFSET_H_TO_R +
+			 SHM_DESC_EVENT_OFFSET(SHM0_DESC_SIZE), ec->rx_count);
+	return metal_io_read32(ch->shm_io, SHM_DESC_OFFSET_H_TO_R +
+			       SHM_DESC_AVAIL_OFFSET) == ec->rx_count;
+}
 
-			/* Kick IRQ to notify data is in shared buffer. */
-			irq_kick(ch);
+/**
+ * @brief   demo() - shared memory IRQ demo
+ *	  This task will, for each of the PLATFORM_CHANNELS channels in turn:
+ *	  * Copy each ping buffer the host published into a pong buffer.
+ *	  * Update the shared memory descriptor for all the new available pong
+ *	    buffers at once.
+ *	  * Trigger an IRQ to notify the host, if it waits for them.
+ *	  It waits for an IRQ interrupt from the host when no channel has
+ *	  messages left, until the host sent the shutdown message on all of
+ *	  them.
+ * @param[in] ch - channel structure
+ * @return - return 0 on success, otherwise return error number indicating
+ *		 type of error.
+ */
+int demo(void *arg)
+{
+	struct echo_chan_s ec[PLATFORM_CHANNELS];
+	struct channel_s ch_s[PLATFORM_CHANNELS];
+	unsigned int i, active = PLATFORM_CHANNELS;
+	bool platform_ready = false, idle;
+	void *lbuf = NULL;
+	int ret = 0, served;
+
+	memset(ch_s, 0, sizeof(ch_s));
+	memset(ec, 0, sizeof(ec));
+	for (i = 0; i < PLATFORM_CHANNELS; i++) {
+		ec[i].ch = &ch_s[i];
+		ec[i].rx_addr_offset = H_TO_R_DESC_ADDR_START;
+		ec[i].txq.ring = (struct shm_ring_s)
+			SHM_RING_INIT(R_TO_H_PAYLOAD_START, R_TO_H_PAYLOAD_END,
+				      R_TO_H_DESC_NUM);
+		ec[i].txq.addr_offset = R_TO_H_DESC_ADDR_START;
+	}
+
+	/* platform_init will set the OS agnostic channel information */
+	ret = platform_init(ch_s);
+	if (ret) {
+		metal_err("REMOTE: Failed to initialize system.\n");
+		goto out;
+	}
+
+	platform_ready = true;
+
+	/* OS specific setup for system suspend/resume done here. */
+	for (i = 0; i < PLATFORM_CHANNELS; i++) {
+		ret = amp_os_init(&ch_s[i], arg);
+		if (ret) {
+			metal_err("REMOTE: Failed to set task to system.\n");
+			goto out;
 		}
+	}
+
+	metal_info("REMOTE: IRQ and shared memory, %u channels%s\n",
+		   PLATFORM_CHANNELS,
+		   ZERO_COPY_ECHO ? ", zero-copy echo" : "");
 
+	lbuf = metal_allocate_memory(BUF_SIZE_MAX);
+	if (!lbuf) {
+		metal_err("REMOTE: Failed to allocate local buffer for msg.\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	metal_info("REMOTE: Wait for echo test to start.\n");
+	while (active) {
+		served = 0;
+		for (i = 0; i < PLATFORM_CHANNELS; i++) {
+			if (ec[i].done)
+				continue;
+			ret = echo_drain(&ec[i], lbuf);
+			if (ret < 0)
+				goto out;
+			served += ret;
+			if (ec[i].done) {
+				metal_info("REMOTE: Received shutdown message on channel %u\n",
+					   i);
+				active--;
+			}
+		}
+		if (served || !active)
+			continue;
+
+		/* Wait for a kick, unless a message came on any channel */
+		idle = true;
+		for (i = 0; i < PLATFORM_CHANNELS; i++)
+			if (!ec[i].done && !echo_idle(&ec[i]))
+				idle = false;
+		if (idle)
+			system_suspend(&ch_s[0]);
 	}
+	ret = 0;
 
 out:
-	metal_info("REMOTE: IRQ shared memory demo finished with exit code: %i.\n", ret);
+	metal_info("REMOTE: IRQ shared memory demo finished with exit code: %i.\n",
+		   ret);
+	for (i = 0; platform_ready && i < PLATFORM_CHANNELS; i++)
+		metal_info("REMOTE: Channel %u echo ring full %lu times, %lu kicks for %u echoes.\n",
+			   i, ec[i].txq.ring.full, ec[i].txq.kicks,
+			   ec[i].txq.count);
 
 	if (lbuf)
 		metal_free_memory(lbuf);
 
 	if (platform_ready)
-		platform_cleanup(&ch_s);
+		platform_cleanup(ch_s);
 
 	return ret;
 }
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * shm_ring.h - producer side of the payload ring of a direction
+ *
+ * The messages are written contiguously from the head of the payload area,
+ * wrapping to its start when the next message does not fit at its end, and
+ * are reclaimed in order as the consumer increases its used counter: the
+ * oldest message in flight, whose address is still in the descriptor
+ * address array, is the tail of the ring. The producer waits when neither
+ * the payload area nor the address array have room for the next message.
+ *
+ * The producer publishes its messages in batches, one avail counter update
+ * for several messages, and kicks the consumer only when the batch reaches
+ * the event index of the descriptors: the count of used messages written by
+ * the consumer before it waits for a kick. A consumer still draining the
+ * earlier messages has not updated it, so the producer does not kick.
+ */
+
+#ifndef __SHM_RING_H__
+#define __SHM_RING_H__
+
+#include <errno.h>
+#include <stdint.h>
+
+struct shm_ring_s {
+	unsigned long start; /* start of the payload area */
+	unsigned long end; /* end of the payload area */
+	unsigned long head; /* next free payload offset */
+	uint32_t slots; /* entries of the address array */
+	unsigned long full; /* waits of the producer for room */
+};
+
+#define SHM_RING_INIT(s, e, n) \
+	{ .start = (s), .end = (e), .head = (s), .slots = (n), }
+
+/**
+ * @brief shm_ring_tail_slot() - address array entry of the oldest message
+ *        in flight
+ *
+ * @param[in] addr_offset - next entry of the address array
+ * @param[in] inflight - number of messages in flight, at most the entries
+ * @param[in] addr_start - first entry of the address array
+ * @param[in] addr_end - end of the address array
+ * @return - offset of the entry
+ */
+static inline unsigned long shm_ring_tail_slot(unsigned long addr_offset,
+					       uint32_t inflight,
+					       unsigned long addr_start,
+					       unsigned long addr_end)
+{
+	unsigned long span = addr_end - addr_start;
+
+	return addr_start + (addr_offset - addr_start + span -
+			     inflight * sizeof(uint32_t)) % span;
+}
+
+/**
+ * @brief shm_ring_alloc() - find room for the next message
+ *
+ * @param[in] ring - payload ring
+ * @param[in] inflight - number of messages not yet used by the consumer
+ * @param[in] tail - payload offset of the oldest of them, if any
+ * @param[in] len - length of the message, header included
+ * @param[out] offset - payload offset of the message
+ * @return - 0 on success, -EAGAIN if the ring or the address array is full
+ */
+static inline int shm_ring_alloc(struct shm_ring_s *ring, uint32_t inflight,
+				 unsigned long tail, unsigned long len,
+				 unsigned long *offset)
+{
+	if (inflight >= ring->slots)
+		return -EAGAIN;
+	/* All used by the consumer, restart from the start */
+	if (!inflight)
+		ring->head = ring->start;
+
+	if (!inflight || ring->head > tail) {
+		/* Free from the head to the end, then up to the tail */
+		if (ring->head + len <= ring->end) {
+			*offset = ring->head;
+			return 0;
+		}
+		if (ring->start + len <= (inflight ? tail : ring->end)) {
+			*offset = ring->start;
+			return 0;
+		}
+	} else if (ring->head + len <= tail) {
+		/* Wrapped, free from the head up to the tail */
+		*offset = ring->head;
+		return 0;
+	}
+	return -EAGAIN;
+}
+
+/**
+ * @brief shm_ring_commit() - advance the head past a written message
+ *
+ * @param[in] ring - payload ring
+ * @param[in] offset - payload offset of the message, from shm_ring_alloc()
+ * @param[in] len - length of the message, header included
+ */
+static inline void shm_ring_commit(struct shm_ring_s *ring,
+				   unsigned long offset, unsigned long len)
+{
+	ring->head = offset + len;
+}
+
+/**
+ * @brief shm_need_kick() - whether publishing messages needs a kick
+ *
+ * The counters wrap, so the event index is compared with the published
+ * messages by their distance from the new avail counter.
+ *
+ * @param[in] event - event index written by the consumer
+ * @param[in] new_avail - avail counter after the publish
+ * @param[in] old_avail - avail counter before the publish
+ * @return - non zero if the consumer waits for one of the published messages
+ */
+static inline int shm_need_kick(uint32_t event, uint32_t new_avail,
+				uint32_t old_avail)
+{
+	return (uint32_t)(new_avail - event - 1) <
+	       (uint32_t)(new_avail - old_avail);
+}
+
+#endif /* __SHM_RING_H__ */
@@ -17,6 +17,7 @@
 #include <stdio.h>
 
 #include "config.h"
+#include "latency_hist.h"
 
 /*
  * Apply this snippet to the device tree in an overlay so that Linux userspace can
@@ -113,6 +114,9 @@ static inline void update_stat(struct metal_stat *pst, uint64_t val)
 		pst->st_max = val;
 }
 
+/* Channels of the platform: one pair of descriptors and one IPI mask */
+#define PLATFORM_CHANNELS 1
+
 struct channel_s {
 	struct metal_io_region *host_to_remote_desc_io; /* host to remote descriptors */
 	struct metal_io_region *remote_to_host_desc_io; /* remote to host descriptors */
@@ -9,6 +9,7 @@
 
 #include "platform_init.h"
 
+/* Both take an array of the PLATFORM_CHANNELS channels of the machine */
 int platform_init(struct channel_s *ch);
 void platform_cleanup(struct channel_s *ch);
 
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef __COMMON_H__
+#define __COMMON_H__
+
+#include <sys/types.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <metal/atomic.h>
+#include <metal/assert.h>
+#include <metal/cpu.h>
+#include <metal/io.h>
+#include <metal/irq.h>
+
+#include <stdio.h>
+
+#include "config.h"
+#include "latency_hist.h"
+
+/*
+ * Doorbells, in the doorbells page: each one is a counter of the kicks,
+ * incremented by the side kicking, and waited on with a futex by the side
+ * kicked, in place of the IPI. Each channel has its own pair, the remote
+ * being woken up through one IRQ counter rung with them all, as one IPI
+ * interrupt with a mask per channel.
+ */
+#define SIM_DOORBELL_H_TO_R 0x0 /* host to remote doorbell offset */
+#define SIM_DOORBELL_R_TO_H 0x4 /* remote to host doorbell offset */
+#define SIM_DOORBELL_STRIDE 0x8 /* doorbells of a channel */
+#define SIM_DOORBELL_REMOTE_IRQ (SIM_DOORBELL_SIZE - 0x4) /* remote IRQ */
+
+/* Channels of the platform */
+#define PLATFORM_CHANNELS SIM_CHANNELS
+
+/**
+ * @brief platform_gettime() - return platform-specific timestamp in ns
+ */
+unsigned long long platform_gettime(void);
+
+/**
+ * basic statistics
+ */
+struct metal_stat {
+	uint64_t st_cnt;
+	uint64_t st_sum;
+	uint64_t st_min;
+	uint64_t st_max;
+};
+#define STAT_INIT { .st_cnt = 0, .st_sum = 0, .st_min = ~0UL, .st_max = 0, }
+
+/**
+ * @brief update_stat() - update basic statistics
+ *
+ * @param[in] pst   - pointer to the struct stat
+ * @param[in] val - the value for the update
+ */
+static inline void update_stat(struct metal_stat *pst, uint64_t val)
+{
+	pst->st_cnt++;
+	pst->st_sum += val;
+	if (pst->st_min > val)
+		pst->st_min = val;
+	if (pst->st_max < val)
+		pst->st_max = val;
+}
+
+struct channel_s {
+	struct metal_io_region *host_to_remote_desc_io; /* host to remote descriptors */
+	struct metal_io_region *remote_to_host_desc_io; /* remote to host descriptors */
+	struct metal_io_region *ipi_io; /* Channel doorbells metal i/o region */
+	struct metal_io_region *shm_io; /* Shared memory metal i/o region */
+	struct metal_io_region *ttc_io; /* Unused, the time is CLOCK_MONOTONIC_RAW */
+	atomic_flag remote_nkicked; /* IRQ kick flag */
+	atomic_uint *remote_irq; /* Remote IRQ counter, of all the channels */
+	uint32_t ipi_mask; /* Unused */
+	int irq_vector_id; /* Unused */
+};
+
+/**
+ * @brief sim_doorbell_ring() - ring a doorbell, waking up its waiter
+ *
+ * @param[in] db - pointer to the doorbell
+ */
+static inline void sim_doorbell_ring(atomic_uint *db)
+{
+	atomic_fetch_add(db, 1);
+	syscall(SYS_futex, db, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * @ Linux simulation port for IRQ notification
+ * @param[in] ch - channel to notify the remote on
+ */
+static inline void irq_kick(struct channel_s *ch)
+{
+	atomic_uint *db;
+
+	metal_assert(ch);
+	db = metal_io_virt(ch->ipi_io, SIM_DOORBELL_H_TO_R);
+	atomic_fetch_add(db, 1);
+	sim_doorbell_ring(ch->remote_irq);
+}
+#endif /* __COMMON_H__ */
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Linux simulation of the host platform: the carveouts and the doorbells
+ * of SIM_CHANNELS channels live in a shared memory file mapped by both the
+ * host and the remote processes, a thread per channel waits on its remote
+ * to host doorbell in place of the IPI interrupt, and the time is read from
+ * CLOCK_MONOTONIC_RAW in place of the TTC.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <metal/io.h>
+#include <metal/sys.h>
+#include "common.h"
+#include "platform_init.h"
+
+#define NS_PER_S (1000 * 1000 * 1000)
+
+/* Carveouts and doorbells of a channel */
+struct sim_channel_s {
+	metal_phys_addr_t shm_phys;
+	metal_phys_addr_t h_to_r_desc_phys;
+	metal_phys_addr_t r_to_h_desc_phys;
+	metal_phys_addr_t doorbell_phys;
+	struct metal_io_region shm_io, h_to_r_desc_io, r_to_h_desc_io;
+	struct metal_io_region doorbell_io;
+	pthread_t doorbell_thread;
+	int doorbell_started;
+};
+
+static struct sim_channel_s sim_ch[SIM_CHANNELS];
+static void *shm_va = MAP_FAILED;
+static atomic_int doorbell_stop;
+
+/**
+ * @brief map_shm() - map the shared memory file, creating it if needed
+ *
+ * @return 0 - succeeded, negative errno for failures.
+ */
+static int map_shm(void)
+{
+	const char *path = getenv(SIM_SHM_ENV);
+	int fd, ret = 0;
+
+	if (!path)
+		path = SIM_SHM_PATH;
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		metal_err("HOST: Failed to open %s: %s.\n", path,
+			  strerror(errno));
+		return -errno;
+	}
+	if (ftruncate(fd, SIM_SHM_SIZE)) {
+		ret = -errno;
+		metal_err("HOST: Failed to size %s: %s.\n", path,
+			  strerror(errno));
+		goto out;
+	}
+	shm_va = mmap(NULL, SIM_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      fd, 0);
+	if (shm_va == MAP_FAILED) {
+		ret = -errno;
+		metal_err("HOST: Failed to map %s: %s.\n", path,
+			  strerror(errno));
+	}
+out:
+	close(fd);
+	return ret;
+}
+
+/* Initialize the i/o region of a carveout of the shared memory file */
+static void init_region(struct metal_io_region *io,
+			metal_phys_addr_t *phys, metal_phys_addr_t base,
+			size_t size)
+{
+	*phys = base;
+	metal_io_init(io, (char *)shm_va + (base - SHM0_DESC_BASE), phys,
+		      size, (unsigned int)-1, 0, NULL);
+}
+
+/**
+ * @brief doorbell_wait() - wait for the remote kicks of a channel, as the
+ *        IPI handler
+ *        It clears the kicked flag of the channel on each kick, until
+ *        platform_cleanup().
+ *
+ * @param[in] arg - channel to use
+ */
+static void *doorbell_wait(void *arg)
+{
+	struct channel_s *ch = arg;
+	atomic_uint *db = metal_io_virt(ch->ipi_io, SIM_DOORBELL_R_TO_H);
+	unsigned int seen = atomic_load(db), cur;
+
+	while (!atomic_load(&doorbell_stop)) {
+		cur = atomic_load(db);
+		if (cur == seen) {
+			syscall(SYS_futex, db, FUTEX_WAIT, seen, NULL, NULL, 0);
+			continue;
+		}
+		seen = cur;
+		atomic_flag_clear(&ch->remote_nkicked);
+	}
+	return NULL;
+}
+
+/**
+ * @brief init_channel() - set up a channel from its partition of the file
+ *        and start its doorbell thread
+ *
+ * @param[in] ch - channel to set up
+ * @param[in] id - index of the channel
+ * @return 0 - succeeded, negative errno for failures.
+ */
+static int init_channel(struct channel_s *ch, unsigned int id)
+{
+	struct sim_channel_s *sc = &sim_ch[id];
+	metal_phys_addr_t base = SHM0_DESC_BASE + id * SIM_CHANNEL_SIZE;
+	int ret;
+
+	/* initialize remote_nkicked */
+	ch->remote_nkicked = (atomic_flag)ATOMIC_FLAG_INIT;
+	atomic_flag_test_and_set(&ch->remote_nkicked);
+
+	init_region(&sc->h_to_r_desc_io, &sc->h_to_r_desc_phys, base,
+		    SHM0_DESC_SIZE);
+	init_region(&sc->r_to_h_desc_io, &sc->r_to_h_desc_phys,
+		    base + (SHM1_DESC_BASE - SHM0_DESC_BASE), SHM1_DESC_SIZE);
+	init_region(&sc->shm_io, &sc->shm_phys,
+		    base + (SHM_PAYLOAD_BASE - SHM0_DESC_BASE),
+		    SHM_PAYLOAD_SIZE);
+	/* The doorbells of the channel */
+	init_region(&sc->doorbell_io, &sc->doorbell_phys,
+		    SIM_DOORBELL_BASE + id * SIM_DOORBELL_STRIDE,
+		    SIM_DOORBELL_STRIDE);
+	ch->shm_io = &sc->shm_io;
+	ch->host_to_remote_desc_io = &sc->h_to_r_desc_io;
+	ch->remote_to_host_desc_io = &sc->r_to_h_desc_io;
+	ch->ipi_io = &sc->doorbell_io;
+	ch->remote_irq = (atomic_uint *)((char *)shm_va +
+					 (SIM_DOORBELL_BASE - SHM0_DESC_BASE) +
+					 SIM_DOORBELL_REMOTE_IRQ);
+	ch->irq_vector_id = -1;
+
+	/* Wait for the remote kicks */
+	ret = -pthread_create(&sc->doorbell_thread, NULL, doorbell_wait, ch);
+	if (ret) {
+		metal_err("HOST: Failed to start the channel %u doorbell thread\n",
+			  id);
+		return ret;
+	}
+	sc->doorbell_started = 1;
+	return 0;
+}
+
+int platform_init(struct channel_s *ch)
+{
+	struct metal_init_params init_param = METAL_INIT_DEFAULTS;
+	unsigned int i;
+	int ret;
+
+	metal_assert(ch);
+	memset(ch, 0, PLATFORM_CHANNELS * sizeof(*ch));
+
+	ret = metal_init(&init_param);
+	if (ret) {
+		metal_err("HOST: Failed to initialize libmetal\n");
+		return ret;
+	}
+
+	ret = map_shm();
+	if (ret)
+		goto err;
+
+	atomic_store(&doorbell_stop, 0);
+	for (i = 0; i < PLATFORM_CHANNELS; i++) {
+		ret = init_channel(&ch[i], i);
+		if (ret)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	platform_cleanup(ch);
+	return ret;
+}
+
+void platform_cleanup(struct channel_s *ch)
+{
+	struct sim_channel_s *sc;
+	unsigned int i;
+
+	(void)ch;
+
+	/* Wake the doorbell threads up, for them to see the stop */
+	atomic_store(&doorbell_stop, 1);
+	for (i = 0; i < SIM_CHANNELS; i++) {
+		sc = &sim_ch[i];
+		if (!sc->doorbell_started)
+			continue;
+		sim_doorbell_ring(metal_io_virt(&sc->doorbell_io,
+						SIM_DOORBELL_R_TO_H));
+		pthread_join(sc->doorbell_thread, NULL);
+		sc->doorbell_started = 0;
+	}
+	if (shm_va != MAP_FAILED) {
+		munmap(shm_va, SIM_SHM_SIZE);
+		shm_va = MAP_FAILED;
+	}
+
+	/* Finish libmetal environment */
+	metal_finish();
+}
+
+unsigned long long platform_gettime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (unsigned long long)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
@@ -0,0 +1,16 @@
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef __PLATFORM_INIT_H__
+#define __PLATFORM_INIT_H__
+
+#include "common.h"
+
+/* Both take an array of the PLATFORM_CHANNELS channels of the machine */
+int platform_init(struct channel_s *ch);
+void platform_cleanup(struct channel_s *ch);
+
+#endif /* __PLATFORM_INIT_H__ */
@@ -46,6 +46,9 @@ struct msg_hdr_s {
 	uint32_t len;
 };
 
+/* Channels of the platform: one shared memory window and one IPI mask */
+#define PLATFORM_CHANNELS 1
+
 extern struct metal_device *ipi_dev; /* IPI metal device */
 extern struct metal_device *shm_dev; /* SHM metal device */
 extern struct metal_device *ttc_dev; /* TTC metal device */
@@ -16,6 +16,8 @@ struct channel_s;
  *        register the IPI, shared memory descriptor and shared memory
  *        devices to the libmetal generic bus.
  *
+ * @param[in] ch - array of the PLATFORM_CHANNELS channels
+ *
  * @return 0 - succeeded, non-zero for failures.
  */
 int platform_init(struct channel_s *ch);
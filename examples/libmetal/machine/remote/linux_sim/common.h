@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef __COMMON_H__
+#define __COMMON_H__
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <metal/atomic.h>
+#include <metal/alloc.h>
+#include <metal/assert.h>
+#include <metal/errno.h>
+#include <metal/sys.h>
+#include <metal/cpu.h>
+#include <metal/io.h>
+#include <sys/types.h>
+#include "platform_init.h"
+
+/* This provides the carveout and doorbell definitions */
+#include "config.h"
+
+/*
+ * Doorbells, in the doorbells page: each one is a counter of the kicks,
+ * incremented by the side kicking, and waited on with a futex by the side
+ * kicked, in place of the IPI. Each channel has its own pair, the remote
+ * being woken up through one IRQ counter rung with them all, as one IPI
+ * interrupt with a mask per channel.
+ */
+#define SIM_DOORBELL_H_TO_R 0x0 /* host to remote doorbell offset */
+#define SIM_DOORBELL_R_TO_H 0x4 /* remote to host doorbell offset */
+#define SIM_DOORBELL_STRIDE 0x8 /* doorbells of a channel */
+#define SIM_DOORBELL_REMOTE_IRQ (SIM_DOORBELL_SIZE - 0x4) /* remote IRQ */
+
+/* Channels of the platform */
+#define PLATFORM_CHANNELS SIM_CHANNELS
+
+struct msg_hdr_s {
+	uint32_t index;
+	uint32_t len;
+};
+
+struct channel_s {
+	struct metal_io_region *ipi_io; /* Channel doorbells metal i/o region */
+	struct metal_io_region *shm_io; /* Shared memory metal i/o region */
+	struct metal_io_region *ttc_io; /* Unused, the time is CLOCK_MONOTONIC_RAW */
+	uint32_t ipi_mask;              /* Unused */
+	int irq_vector_id;              /* Unused */
+	atomic_uint *irq;               /* Remote IRQ counter, of all the channels */
+	unsigned int kicks_seen;        /* Host kicks already served */
+};
+
+/**
+ * @brief amp_os_init() - initialize the doorbell wait
+ *
+ * The kicks rung before are ignored, the remote being started first.
+ *
+ * @param[in] ch - remote communication channel
+ * @param[in] arg - unused
+ */
+static inline int amp_os_init(struct channel_s *ch, void *arg)
+{
+	(void)arg;
+
+	metal_assert(ch);
+
+	ch->kicks_seen = atomic_load(ch->irq);
+
+	return 0;
+}
+
+/**
+ * @brief system_suspend() - park the demo loop until the host kicks
+ *
+ * The remote IRQ counter is rung with the doorbells of all the channels, so
+ * any kick ends the wait. The kicks rung while the demo loop was running
+ * return at once, so that none is lost.
+ *
+ * @param[in] ch - remote communication channel
+ */
+static inline void system_suspend(struct channel_s *ch)
+{
+	unsigned int cur;
+
+	metal_assert(ch);
+
+	while ((cur = atomic_load(ch->irq)) == ch->kicks_seen)
+		syscall(SYS_futex, ch->irq, FUTEX_WAIT, cur, NULL, NULL, 0);
+	ch->kicks_seen = cur;
+}
+
+/**
+ * @ Linux simulation port for IRQ notification
+ * @param[in] ch - channel to notify the host on
+ */
+static inline void irq_kick(struct channel_s *ch)
+{
+	atomic_uint *db;
+
+	metal_assert(ch);
+
+	db = metal_io_virt(ch->ipi_io, SIM_DOORBELL_R_TO_H);
+	atomic_fetch_add(db, 1);
+	syscall(SYS_futex, db, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+int demo(void *arg);
+
+#endif /* __COMMON_H__ */
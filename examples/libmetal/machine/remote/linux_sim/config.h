@@ -0,0 +1,37 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+ * Simulated carveout layout, the one of the AMD reference design. The
+ * "physical" addresses are the ones the demos exchange in the descriptors,
+ * each carveout lives at its address minus SHM0_DESC_BASE in the shared
+ * memory file.
+ */
+#define SHM0_DESC_BASE 0x09860000
+#define SHM0_DESC_SIZE 0x4000
+#define SHM1_DESC_BASE 0x09864000
+#define SHM1_DESC_SIZE 0x4000
+#define SHM_PAYLOAD_BASE 0x09868000
+#define SHM_PAYLOAD_SIZE 0x40000
+/* Payload halves, from the descriptor 0 carveout on the remote */
+#define SHM_PAYLOAD_RX_OFFSET 0x8000
+#define SHM_PAYLOAD_TX_OFFSET 0x28000
+#define SHM_PAYLOAD_HALF_SIZE 0x20000
+
+/*
+ * Channels: the carveouts above are the ones of channel 0, each next
+ * channel has the same layout, SIM_CHANNEL_SIZE higher in the file.
+ */
+#define SIM_CHANNELS 4
+#define SIM_CHANNEL_SIZE (SHM0_DESC_SIZE + SHM1_DESC_SIZE + SHM_PAYLOAD_SIZE)
+
+/* Doorbells page, after the carveouts of the last channel */
+#define SIM_DOORBELL_BASE (SHM0_DESC_BASE + SIM_CHANNELS * SIM_CHANNEL_SIZE)
+#define SIM_DOORBELL_SIZE 0x1000
+
+/* Shared memory file, the path can be changed with SIM_SHM_ENV */
+#define SIM_SHM_PATH "/dev/shm/libmetal-irq-shmem-demo"
+#define SIM_SHM_ENV "LIBMETAL_SIM_SHM"
+#define SIM_SHM_SIZE (SIM_DOORBELL_BASE + SIM_DOORBELL_SIZE - SHM0_DESC_BASE)
+
+#endif /* CONFIG_H */
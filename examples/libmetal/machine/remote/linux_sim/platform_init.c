@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Linux simulation of the remote platform: the carveouts and the doorbells
+ * of SIM_CHANNELS channels live in a shared memory file mapped by both the
+ * host and the remote processes, and the remote waits on the remote IRQ
+ * counter, rung with the host to remote doorbells, in place of the IPI
+ * interrupt.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <metal/io.h>
+#include <metal/sys.h>
+
+#include "common.h"
+
+#define SHM_TOTAL_SIZE (SHM0_DESC_SIZE + SHM1_DESC_SIZE + SHM_PAYLOAD_SIZE)
+
+static metal_phys_addr_t shm_phys[SIM_CHANNELS];
+static metal_phys_addr_t doorbell_phys[SIM_CHANNELS];
+
+static struct metal_io_region shm_io[SIM_CHANNELS];
+static struct metal_io_region doorbell_io[SIM_CHANNELS];
+static void *shm_va = MAP_FAILED;
+
+/**
+ * @brief map_shm() - map the shared memory file, creating it if needed
+ *
+ * @return 0 - succeeded, negative errno for failures.
+ */
+static int map_shm(void)
+{
+	const char *path = getenv(SIM_SHM_ENV);
+	int fd, ret = 0;
+
+	if (!path)
+		path = SIM_SHM_PATH;
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		metal_err("REMOTE: Failed to open %s: %s.\n", path,
+			  strerror(errno));
+		return -errno;
+	}
+	if (ftruncate(fd, SIM_SHM_SIZE)) {
+		ret = -errno;
+		metal_err("REMOTE: Failed to size %s: %s.\n", path,
+			  strerror(errno));
+		goto out;
+	}
+	shm_va = mmap(NULL, SIM_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      fd, 0);
+	if (shm_va == MAP_FAILED) {
+		ret = -errno;
+		metal_err("REMOTE: Failed to map %s: %s.\n", path,
+			  strerror(errno));
+	}
+out:
+	close(fd);
+	return ret;
+}
+
+int platform_init(struct channel_s *ch)
+{
+	struct metal_init_params metal_param = METAL_INIT_DEFAULTS;
+	atomic_uint *irq;
+	unsigned int i;
+	char *va;
+	int ret;
+
+	metal_assert(ch);
+
+	ret = metal_init(&metal_param);
+	if (ret) {
+		metal_err("REMOTE: Failed to initialize libmetal\n");
+		return ret;
+	}
+
+	ret = map_shm();
+	if (ret) {
+		metal_finish();
+		return ret;
+	}
+
+	irq = (atomic_uint *)((char *)shm_va +
+			      (SIM_DOORBELL_BASE - SHM0_DESC_BASE) +
+			      SIM_DOORBELL_REMOTE_IRQ);
+	for (i = 0; i < PLATFORM_CHANNELS; i++) {
+		/* The shared memory region spans the descriptors and the payload */
+		shm_phys[i] = SHM0_DESC_BASE + i * SIM_CHANNEL_SIZE;
+		va = (char *)shm_va + i * SIM_CHANNEL_SIZE;
+		metal_io_init(&shm_io[i], va, &shm_phys[i], SHM_TOTAL_SIZE,
+			      (unsigned int)-1, 0, NULL);
+		doorbell_phys[i] = SIM_DOORBELL_BASE + i * SIM_DOORBELL_STRIDE;
+		va = (char *)shm_va + (doorbell_phys[i] - SHM0_DESC_BASE);
+		metal_io_init(&doorbell_io[i], va, &doorbell_phys[i],
+			      SIM_DOORBELL_STRIDE, (unsigned int)-1, 0, NULL);
+
+		/*
+		 * Buffer clean up. Do this at start in case a
+		 * previous run was stopped midway.
+		 */
+		metal_io_block_set(&shm_io[i], 0, 0, SHM_TOTAL_SIZE);
+
+		ch[i].shm_io = &shm_io[i];
+		ch[i].ipi_io = &doorbell_io[i];
+		ch[i].irq = irq;
+		ch[i].irq_vector_id = -1;
+	}
+
+	return 0;
+}
+
+void platform_cleanup(struct channel_s *ch)
+{
+	(void)ch;
+
+	if (shm_va != MAP_FAILED) {
+		munmap(shm_va, SIM_SHM_SIZE);
+		shm_va = MAP_FAILED;
+	}
+	/* Finish libmetal environment */
+	metal_finish();
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2025, Advanced Micro Devices, Inc.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef __PLATFORM_INIT_H__
+#define __PLATFORM_INIT_H__
+
+struct channel_s;
+
+/**
+ * @brief platform_init() - Map the shared memory file.
+ *        This function initializes libmetal, maps the shared memory file
+ *        and sets the shared memory and doorbell i/o regions of the
+ *        channels.
+ *
+ * @param[in] ch - array of the PLATFORM_CHANNELS channels
+ * @return 0 - succeeded, non-zero for failures.
+ */
+int platform_init(struct channel_s *ch);
+
+/**
+ * @brief platform_cleanup() - system cleanup
+ *        This function unmaps the shared memory file and finishes the
+ *        libmetal environment.
+ */
+void platform_cleanup(struct channel_s *ch);
+
+#endif /* __PLATFORM_INIT_H__ */
@@ -10,12 +10,17 @@
  * The application sends chunks of data to the
  * remote processor. The remote side echoes the data back
  * to application which then app validates the data returned.
+ *
+ * The replies are waited for with poll(), and up to a window of messages
+ * are kept in flight, so that the round trip times and the throughput
+ * reported are the ones of the rpmsg char device.
  */
 
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <poll.h>
 #include <unistd.h>
 #include <time.h>
 #include <fcntl.h>
@@ -39,11 +44,25 @@ struct _payload {
 #define PAYLOAD_MIN_SIZE	1
 #define PAYLOAD_MAX_SIZE	(MAX_RPMSG_BUFF_SIZE - 24)
 #define NUM_PAYLOADS		(PAYLOAD_MAX_SIZE/PAYLOAD_MIN_SIZE)
+#define PAYLOAD_HDR_SIZE	(2 * sizeof(unsigned long))
+#define PAYLOAD_PATTERN		0xA5
+
+#define WINDOW_MAX		NUM_PAYLOADS
+#define TIMEOUT_DEF_MS		1000
+#define NS_PER_S		1000000000ULL
 
 #define RPMSG_BUS_SYS "/sys/bus/rpmsg"
 
 #define PR_DBG(fmt, args ...) printf("%s():%u "fmt, __func__, __LINE__, ##args)
 #define SHUTDOWN_MSG    0xEF56A55A
+
+struct echo_stats {
+	unsigned long long *lat;	/* round trip times in ns */
+	unsigned long nlat;
+	unsigned long long bytes;	/* bytes echoed */
+	int err_cnt;
+};
+
 void send_shutdown(int fd)
 {
 	union {
@@ -65,21 +84,202 @@ void print_help(void)
 {
 	extern char *__progname;
 
-	printf("\r\nusage: %s [option: -d, -c, -n, -s, -e]\r\n", __progname);
+	printf("\r\nusage: %s [option: -d, -c, -n, -s, -e, -w, -t, -v]\r\n",
+	       __progname);
 	printf("-d - rpmsg device name\r\n");
 	printf("-c - rpmsg control device name\r\n");
 	printf("-n - number of times payload will be sent\r\n");
 	printf("-s - source end point address\r\n");
 	printf("-e - destination end point address\r\n");
+	printf("-w - number of messages in flight, 1 to %d (default 1)\r\n",
+	       WINDOW_MAX);
+	printf("-t - timeout waiting for the remote in ms (default %d)\r\n",
+	       TIMEOUT_DEF_MS);
+	printf("-v - print each message sent and received\r\n");
 	printf("\r\n");
 }
 
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/* Wait for events on fd, return the events received or a negative errno */
+static int wait_fd(int fd, short events, int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		perror("poll");
+		return -errno;
+	}
+	if (!ret) {
+		fprintf(stderr, "no reply from the remote in %d ms\n", timeout);
+		return -ETIMEDOUT;
+	}
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		fprintf(stderr, "poll: error on the endpoint\n");
+		return -EIO;
+	}
+	return pfd.revents;
+}
+
+/* Validate a reply, return the number of errors found */
+static int check_payload(struct _payload *r_payload, int bytes_rcvd,
+			 unsigned long num)
+{
+	unsigned char *data = (unsigned char *)r_payload->data;
+	unsigned long k;
+
+	if (r_payload->num != num) {
+		printf("\r\n Expected payload number %lu, got %lu\r\n",
+		       num, r_payload->num);
+		return 1;
+	}
+	if (r_payload->size != PAYLOAD_MIN_SIZE + num ||
+	    (unsigned long)bytes_rcvd != PAYLOAD_HDR_SIZE + r_payload->size) {
+		printf("\r\n Payload number %lu: bad size %lu, %d bytes\r\n",
+		       num, r_payload->size, bytes_rcvd);
+		return 1;
+	}
+	/* Validate data buffer integrity. */
+	for (k = 0; k < r_payload->size; k++) {
+		if (data[k] != PAYLOAD_PATTERN) {
+			printf(" \r\n Data corruption");
+			printf(" at index %lu \r\n", k);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Send the NUM_PAYLOADS payloads of a round, keeping up to window of them
+ * in flight, and receive their echoes in order.
+ */
+static int echo_round(int fd, int window, int timeout, int verbose,
+		      struct _payload *i_payload, struct _payload *r_payload,
+		      unsigned long long *tsend, struct echo_stats *st)
+{
+	unsigned long sent = 0, rcvd = 0;
+	int bytes_sent, bytes_rcvd;
+	unsigned long long tend;
+	short events;
+	int ret;
+
+	while (rcvd < NUM_PAYLOADS) {
+		events = POLLIN;
+		/* Fill the window */
+		while (sent < NUM_PAYLOADS && sent - rcvd < (unsigned long)window) {
+			i_payload->num = sent;
+			i_payload->size = PAYLOAD_MIN_SIZE + sent;
+			tsend[sent % window] = now_ns();
+			bytes_sent = write(fd, i_payload,
+					   PAYLOAD_HDR_SIZE + i_payload->size);
+			if (bytes_sent < 0 && errno == EAGAIN) {
+				events |= POLLOUT;
+				break;
+			}
+			if (bytes_sent <= 0) {
+				perror("write");
+				return -errno;
+			}
+			if (verbose)
+				printf(" sent payload number %lu of size %d\r\n",
+				       i_payload->num, bytes_sent);
+			sent++;
+		}
+
+		ret = wait_fd(fd, events, timeout);
+		if (ret < 0)
+			return ret;
+		if (!(ret & POLLIN))
+			continue;
+
+		/* Drain the replies */
+		while (rcvd < sent) {
+			bytes_rcvd = read(fd, r_payload,
+					  PAYLOAD_HDR_SIZE + PAYLOAD_MAX_SIZE);
+			if (bytes_rcvd < 0 && errno == EAGAIN)
+				break;
+			if (bytes_rcvd <= 0) {
+				perror("read");
+				return -errno;
+			}
+			tend = now_ns();
+			if (verbose)
+				printf(" received payload number %lu of size %d\r\n",
+				       r_payload->num, bytes_rcvd);
+			st->err_cnt += check_payload(r_payload, bytes_rcvd, rcvd);
+			st->lat[st->nlat++] = tend - tsend[rcvd % window];
+			st->bytes += bytes_rcvd;
+			rcvd++;
+		}
+	}
+	return 0;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Value at the ppm parts per million of the sorted values */
+static unsigned long long percentile(const unsigned long long *v,
+				     unsigned long n, unsigned long ppm)
+{
+	unsigned long long rank = ((unsigned long long)n * ppm + 999999) / 1000000;
+
+	return v[rank ? rank - 1 : 0];
+}
+
+static void print_stats(struct echo_stats *st, unsigned long long elapsed,
+			int window)
+{
+	unsigned long long sum = 0;
+	unsigned long i;
+
+	if (!st->nlat || !elapsed)
+		return;
+	qsort(st->lat, st->nlat, sizeof(st->lat[0]), cmp_ull);
+	for (i = 0; i < st->nlat; i++)
+		sum += st->lat[i];
+
+	printf("\r\n %lu messages, window %d, %llu bytes in %llu.%06llu s\r\n",
+	       st->nlat, window, st->bytes, elapsed / NS_PER_S,
+	       (elapsed % NS_PER_S) / 1000);
+	printf(" throughput: %.0f msgs/s, %.3f MB/s\r\n",
+	       (double)st->nlat * NS_PER_S / elapsed,
+	       (double)st->bytes * NS_PER_S / elapsed / 1000000);
+	printf(" round trip (us): min %.1f avg %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f\r\n",
+	       st->lat[0] / 1000.0, (double)sum / st->nlat / 1000.0,
+	       percentile(st->lat, st->nlat, 500000) / 1000.0,
+	       percentile(st->lat, st->nlat, 900000) / 1000.0,
+	       percentile(st->lat, st->nlat, 990000) / 1000.0,
+	       percentile(st->lat, st->nlat, 999000) / 1000.0,
+	       st->lat[st->nlat - 1] / 1000.0);
+}
+
 int main(int argc, char *argv[])
 {
-	int ret, i, j;
-	int size, bytes_rcvd, bytes_sent, err_cnt = 0;
+	int ret, j;
 	int opt, charfd, fd;
 	int ntimes = 1;
+	int window = 1, timeout = TIMEOUT_DEF_MS, verbose = 0;
+	int round_err;
+	unsigned long long tstart, elapsed;
+	unsigned long long *tsend;
+	struct echo_stats st = { 0 };
 	char rpmsg_dev[NAME_MAX] = "virtio0.rpmsg-openamp-demo-channel.-1.0";
 	char rpmsg_ctrl_dev_name[NAME_MAX] = "virtio0.rpmsg_ctrl.0.0";
 	char rpmsg_char_name[16];
@@ -95,7 +295,7 @@ int main(int argc, char *argv[])
 	printf("\r\n Echo test start \r\n");
 	lookup_channel(rpmsg_dev, &eptinfo);
 
-	while ((opt = getopt(argc, argv, "d:c:n:s:e:")) != -1) {
+	while ((opt = getopt(argc, argv, "d:c:n:s:e:w:t:v")) != -1) {
 		switch (opt) {
 		case 'd':
 			memset(rpmsg_dev, 0, sizeof(rpmsg_dev));
@@ -114,12 +314,24 @@ int main(int argc, char *argv[])
 		case 'e':
 			eptinfo.dst = strtol(optarg, NULL, 10);
 			break;
+		case 'w':
+			window = strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			timeout = strtol(optarg, NULL, 10);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
 		default:
 			print_help();
 			return -EINVAL;
 		}
 	}
-
+	if (ntimes <= 0 || window <= 0 || window > WINDOW_MAX) {
+		print_help();
+		return -EINVAL;
+	}
 
 	sprintf(fpath, RPMSG_BUS_SYS "/devices/%s", rpmsg_dev);
 	if (access(fpath, F_OK)) {
@@ -145,11 +357,14 @@ int main(int argc, char *argv[])
 	ret = app_rpmsg_create_ept(charfd, &eptinfo);
 	if (ret) {
 		fprintf(stderr, "app_rpmsg_create_ept %s\n", strerror(errno));
+		close(charfd);
 		return -EINVAL;
 	}
 	if (!get_rpmsg_ept_dev_name(rpmsg_char_name, eptinfo.name,
-				    ept_dev_name))
+				    ept_dev_name)) {
+		close(charfd);
 		return -EINVAL;
+	}
 	sprintf(ept_dev_path, "/dev/%s", ept_dev_name);
 
 	printf("open %s\n", ept_dev_path);
@@ -160,83 +375,53 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	i_payload = (struct _payload *)malloc(2 * sizeof(unsigned long) + PAYLOAD_MAX_SIZE);
-	r_payload = (struct _payload *)malloc(2 * sizeof(unsigned long) + PAYLOAD_MAX_SIZE);
+	i_payload = (struct _payload *)malloc(PAYLOAD_HDR_SIZE + PAYLOAD_MAX_SIZE);
+	r_payload = (struct _payload *)malloc(PAYLOAD_HDR_SIZE + PAYLOAD_MAX_SIZE);
+	tsend = malloc(window * sizeof(*tsend));
+	st.lat = malloc((size_t)ntimes * NUM_PAYLOADS * sizeof(*st.lat));
 
-	if (i_payload == 0 || r_payload == 0) {
+	if (i_payload == 0 || r_payload == 0 || !tsend || !st.lat) {
 		printf("ERROR: Failed to allocate memory for payload.\n");
-		return -1;
+		ret = -ENOMEM;
+		goto out;
 	}
 
-	for (j=0; j < ntimes; j++){
-		printf("\r\n **********************************");
-		printf("****\r\n");
-		printf("\r\n  Echo Test Round %d \r\n", j);
-		printf("\r\n **********************************");
-		printf("****\r\n");
-		for (i = 0, size = PAYLOAD_MIN_SIZE; i < NUM_PAYLOADS;
-		i++, size++) {
-			int k;
-
-			i_payload->num = i;
-			i_payload->size = size;
-
-			/* Mark the data buffer. */
-			memset(&(i_payload->data[0]), 0xA5, size);
-
-			printf("\r\n sending payload number");
-			printf(" %ld of size %lu\r\n", i_payload->num,
-			(2 * sizeof(unsigned long)) + size);
-
-			bytes_sent = write(fd, i_payload,
-			(2 * sizeof(unsigned long)) + size);
-
-			if (bytes_sent <= 0) {
-				printf("\r\n Error sending data");
-				printf(" .. \r\n");
-				break;
-			}
-			printf("echo test: sent : %d\n", bytes_sent);
-
-			r_payload->num = 0;
-			bytes_rcvd = read(fd, r_payload,
-					(2 * sizeof(unsigned long)) + PAYLOAD_MAX_SIZE);
-			while (bytes_rcvd <= 0) {
-				usleep(10000);
-				bytes_rcvd = read(fd, r_payload,
-					(2 * sizeof(unsigned long)) + PAYLOAD_MAX_SIZE);
-			}
-			printf(" received payload number ");
-			printf("%ld of size %d\r\n", r_payload->num, bytes_rcvd);
-
-			/* Validate data buffer integrity. */
-			for (k = 0; k < r_payload->size; k++) {
-
-				if (r_payload->data[k] != 0xA5) {
-					printf(" \r\n Data corruption");
-					printf(" at index %d \r\n", k);
-					err_cnt++;
-					break;
-				}
-			}
-			bytes_rcvd = read(fd, r_payload,
-			(2 * sizeof(unsigned long)) + PAYLOAD_MAX_SIZE);
+	/* Mark the data buffer. */
+	memset(&(i_payload->data[0]), PAYLOAD_PATTERN, PAYLOAD_MAX_SIZE);
 
-		}
-		printf("\r\n **********************************");
-		printf("****\r\n");
+	tstart = now_ns();
+	for (j = 0; j < ntimes; j++) {
+		round_err = st.err_cnt;
+		ret = echo_round(fd, window, timeout, verbose, i_payload,
+				 r_payload, tsend, &st);
+		round_err = st.err_cnt - round_err;
 		printf("\r\n Echo Test Round %d Test Results: Error count = %d\r\n",
-		j, err_cnt);
-		printf("\r\n **********************************");
-		printf("****\r\n");
+		       j, round_err);
+		if (ret)
+			break;
 	}
+	elapsed = now_ns() - tstart;
+
+	printf("\r\n **********************************");
+	printf("****\r\n");
+	print_stats(&st, elapsed, window);
+	printf("\r\n Echo Test Results: Error count = %d\r\n", st.err_cnt);
+	printf("\r\n **********************************");
+	printf("****\r\n");
 
 	send_shutdown(fd);
+	/* A timed out or failed round, or corrupted echoes, fail the test */
+	if (!ret && st.err_cnt)
+		ret = -EIO;
+
+out:
 	free(i_payload);
 	free(r_payload);
+	free(tsend);
+	free(st.lat);
 
 	close(fd);
 	if (charfd >= 0)
 		close(charfd);
-	return 0;
+	return ret;
 }